@@ -0,0 +1,317 @@
+#include <string.h>
+#include <sys/random.h>
+#include "aead.h"
+
+#define ROTL32(v, n) ((v) << (n) | (v) >> (32 - (n)))
+
+#define QUARTER_ROUND(x, a, b, c, d)                  \
+    x[a] += x[b], x[d] = ROTL32(x[d] ^ x[a], 16),     \
+    x[c] += x[d], x[b] = ROTL32(x[b] ^ x[c], 12),     \
+    x[a] += x[b], x[d] = ROTL32(x[d] ^ x[a], 8),      \
+    x[c] += x[d], x[b] = ROTL32(x[b] ^ x[c], 7)
+
+#define POLY_MASK44 0xFFFFFFFFFFFULL
+#define POLY_MASK42 0x3FFFFFFFFFFULL
+
+static uint32_t load32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t load64(const unsigned char *p)
+{
+    return load32(p) | (uint64_t)load32(p + 4) << 32;
+}
+
+static void store32(unsigned char *p, uint32_t v)
+{
+    p[0] = v, p[1] = v >> 8, p[2] = v >> 16, p[3] = v >> 24;
+}
+
+static void store64(unsigned char *p, uint64_t v)
+{
+    store32(p, v);
+    store32(p + 4, v >> 32);
+}
+
+/* The 20 ChaCha rounds over a 16-word state */
+static void chacha_rounds(uint32_t x[16])
+{
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTER_ROUND(x, 0, 4, 8, 12);
+        QUARTER_ROUND(x, 1, 5, 9, 13);
+        QUARTER_ROUND(x, 2, 6, 10, 14);
+        QUARTER_ROUND(x, 3, 7, 11, 15);
+        QUARTER_ROUND(x, 0, 5, 10, 15);
+        QUARTER_ROUND(x, 1, 6, 11, 12);
+        QUARTER_ROUND(x, 2, 7, 8, 13);
+        QUARTER_ROUND(x, 3, 4, 9, 14);
+    }
+}
+
+/* Fill a state with the constants, 'key' and 4 input words */
+static void chacha_setup(uint32_t x[16], const uint32_t *key, const uint32_t *input)
+{
+    x[0] = 0x61707865, x[1] = 0x3320646E, x[2] = 0x79622D32, x[3] = 0x6B206574; // "expand 32-byte k"
+    memcpy(x + 4, key, 8 * sizeof(uint32_t));
+    memcpy(x + 12, input, 4 * sizeof(uint32_t));
+}
+
+/* One 64-byte keystream block; input is the block counter and the 3 nonce words */
+static void chacha20_block(const uint32_t *key, const uint32_t *input, unsigned char *out)
+{
+    uint32_t x[16], s[16];
+
+    chacha_setup(s, key, input);
+    memcpy(x, s, sizeof(x));
+    chacha_rounds(x);
+    for (int i = 0; i < 16; i++)
+        store32(out + 4 * i, x[i] + s[i]);
+}
+
+/* XOR 'len' bytes with the keystream from block 'counter' on */
+static void chacha20_xor(const uint32_t *key, uint32_t counter, const uint32_t *nonce, const char *in, char *out, size_t len)
+{
+    uint32_t input[4] = { counter, nonce[0], nonce[1], nonce[2] };
+    unsigned char stream[64];
+
+    for (size_t i = 0; i < len; i += 64, input[0]++)
+    {
+        size_t n = len - i < 64 ? len - i : 64;
+        chacha20_block(key, input, stream);
+        for (size_t j = 0; j < n; j++)
+            out[i + j] = in[i + j] ^ stream[j];
+    }
+}
+
+/* HChaCha20: 32 key bytes and 16 input bytes to 32 new key bytes */
+static void hchacha20(uint32_t *key, const uint32_t *input)
+{
+    uint32_t x[16];
+
+    chacha_setup(x, key, input);
+    chacha_rounds(x);
+    memcpy(key, x, 4 * sizeof(uint32_t));
+    memcpy(key + 4, x + 12, 4 * sizeof(uint32_t));
+}
+
+/* Poly1305 accumulator, 44/44/42-bit limbs */
+typedef struct
+{
+    uint64_t r[3], s[2], h[3];
+} Poly1305;
+
+static void poly1305_init(Poly1305 *st, const unsigned char *otk)
+{
+    uint64_t t0 = load64(otk), t1 = load64(otk + 8);
+
+    // Clamp r
+    st->r[0] = t0 & 0xFFC0FFFFFFFULL;
+    st->r[1] = (t0 >> 44 | t1 << 20) & 0xFFFFFC0FFFFULL;
+    st->r[2] = t1 >> 24 & 0x00FFFFFFC0FULL;
+    st->s[0] = load64(otk + 16);
+    st->s[1] = load64(otk + 24);
+    st->h[0] = st->h[1] = st->h[2] = 0;
+}
+
+/* Absorb whole 16-byte blocks; the AEAD zero-pads everything to blocks */
+static void poly1305_blocks(Poly1305 *st, const unsigned char *m, size_t len)
+{
+    const uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+    const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], c;
+
+    for (; len >= 16; m += 16, len -= 16)
+    {
+        uint64_t t0 = load64(m), t1 = load64(m + 8);
+        h0 += t0 & POLY_MASK44;
+        h1 += (t0 >> 44 | t1 << 20) & POLY_MASK44;
+        h2 += (t1 >> 24 & POLY_MASK42) | (uint64_t)1 << 40;
+
+        // h *= r mod 2^130 - 5
+        unsigned __int128 d0 = (unsigned __int128)h0 * r0 + (unsigned __int128)h1 * s2 + (unsigned __int128)h2 * s1;
+        unsigned __int128 d1 = (unsigned __int128)h0 * r1 + (unsigned __int128)h1 * r0 + (unsigned __int128)h2 * s2;
+        unsigned __int128 d2 = (unsigned __int128)h0 * r2 + (unsigned __int128)h1 * r1 + (unsigned __int128)h2 * r0;
+
+        c = (uint64_t)(d0 >> 44), h0 = (uint64_t)d0 & POLY_MASK44;
+        d1 += c, c = (uint64_t)(d1 >> 44), h1 = (uint64_t)d1 & POLY_MASK44;
+        d2 += c, c = (uint64_t)(d2 >> 42), h2 = (uint64_t)d2 & POLY_MASK42;
+        h0 += c * 5, c = h0 >> 44, h0 &= POLY_MASK44;
+        h1 += c;
+    }
+    st->h[0] = h0, st->h[1] = h1, st->h[2] = h2;
+}
+
+/* Fully reduce h, add s and write the tag */
+static void poly1305_finish(Poly1305 *st, unsigned char *tag)
+{
+    uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], c, g0, g1, g2;
+
+    c = h1 >> 44, h1 &= POLY_MASK44;
+    h2 += c, c = h2 >> 42, h2 &= POLY_MASK42;
+    h0 += c * 5, c = h0 >> 44, h0 &= POLY_MASK44;
+    h1 += c, c = h1 >> 44, h1 &= POLY_MASK44;
+    h2 += c, c = h2 >> 42, h2 &= POLY_MASK42;
+    h0 += c * 5, c = h0 >> 44, h0 &= POLY_MASK44;
+    h1 += c;
+
+    // h - p, kept when h >= p
+    g0 = h0 + 5, c = g0 >> 44, g0 &= POLY_MASK44;
+    g1 = h1 + c, c = g1 >> 44, g1 &= POLY_MASK44;
+    g2 = h2 + c - ((uint64_t)1 << 42);
+    c = (g2 >> 63) - 1;
+    h0 = (h0 & ~c) | (g0 & c);
+    h1 = (h1 & ~c) | (g1 & c);
+    h2 = (h2 & ~c) | (g2 & c);
+
+    // h + s mod 2^128
+    h0 += st->s[0] & POLY_MASK44, c = h0 >> 44, h0 &= POLY_MASK44;
+    h1 += ((st->s[0] >> 44 | st->s[1] << 20) & POLY_MASK44) + c, c = h1 >> 44, h1 &= POLY_MASK44;
+    h2 += (st->s[1] >> 24 & POLY_MASK42) + c, h2 &= POLY_MASK42;
+    store64(tag, h0 | h1 << 44);
+    store64(tag + 8, h1 >> 20 | h2 << 24);
+}
+
+/* Tag of a ciphertext without associated data (RFC 8439 section 2.8) */
+static void aead_tag(const uint32_t *key, const uint32_t *nonce, const char *ct, size_t len, unsigned char *tag)
+{
+    unsigned char otk[64], block[16] = { 0 };
+    uint32_t input[4] = { 0, nonce[0], nonce[1], nonce[2] };
+    Poly1305 st;
+
+    chacha20_block(key, input, otk);                        // Block 0 keys Poly1305
+    poly1305_init(&st, otk);
+    poly1305_blocks(&st, (const unsigned char *)ct, len & ~(size_t)15);
+    if (len & 15)
+    {
+        memcpy(block, ct + (len & ~(size_t)15), len & 15);
+        poly1305_blocks(&st, block, 16);
+    }
+    store64(block, 0);                                      // Associated data length
+    store64(block + 8, len);
+    poly1305_blocks(&st, block, 16);
+    poly1305_finish(&st, tag);
+}
+
+/* Nonce of chunk 'index': final-chunk flag, then the 64-bit index */
+static void chunk_nonce(uint32_t *nonce, size_t plain, size_t index)
+{
+    size_t chunks = plain == 0 ? 1 : (plain + AEAD_CHUNK_SIZE - 1) / AEAD_CHUNK_SIZE;
+
+    nonce[0] = index + 1 == chunks;
+    nonce[1] = (uint32_t)index;
+    nonce[2] = (uint32_t)((uint64_t)index >> 32);
+}
+
+/* Fill 'salt' with AEAD_SALT_SIZE random bytes */
+Status aead_random_salt(unsigned char *salt)
+{
+    return getrandom(salt, AEAD_SALT_SIZE, 0) == AEAD_SALT_SIZE ? e_success : e_failure;
+}
+
+/* Derive the chunk key from a passphrase and the stream's salt
+ * The passphrase is absorbed 32 bytes at a time with HChaCha20, then
+ * stretched by AEAD_KDF_ROUNDS more calls; each call mixes in the salt
+ */
+void aead_derive_key(AeadKey *key, const char *passphrase, const unsigned char *salt)
+{
+    size_t len = strlen(passphrase);
+    uint32_t input[4], step = 0;
+
+    memset(key, 0, sizeof(*key));
+    for (size_t i = 0; i <= len; i += 32)
+    {
+        unsigned char block[32] = { 0 };
+        memcpy(block, passphrase + i, len - i < 32 ? len - i : 32);
+        for (int w = 0; w < 8; w++)
+            key->key[w] ^= load32(block + 4 * w);
+        for (int w = 0; w < 4; w++)
+            input[w] = load32(salt + 4 * w);
+        input[0] ^= step++;
+        input[3] ^= len;
+        hchacha20(key->key, input);
+    }
+    for (int r = 0; r < AEAD_KDF_ROUNDS; r++)
+    {
+        input[0] = load32(salt) ^ step++;
+        hchacha20(key->key, input);
+    }
+}
+
+/* Record bytes for 'plain' secret bytes: chunks plus one tag each */
+size_t aead_records_size(size_t plain)
+{
+    size_t chunks = plain == 0 ? 1 : (plain + AEAD_CHUNK_SIZE - 1) / AEAD_CHUNK_SIZE;
+    return plain + chunks * AEAD_TAG_SIZE;
+}
+
+/* Sealed stream bytes for 'plain' secret bytes, salt included */
+size_t aead_stream_size(size_t plain)
+{
+    return AEAD_SALT_SIZE + aead_records_size(plain);
+}
+
+/* Secret bytes behind a sealed stream of 'sealed' bytes, -1 if no stream has that size */
+long aead_plain_size(size_t sealed)
+{
+    if (sealed < AEAD_SALT_SIZE + AEAD_TAG_SIZE)
+        return -1;
+
+    size_t body = sealed - AEAD_SALT_SIZE, full = body / AEAD_RECORD_SIZE, rest = body % AEAD_RECORD_SIZE;
+    if (rest == 0)
+        return full * AEAD_CHUNK_SIZE;
+    if (rest < AEAD_TAG_SIZE || (rest == AEAD_TAG_SIZE && full > 0))
+        return -1;                                          // Only an empty secret has an empty record
+    return full * AEAD_CHUNK_SIZE + rest - AEAD_TAG_SIZE;
+}
+
+/* Seal secret bytes [begin, end) of a 'plain' byte secret */
+void aead_seal_range(const AeadKey *key, size_t plain, size_t begin, size_t end, const char *in, char *out)
+{
+    uint32_t nonce[3];
+
+    if (begin == end && plain != 0)
+        return;                                                 // Empty slice; only an empty secret has an empty chunk
+
+    do
+    {
+        size_t len = end - begin < AEAD_CHUNK_SIZE ? end - begin : AEAD_CHUNK_SIZE;
+        chunk_nonce(nonce, plain, begin / AEAD_CHUNK_SIZE);
+        chacha20_xor(key->key, 1, nonce, in, out, len);
+        aead_tag(key->key, nonce, out, len, (unsigned char *)out + len);
+
+        begin += len;
+        in += len;
+        out += len + AEAD_TAG_SIZE;
+    } while (begin < end);
+}
+
+/* Open the records of secret bytes [begin, end) of a 'plain' byte secret */
+Status aead_open_range(const AeadKey *key, size_t plain, size_t begin, size_t end, const char *in, char *out)
+{
+    uint32_t nonce[3];
+    unsigned char tag[AEAD_TAG_SIZE];
+
+    if (begin == end && plain != 0)
+        return e_success;                                       // Empty slice; only an empty secret has an empty chunk
+
+    do
+    {
+        size_t len = end - begin < AEAD_CHUNK_SIZE ? end - begin : AEAD_CHUNK_SIZE;
+        unsigned char diff = 0;
+
+        chunk_nonce(nonce, plain, begin / AEAD_CHUNK_SIZE);
+        aead_tag(key->key, nonce, in, len, tag);
+        for (int i = 0; i < AEAD_TAG_SIZE; i++)             // Constant time compare
+            diff |= tag[i] ^ (unsigned char)in[len + i];
+        if (diff != 0)
+            return e_failure;
+        chacha20_xor(key->key, 1, nonce, in, out, len);
+
+        begin += len;
+        in += len + AEAD_TAG_SIZE;
+        out += len;
+    } while (begin < end);
+    return e_success;
+}
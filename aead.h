@@ -0,0 +1,55 @@
+#ifndef AEAD_H
+#define AEAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Chunked ChaCha20-Poly1305 (RFC 8439) for the secret data
+ * Sealed stream: [salt][record 0][record 1]...
+ * Record n holds up to AEAD_CHUNK_SIZE ciphertext bytes of chunk n and its
+ * 16-byte tag. The nonce carries the chunk index and a final-chunk flag,
+ * so records cannot be reordered, dropped or cut off unnoticed.
+ * An empty secret still gets one (empty) final record.
+ */
+
+#define AEAD_KEY_SIZE 32
+#define AEAD_SALT_SIZE 16
+#define AEAD_TAG_SIZE 16
+#define AEAD_CHUNK_SIZE (64 * 1024)
+#define AEAD_RECORD_SIZE (AEAD_CHUNK_SIZE + AEAD_TAG_SIZE)
+#define AEAD_BATCH_CHUNKS 4 // chunks per worker thread sealed or opened at a time
+#define AEAD_KDF_ROUNDS (1 << 16) // passphrase stretching iterations
+
+typedef struct _AeadKey
+{
+    uint32_t key[AEAD_KEY_SIZE / 4];
+} AeadKey;
+
+/* Fill 'salt' with AEAD_SALT_SIZE random bytes */
+Status aead_random_salt(unsigned char *salt);
+
+/* Derive the chunk key from a passphrase and the stream's salt */
+void aead_derive_key(AeadKey *key, const char *passphrase, const unsigned char *salt);
+
+/* Record bytes for 'plain' secret bytes: chunks plus one tag each */
+size_t aead_records_size(size_t plain);
+
+/* Sealed stream bytes for 'plain' secret bytes, salt included */
+size_t aead_stream_size(size_t plain);
+
+/* Secret bytes behind a sealed stream of 'sealed' bytes, -1 if no stream has that size */
+long aead_plain_size(size_t sealed);
+
+/* Seal secret bytes [begin, end) of a 'plain' byte secret
+ * begin is a multiple of AEAD_CHUNK_SIZE; 'out' receives their records
+ */
+void aead_seal_range(const AeadKey *key, size_t plain, size_t begin, size_t end, const char *in, char *out);
+
+/* Open the records of secret bytes [begin, end) of a 'plain' byte secret
+ * Return Value: e_failure if any tag does not match (nothing is trusted then)
+ */
+Status aead_open_range(const AeadKey *key, size_t plain, size_t begin, size_t end, const char *in, char *out);
+
+#endif
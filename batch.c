@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "batch.h"
+
+/* State shared by the worker pool */
+typedef struct
+{
+    FILE *manifest;
+    pthread_mutex_t lock; // guards manifest, line_no, failed and stdout
+    long line_no;
+    int failed;
+    const EncodeInfo *enc_template;
+    const DecodeInfo *dec_template;
+} BatchJob;
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Print a string as a JSON string literal */
+void print_json_string(const char *str)
+{
+    putchar('"');
+    for (; str && *str; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            printf("\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            printf("\\u%04x", *str);
+        else
+            putchar(*str);
+    }
+    putchar('"');
+}
+
+/* Split a manifest line into at most 5 fields
+ * Return Value: number of fields
+ */
+static int split_line(char *line, char *fields[5])
+{
+    char *save;
+    int count = 0;
+
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok && count < 5; tok = strtok_r(NULL, " \t\r\n", &save))
+        fields[count++] = tok;
+    return count;
+}
+
+/* Run one manifest line, reusing the worker's encoder buffers */
+static Status run_line(char *line, BatchJob *job, EncodeInfo *encInfo, long line_no)
+{
+    char *fields[5];
+    char *argv[6] = { "batch", "-e", NULL, NULL, NULL, NULL };
+    const char *op = "encode", *input = NULL, *output = NULL;
+    struct timespec start;
+    Status status = e_failure;
+
+    int count = split_line(line, fields);
+    if (count == 0 || fields[0][0] == '#')
+        return e_success;                                   // Blank or comment
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (strcmp(fields[0], "-d") == 0 && count == 3)
+    {
+        DecodeInfo decInfo = *job->dec_template;
+
+        op = "decode";
+        argv[1] = "-d";
+        argv[2] = fields[1];
+        argv[3] = fields[2];
+        input = fields[1];
+        output = fields[2];
+        if (read_and_validate_decode_args(argv, &decInfo) == e_success)
+        {
+            status = do_decoding(&decInfo);
+            if (decInfo.out_fname != fields[2])
+                free(decInfo.out_fname);                    // Name with decoded extension
+        }
+    }
+    else if (strcmp(fields[0], "-e") == 0 ? count == 4 : count == 3)
+    {
+        int first = strcmp(fields[0], "-e") == 0;
+
+        argv[2] = fields[first];
+        argv[3] = fields[first + 1];
+        argv[4] = fields[first + 2];
+        input = fields[first];
+        output = fields[first + 2];
+        if (read_and_validate_encode_args(argv, encInfo) == e_success)
+            status = do_encoding(encInfo);
+    }
+    else
+    {
+        op = "invalid";
+    }
+
+    double ms = elapsed_ms(&start);
+
+    // One report line per job
+    pthread_mutex_lock(&job->lock);
+    printf("{\"line\":%ld,\"op\":\"%s\",\"input\":", line_no, op);
+    print_json_string(input);
+    printf(",\"output\":");
+    print_json_string(output);
+    printf(",\"status\":\"%s\",\"ms\":%.3f}\n", status == e_success ? "ok" : "error", ms);
+    fflush(stdout);
+    if (status == e_failure)
+        job->failed = 1;
+    pthread_mutex_unlock(&job->lock);
+
+    return status;
+}
+
+/* Worker: pull manifest lines until none are left */
+static void *batch_worker(void *arg)
+{
+    BatchJob *job = arg;
+    EncodeInfo encInfo = *job->enc_template;
+    char line[MAX_MANIFEST_LINE];
+
+    // The block buffer survives from one job to the next
+    encInfo.io_buf = NULL;
+    encInfo.keep_io_buf = 1;
+    encInfo.quiet = 1;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        char *got = fgets(line, sizeof(line), job->manifest);
+        long line_no = ++job->line_no;
+        pthread_mutex_unlock(&job->lock);
+
+        if (got == NULL)
+            break;
+        run_line(line, job, &encInfo, line_no);
+    }
+
+    free(encInfo.io_buf);
+    return NULL;
+}
+
+/* Run every job of the manifest on 'jobs' worker threads */
+Status run_batch(FILE *manifest, int jobs, const EncodeInfo *enc_template, const DecodeInfo *dec_template)
+{
+    BatchJob job = { manifest, PTHREAD_MUTEX_INITIALIZER, 0, 0, enc_template, dec_template };
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > MAX_THREADS)
+        jobs = MAX_THREADS;
+
+    for (int i = 1; i < jobs; i++)
+    {
+        if (pthread_create(&tids[started], NULL, batch_worker, &job) == 0)
+            started++;
+    }
+    batch_worker(&job);                                     // Calling thread works too
+
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    return job.failed ? e_failure : e_success;
+}
@@ -0,0 +1,29 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "types.h" // Contains user defined types
+#include "encode.h"
+#include "decode.h"
+
+/*
+ * Batch mode: run many encode/decode jobs in one process
+ * Manifest lines (blank lines and # comments are skipped):
+ *   <source.bmp> <secret.txt> <stego.bmp>        encode
+ *   -e <source.bmp> <secret.txt> <stego.bmp>     encode
+ *   -d <stego.bmp> <output>                      decode
+ * One JSON line per job is printed on stdout
+ */
+
+#define MAX_MANIFEST_LINE 4096
+
+/* Run every job of the manifest on 'jobs' worker threads
+ * enc_template/dec_template carry the options applied to each job
+ * Return Value: e_failure if the manifest could not be read or any job failed
+ */
+Status run_batch(FILE *manifest, int jobs, const EncodeInfo *enc_template, const DecodeInfo *dec_template);
+
+/* Print a string as a JSON string literal */
+void print_json_string(const char *str);
+
+#endif
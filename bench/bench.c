@@ -0,0 +1,397 @@
+/*
+ * Benchmark harness for the encode/decode pipeline
+ * Build: gcc -O2 -I. bench/bench.c encode.c decode.c lsb.c parallel.c bmp.c scatter.c aead.c pack.c crc.c stego.c uring.c pipeline.c stats.c -pthread -o bench_stego
+ * Usage: ./bench_stego [--sizes 64K,1M,16M,256M] [--reps N] [--threads 1,4]
+ *                      [--io stdio,mmap,uring,pipeline] [--kernels scalar,sse2,avx2]
+ *                      [--payload-ratio R] [--dir DIR] [--csv]
+ *
+ * Generates synthetic 24-bit BMPs and payloads, runs every stage of
+ * do_encoding/do_decoding with its own timer and reports throughput
+ * (carrier MB/s) and p50/p99 latency per strategy and kernel.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "encode.h"
+#include "decode.h"
+#include "common.h"
+#include "uring.h"
+#include "lsb.h"
+
+#define MAX_LIST 16
+#define MAX_REPS 1000
+
+/* Encode stages, in do_encoding order */
+enum { ES_OPEN, ES_CAPACITY, ES_HEADER, ES_STEGO, ES_DATA, ES_TAIL, ES_CLOSE, ES_COUNT };
+static const char *enc_stage_names[ES_COUNT] = { "open", "capacity", "header", "stego", "data", "tail", "close" };
+
+/* Decode stages, in do_decoding order */
+enum { DS_OPEN, DS_HEADER, DS_STEGO, DS_DATA, DS_CLOSE, DS_COUNT };
+static const char *dec_stage_names[DS_COUNT] = { "open", "header", "stego", "data", "close" };
+
+typedef struct
+{
+    size_t sizes[MAX_LIST];
+    int n_sizes;
+    int threads[MAX_LIST];
+    int n_threads;
+    IOMode io[MAX_LIST];
+    int n_io;
+    KernelType kernels[MAX_LIST];
+    int n_kernels;
+    int reps;
+    double payload_ratio;
+    const char *dir;
+    int csv;
+} BenchConfig;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Percentile of a sorted sample */
+static double percentile(const double *sorted, int n, double q)
+{
+    int idx = (int)(q * n + 0.999999) - 1;
+    if (idx < 0)
+        idx = 0;
+    if (idx >= n)
+        idx = n - 1;
+    return sorted[idx];
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Parse a size with an optional K/M/G suffix */
+static size_t parse_size(const char *arg)
+{
+    char *end;
+    size_t n = strtoull(arg, &end, 10);
+
+    if (*end == 'K' || *end == 'k')
+        n <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        n <<= 20;
+    else if (*end == 'G' || *end == 'g')
+        n <<= 30;
+    return n;
+}
+
+static const char *io_name(IOMode io)
+{
+    return io == e_io_mmap ? "mmap" : io == e_io_stdio ? "stdio" : io == e_io_uring ? "uring" :
+           io == e_io_pipeline ? "pipeline" : "auto";
+}
+
+/* Write a synthetic 24-bit BMP with about 'bytes' of pixel data */
+static int make_bmp(const char *path, size_t bytes)
+{
+    uint32_t width = 1024, height = bytes / (width * 3);
+    if (height == 0)
+        height = 1;
+
+    uint32_t image_size = width * 3 * height, file_size = 54 + image_size;
+    unsigned char header[54] = { 'B', 'M' };
+    uint32_t fields[] = { file_size, 0, 54, 40, width, height };
+    memcpy(header + 2, fields, sizeof(fields));
+    header[26] = 1;                                         // planes
+    header[28] = 24;                                        // bits per pixel
+    memcpy(header + 34, &image_size, 4);
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return 0;
+    fwrite(header, 1, 54, fp);
+
+    // xorshift noise, written block by block so GB images stay cheap
+    static unsigned char block[1 << 20];
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t left = image_size; left > 0;)
+    {
+        size_t n = left < sizeof(block) ? left : sizeof(block);
+        for (size_t i = 0; i < n; i++)
+        {
+            state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+            block[i] = state;
+        }
+        fwrite(block, 1, n, fp);
+        left -= n;
+    }
+    fclose(fp);
+    return 1;
+}
+
+/* Write 'bytes' of printable payload */
+static int make_secret(const char *path, size_t bytes)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return 0;
+    for (size_t i = 0; i < bytes; i++)
+        fputc('a' + (i * 7 + i / 13) % 26, fp);
+    fclose(fp);
+    return 1;
+}
+
+/* One timed encode, stage by stage as in do_encoding */
+static Status timed_encode(EncodeInfo *encInfo, double stage[ES_COUNT])
+{
+    Status status = e_failure;
+    double t = now_sec(), t2;
+
+#define LAP(s) (t2 = now_sec(), stage[s] = t2 - t, t = t2)
+    if (open_files(encInfo) == e_success)
+    {
+        Status ready = encInfo->io_mode == e_io_mmap ? map_files(encInfo) : alloc_io_buffer(encInfo);
+        if (encInfo->io_mode == e_io_mmap && encInfo->chunk_size == 0)
+            encInfo->chunk_size = DEFAULT_CHUNK_SIZE;
+        LAP(ES_OPEN);
+        if (ready == e_success &&
+            check_capacity(encInfo) == e_success && (LAP(ES_CAPACITY), 1) &&
+            copy_bmp_header(encInfo) == e_success && (LAP(ES_HEADER), 1) &&
+            encode_stego_header(encInfo) == e_success && (LAP(ES_STEGO), 1) &&
+            encode_secret_file_data(encInfo) == e_success && (LAP(ES_DATA), 1) &&
+            copy_remaining_img_data(encInfo) == e_success && (LAP(ES_TAIL), 1))
+            status = e_success;
+    }
+    close_files(encInfo);
+    LAP(ES_CLOSE);
+    return status;
+}
+
+/* One timed decode, stage by stage as in do_decoding */
+static Status timed_decode(DecodeInfo *decInfo, const char *out_path, double stage[DS_COUNT])
+{
+    Status status = e_failure;
+    double t = now_sec(), t2;
+
+    decInfo->fptr_op_image = decInfo->out_secret = NULL;
+    decInfo->op_map = decInfo->out_map = NULL;
+    if (open_decode_files(decInfo) == e_success)
+    {
+        if (decInfo->io_mode == e_io_mmap)
+            map_decode_files(decInfo);
+        LAP(DS_OPEN);
+        if (skip_bmp_header(decInfo) == e_success && (LAP(DS_HEADER), 1) &&
+            decode_stego_header(decInfo) == e_success && (LAP(DS_STEGO), 1) &&
+            (decInfo->out_secret = fopen(out_path, "w+")) != NULL &&
+            decode_secret_file_data(decInfo) == e_success && (LAP(DS_DATA), 1))
+            status = e_success;
+    }
+    close_decode_files(decInfo);
+    LAP(DS_CLOSE);
+#undef LAP
+    return status;
+}
+
+/* Print throughput, latency and per-stage medians for one configuration */
+static void report(const BenchConfig *cfg, const char *op, size_t image_bytes, size_t secret_bytes,
+                   IOMode io, int threads, double *total, double stages[][ES_COUNT], const char **names, int n_stages)
+{
+    int reps = cfg->reps;
+    double sorted[MAX_REPS];
+
+    memcpy(sorted, total, reps * sizeof(double));
+    qsort(sorted, reps, sizeof(double), cmp_double);
+    double p50 = percentile(sorted, reps, 0.50), p99 = percentile(sorted, reps, 0.99);
+    double mbps = image_bytes / p50 / 1e6;
+
+    if (cfg->csv)
+        printf("%s,%zu,%zu,%s,%s,%d,%.1f,%.3f,%.3f", op, image_bytes, secret_bytes, io_name(io),
+               lsb_kernel_name(), threads, mbps, p50 * 1e3, p99 * 1e3);
+    else
+        printf("%-6s %9zu %9zu %-8s %-6s %2d %9.1f MB/s  p50 %9.3f ms  p99 %9.3f ms |", op, image_bytes,
+               secret_bytes, io_name(io), lsb_kernel_name(), threads, mbps, p50 * 1e3, p99 * 1e3);
+
+    for (int s = 0; s < n_stages; s++)
+    {
+        for (int r = 0; r < reps; r++)
+            sorted[r] = stages[r][s];
+        qsort(sorted, reps, sizeof(double), cmp_double);
+        if (cfg->csv)
+            printf(",%s=%.1f", names[s], percentile(sorted, reps, 0.50) * 1e6);
+        else
+            printf(" %s %.0fus", names[s], percentile(sorted, reps, 0.50) * 1e6);
+    }
+    printf("\n");
+}
+
+/* Run the full matrix for one carrier size */
+static void bench_size(const BenchConfig *cfg, size_t size)
+{
+    char image_path[512], secret_path[512], stego_path[512], out_path[512];
+    static double enc_total[MAX_REPS], dec_total[MAX_REPS];
+    static double enc_stage[MAX_REPS][ES_COUNT], dec_stage[MAX_REPS][ES_COUNT];
+
+    snprintf(image_path, sizeof(image_path), "%s/bench_%d_carrier.bmp", cfg->dir, (int)getpid());
+    snprintf(secret_path, sizeof(secret_path), "%s/bench_%d_secret.txt", cfg->dir, (int)getpid());
+    snprintf(stego_path, sizeof(stego_path), "%s/bench_%d_stego.bmp", cfg->dir, (int)getpid());
+    snprintf(out_path, sizeof(out_path), "%s/bench_%d_out.txt", cfg->dir, (int)getpid());
+
+    // Payload sized to a fraction of the carrier's LSB capacity
+    size_t secret_bytes = (size_t)(size / 8 * cfg->payload_ratio);
+    if (!make_bmp(image_path, size) || !make_secret(secret_path, secret_bytes))
+    {
+        fprintf(stderr, "ERROR: Unable to create fixtures in %s\n", cfg->dir);
+        return;
+    }
+
+    for (int k = 0; k < cfg->n_kernels; k++)
+    {
+        if (lsb_select_kernel(cfg->kernels[k]) == e_failure)
+            continue;                                       // CPU lacks this kernel
+        for (int i = 0; i < cfg->n_io; i++)
+        {
+            for (int t = 0; t < cfg->n_threads; t++)
+            {
+                int ok = 1;
+                for (int r = 0; r < cfg->reps && ok; r++)
+                {
+                    EncodeInfo encInfo;
+                    DecodeInfo decInfo;
+
+                    memset(&encInfo, 0, sizeof(encInfo));
+                    encInfo.src_image_fname = image_path;
+                    encInfo.secret_fname = secret_path;
+                    encInfo.stego_image_fname = stego_path;
+                    strcpy(encInfo.extn_secret_file, ".txt");
+                    encInfo.io_mode = cfg->io[i];
+                    encInfo.threads = cfg->threads[t];
+                    encInfo.quiet = 1;
+
+                    double start = now_sec();
+                    ok = timed_encode(&encInfo, enc_stage[r]) == e_success;
+                    enc_total[r] = now_sec() - start;
+
+                    memset(&decInfo, 0, sizeof(decInfo));
+                    decInfo.op_image_fname = stego_path;
+                    decInfo.io_mode = cfg->io[i];
+                    decInfo.threads = cfg->threads[t];
+
+                    start = now_sec();
+                    ok = ok && timed_decode(&decInfo, out_path, dec_stage[r]) == e_success;
+                    dec_total[r] = now_sec() - start;
+                }
+                if (!ok)
+                {
+                    fprintf(stderr, "ERROR: Round trip failed for %zu bytes, io=%s\n", size, io_name(cfg->io[i]));
+                    continue;
+                }
+                report(cfg, "encode", size, secret_bytes, cfg->io[i], cfg->threads[t], enc_total, enc_stage,
+                       enc_stage_names, ES_COUNT);
+                report(cfg, "decode", size, secret_bytes, cfg->io[i], cfg->threads[t], dec_total, dec_stage,
+                       dec_stage_names, DS_COUNT);
+            }
+        }
+    }
+
+    remove(image_path);
+    remove(secret_path);
+    remove(stego_path);
+    remove(out_path);
+}
+
+/* Split a comma separated option value */
+static int split_list(char *arg, char *items[MAX_LIST])
+{
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
+        items[n++] = tok;
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig cfg = {
+        .sizes = { 64 << 10, 1 << 20, 16 << 20, 128 << 20 }, .n_sizes = 4,
+        .threads = { 1 }, .n_threads = 1,
+        .io = { e_io_stdio, e_io_mmap }, .n_io = 2,
+        .kernels = { e_kernel_scalar, e_kernel_sse2, e_kernel_avx2 }, .n_kernels = 3,
+        .reps = 5, .payload_ratio = 0.5, .dir = "/tmp",
+    };
+    char *items[MAX_LIST];
+
+    for (int i = 1; i < argc; i++)
+    {
+        int has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "--sizes") == 0 && has_value)
+        {
+            cfg.n_sizes = split_list(argv[++i], items);
+            for (int j = 0; j < cfg.n_sizes; j++)
+                cfg.sizes[j] = parse_size(items[j]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+        {
+            cfg.n_threads = split_list(argv[++i], items);
+            for (int j = 0; j < cfg.n_threads; j++)
+                cfg.threads[j] = atoi(items[j]);
+        }
+        else if (strcmp(argv[i], "--io") == 0 && has_value)
+        {
+            cfg.n_io = split_list(argv[++i], items);
+            for (int j = 0; j < cfg.n_io; j++)
+            {
+                cfg.io[j] = strcmp(items[j], "mmap") == 0 ? e_io_mmap : strcmp(items[j], "uring") == 0 ? e_io_uring :
+                            strcmp(items[j], "pipeline") == 0 ? e_io_pipeline : e_io_stdio;
+                if (cfg.io[j] == e_io_uring && !uring_available())
+                {
+                    fprintf(stderr, "io_uring unavailable, uring runs use stdio\n");
+                    cfg.io[j] = e_io_stdio;
+                }
+            }
+        }
+        else if (strcmp(argv[i], "--kernels") == 0 && has_value)
+        {
+            cfg.n_kernels = split_list(argv[++i], items);
+            for (int j = 0; j < cfg.n_kernels; j++)
+                cfg.kernels[j] = strcmp(items[j], "avx2") == 0 ? e_kernel_avx2 :
+                                 strcmp(items[j], "sse2") == 0 ? e_kernel_sse2 : e_kernel_scalar;
+        }
+        else if (strcmp(argv[i], "--reps") == 0 && has_value)
+        {
+            cfg.reps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--payload-ratio") == 0 && has_value)
+        {
+            cfg.payload_ratio = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dir") == 0 && has_value)
+        {
+            cfg.dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--csv") == 0)
+        {
+            cfg.csv = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--sizes LIST] [--reps N] [--threads LIST] [--io LIST] "
+                            "[--kernels LIST] [--payload-ratio R] [--dir DIR] [--csv]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (cfg.reps < 1 || cfg.reps > MAX_REPS || cfg.payload_ratio <= 0 || cfg.payload_ratio > 0.99)
+    {
+        fprintf(stderr, "ERROR: reps must be 1..%d and payload ratio in (0, 0.99]\n", MAX_REPS);
+        return 1;
+    }
+
+    if (cfg.csv)
+        printf("op,image_bytes,secret_bytes,io,kernel,threads,mb_per_s,p50_ms,p99_ms,stage_p50_us...\n");
+
+    for (int s = 0; s < cfg.n_sizes; s++)
+        bench_size(&cfg, cfg.sizes[s]);
+    return 0;
+}
@@ -0,0 +1,296 @@
+#include <string.h>
+#include "bmp.h"
+#include "lsb.h"
+
+/* Carrier bytes staged at a time when pixels hold bytes that carry nothing:
+ * 1024 BGR pixels, whole kernel units at every depth
+ */
+#define BMP_GATHER_SIZE 3072
+
+/* Read a little-endian 32-bit header field */
+static uint read_le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+/* Parse the first BMP_HEADER_SIZE bytes of an image */
+Status bmp_parse(const unsigned char *header, BmpInfo *bmp)
+{
+    uint info_size = read_le32(header + 14);
+    int height = (int)read_le32(header + 22);
+    uint compression = read_le32(header + 30);
+
+    memset(bmp, 0, sizeof(*bmp));
+    if (header[0] != 'B' || header[1] != 'M' || info_size < 40)
+        return e_failure;
+
+    bmp->pixel_offset = read_le32(header + 10);
+    bmp->width = read_le32(header + 18);
+    bmp->top_down = height < 0;
+    bmp->height = height < 0 ? -(uint)height : (uint)height;
+    bmp->bits_per_pixel = header[28] | header[29] << 8;
+
+    // BI_RGB, or BI_BITFIELDS which only adds channel masks
+    if ((compression != 0 && compression != 3) ||
+        (bmp->bits_per_pixel != 8 && bmp->bits_per_pixel != 24 && bmp->bits_per_pixel != 32) ||
+        bmp->pixel_offset < 14 || bmp->pixel_offset - 14 < info_size || bmp->width == 0 || bmp->height == 0)
+        return e_failure;
+
+    // 32 bpp: the fourth byte is alpha (or unused), kept out of the carrier by default
+    bmp->pixel_bytes = bmp->bits_per_pixel / 8;
+    bmp->carrier_bytes = bmp->pixel_bytes == 4 ? 3 : bmp->pixel_bytes;
+    bmp->row_bytes = (size_t)bmp->width * bmp->carrier_bytes;
+    bmp->stride = ((size_t)bmp->width * bmp->pixel_bytes + 3) & ~(size_t)3;
+    bmp->usable = bmp->row_bytes * bmp->height;
+    return e_success;
+}
+
+/* Treat the pixel data from 'pixel_offset' on as one unpadded run */
+void bmp_set_flat(BmpInfo *bmp, size_t pixel_offset)
+{
+    bmp->pixel_offset = pixel_offset;
+    bmp->pixel_bytes = bmp->carrier_bytes = 1;
+    bmp->stride = bmp->row_bytes;
+}
+
+/* Check whether carrier bytes run through the file without gaps */
+int bmp_is_flat(const BmpInfo *bmp)
+{
+    return bmp->stride == bmp->row_bytes && bmp->pixel_bytes == bmp->carrier_bytes;
+}
+
+/* Let the alpha bytes of a 32 bpp image carry data too */
+Status bmp_use_alpha(BmpInfo *bmp)
+{
+    if (bmp->pixel_bytes != 4)
+        return e_failure;
+
+    bmp->carrier_bytes = 4;
+    bmp->row_bytes = (size_t)bmp->width * 4;
+    bmp->usable = bmp->row_bytes * bmp->height;
+    return e_success;
+}
+
+/* Check whether rows carry padding bytes */
+int bmp_has_padding(const BmpInfo *bmp)
+{
+    return bmp->stride != (size_t)bmp->width * bmp->pixel_bytes;
+}
+
+/* File offset of carrier byte 'pos' */
+size_t bmp_file_offset(const BmpInfo *bmp, size_t pos)
+{
+    if (bmp_is_flat(bmp))
+        return bmp->pixel_offset + pos;
+
+    size_t col = pos % bmp->row_bytes;
+    if (bmp->pixel_bytes != bmp->carrier_bytes)
+        col = col / bmp->carrier_bytes * bmp->pixel_bytes + col % bmp->carrier_bytes;
+    return bmp->pixel_offset + pos / bmp->row_bytes * bmp->stride + col;
+}
+
+/* File offset just past carrier byte pos - 1 (pixel_offset for pos 0) */
+size_t bmp_file_end(const BmpInfo *bmp, size_t pos)
+{
+    return pos == 0 ? bmp->pixel_offset : bmp_file_offset(bmp, pos - 1) + 1;
+}
+
+/* Carrier bytes stored before file offset 'off' */
+size_t bmp_carrier_pos(const BmpInfo *bmp, size_t off)
+{
+    if (off <= bmp->pixel_offset)
+        return 0;
+    off -= bmp->pixel_offset;
+    if (bmp_is_flat(bmp))
+        return off;
+
+    size_t col = off % bmp->stride, in_pixel = col % bmp->pixel_bytes;
+    col = col / bmp->pixel_bytes * bmp->carrier_bytes + (in_pixel < bmp->carrier_bytes ? in_pixel : bmp->carrier_bytes);
+    return off / bmp->stride * bmp->row_bytes + (col < bmp->row_bytes ? col : bmp->row_bytes);
+}
+
+/* Most file bytes that 'len' consecutive carrier bytes can span */
+size_t bmp_file_span_max(const BmpInfo *bmp, size_t len)
+{
+    return (len / bmp->carrier_bytes + 1) * bmp->pixel_bytes +
+           (len / bmp->row_bytes + 1) * (bmp->stride - (size_t)bmp->width * bmp->pixel_bytes);
+}
+
+/* Copy carrier bytes [pos, pos + len) of 'buf' to 'dst' (to_buf 0) or back (to_buf 1)
+ * 32 bpp without alpha: three of every four bytes, a fixed pattern the compiler vectorizes
+ */
+static void gather_scatter(const BmpInfo *bmp, char *buf, size_t buf_off, size_t pos, char *dst, size_t len, int to_buf)
+{
+    while (len > 0)
+    {
+        size_t col = pos % bmp->row_bytes, count = bmp->row_bytes - col;
+        if (count > len)
+            count = len;
+
+        char *src = buf + bmp->pixel_offset + pos / bmp->row_bytes * bmp->stride - buf_off +
+                    col / bmp->carrier_bytes * bmp->pixel_bytes;
+        size_t i = 0, c = col % bmp->carrier_bytes;
+
+        // Finish a pixel started by the previous run
+        for (; c != 0 && c < bmp->carrier_bytes && i < count; c++, i++)
+            to_buf ? (src[c] = dst[i]) : (dst[i] = src[c]);
+        if (c != 0)
+            src += bmp->pixel_bytes;
+
+        // Whole pixels
+        if (to_buf)
+            for (; count - i >= 3; i += 3, src += 4)
+                src[0] = dst[i], src[1] = dst[i + 1], src[2] = dst[i + 2];
+        else
+            for (; count - i >= 3; i += 3, src += 4)
+                dst[i] = src[0], dst[i + 1] = src[1], dst[i + 2] = src[2];
+
+        // Part of the last pixel
+        for (c = 0; i < count; c++, i++)
+            to_buf ? (src[c] = dst[i]) : (dst[i] = src[c]);
+
+        pos += count;
+        dst += count;
+        len -= count;
+    }
+}
+
+/* Embed 'count' bytes at 'depth' into carrier bytes pos.. of 'buf'
+ * Whole kernel units inside a row go straight to the kernel, a unit
+ * split by row padding is gathered into a small buffer and scattered back
+ */
+void bmp_embed(const BmpInfo *bmp, char *buf, size_t buf_off, size_t pos, const char *data, size_t count, int depth)
+{
+    const size_t group = LSB_GROUP(depth), span = group * 8 / depth;
+    char unit[BMP_GATHER_SIZE];
+
+    if (bmp_is_flat(bmp))
+    {
+        lsb_embed_depth(buf + bmp_file_offset(bmp, pos) - buf_off, data, count, depth);
+        return;
+    }
+
+    // 32 bpp without alpha: stage BGR bytes, embed, put them back
+    if (bmp->pixel_bytes != bmp->carrier_bytes)
+    {
+        while (count > 0)
+        {
+            size_t run = BMP_GATHER_SIZE / span * group, len;
+            if (run > count)
+                run = count;
+            len = LSB_SPAN(run, depth);
+
+            gather_scatter(bmp, buf, buf_off, pos, unit, len, 0);
+            lsb_embed_depth(unit, data, run, depth);
+            gather_scatter(bmp, buf, buf_off, pos, unit, len, 1);
+            pos += len;
+            data += run;
+            count -= run;
+        }
+        return;
+    }
+
+    while (count > 0)
+    {
+        size_t run = (bmp->row_bytes - pos % bmp->row_bytes) / span * group; // Whole units left in the row
+        if (run > count)
+            run = count;
+
+        if (run > 0)
+        {
+            lsb_embed_depth(buf + bmp_file_offset(bmp, pos) - buf_off, data, run, depth);
+        }
+        else
+        {
+            run = count < group ? count : group;
+            size_t len = LSB_SPAN(run, depth);
+            for (size_t i = 0; i < len; i++)
+                unit[i] = buf[bmp_file_offset(bmp, pos + i) - buf_off];
+            lsb_embed_depth(unit, data, run, depth);
+            for (size_t i = 0; i < len; i++)
+                buf[bmp_file_offset(bmp, pos + i) - buf_off] = unit[i];
+        }
+        pos += LSB_SPAN(run, depth);
+        data += run;
+        count -= run;
+    }
+}
+
+/* Extract 'count' bytes at 'depth' from carrier bytes pos.. of 'buf' */
+void bmp_extract(const BmpInfo *bmp, char *data, const char *buf, size_t buf_off, size_t pos, size_t count, int depth)
+{
+    const size_t group = LSB_GROUP(depth), span = group * 8 / depth;
+    char unit[BMP_GATHER_SIZE];
+
+    if (bmp_is_flat(bmp))
+    {
+        lsb_extract_depth(data, buf + bmp_file_offset(bmp, pos) - buf_off, count, depth);
+        return;
+    }
+
+    // 32 bpp without alpha: stage BGR bytes, then extract
+    if (bmp->pixel_bytes != bmp->carrier_bytes)
+    {
+        while (count > 0)
+        {
+            size_t run = BMP_GATHER_SIZE / span * group, len;
+            if (run > count)
+                run = count;
+            len = LSB_SPAN(run, depth);
+
+            gather_scatter(bmp, (char *)buf, buf_off, pos, unit, len, 0);
+            lsb_extract_depth(data, unit, run, depth);
+            pos += len;
+            data += run;
+            count -= run;
+        }
+        return;
+    }
+
+    while (count > 0)
+    {
+        size_t run = (bmp->row_bytes - pos % bmp->row_bytes) / span * group; // Whole units left in the row
+        if (run > count)
+            run = count;
+
+        if (run > 0)
+        {
+            lsb_extract_depth(data, buf + bmp_file_offset(bmp, pos) - buf_off, run, depth);
+        }
+        else
+        {
+            run = count < group ? count : group;
+            for (size_t i = 0; i < LSB_SPAN(run, depth); i++)
+                unit[i] = buf[bmp_file_offset(bmp, pos + i) - buf_off];
+            lsb_extract_depth(data, unit, run, depth);
+        }
+        pos += LSB_SPAN(run, depth);
+        data += run;
+        count -= run;
+    }
+}
+
+/* Check that carrier bytes pos.. of 'buf' hold 'count' bytes of 'data' at 'depth'
+ * Extracts a staging buffer of whole kernel units at a time, so the bytes
+ * just embedded are read back while they are still in cache
+ */
+Status bmp_verify(const BmpInfo *bmp, const char *buf, size_t buf_off, size_t pos, const char *data, size_t count, int depth)
+{
+    const size_t group = LSB_GROUP(depth);
+    char check[BMP_GATHER_SIZE];
+
+    while (count > 0)
+    {
+        size_t run = BMP_GATHER_SIZE / group * group;
+        if (run > count)
+            run = count;
+
+        bmp_extract(bmp, check, buf, buf_off, pos, run, depth);
+        if (memcmp(check, data, run) != 0)
+            return e_failure;
+        pos += LSB_SPAN(run, depth);
+        data += run;
+        count -= run;
+    }
+    return e_success;
+}
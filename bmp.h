@@ -0,0 +1,78 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * BMP layout descriptor, parsed once per image
+ * Carrier bytes are the pixel bytes of each row in file order (bottom-up
+ * images start with the bottom row), row padding is never used.
+ *   8 bpp: palette indices, 24 bpp: B, G, R
+ *   32 bpp: B, G, R, the alpha byte only once bmp_use_alpha is called
+ * A carrier offset counts carrier bytes only; the helpers map it to a
+ * file offset: pixel_offset + (pos / row_bytes) * stride + pos % row_bytes
+ * (with pixel_bytes per carrier_bytes when the alpha byte is skipped)
+ */
+
+#define BMP_HEADER_SIZE 54 // file header + BITMAPINFOHEADER, the smallest we accept
+
+typedef struct _BmpInfo
+{
+    size_t pixel_offset; // bfOffBits: file offset of the first pixel row
+    uint width; // pixels per row
+    uint height; // rows, always positive
+    uint bits_per_pixel; // biBitCount
+    int top_down; // negative biHeight: first row is the top of the image
+    uint pixel_bytes; // file bytes per pixel
+    uint carrier_bytes; // bytes per pixel that carry data (3 while a 32 bpp alpha byte is skipped)
+    size_t row_bytes; // carrier bytes per row
+    size_t stride; // width * pixel_bytes rounded up to 4, padding included
+    size_t usable; // carrier bytes in the image: row_bytes * height
+} BmpInfo;
+
+/* Parse the first BMP_HEADER_SIZE bytes of an image
+ * Return Value: e_failure for anything but an uncompressed 8/24/32 bpp BMP
+ */
+Status bmp_parse(const unsigned char *header, BmpInfo *bmp);
+
+/* Treat the pixel data from 'pixel_offset' on as one unpadded run */
+void bmp_set_flat(BmpInfo *bmp, size_t pixel_offset);
+
+/* Check whether carrier bytes run through the file without gaps */
+int bmp_is_flat(const BmpInfo *bmp);
+
+/* Let the alpha bytes of a 32 bpp image carry data too
+ * Return Value: e_failure when the image has no alpha byte
+ */
+Status bmp_use_alpha(BmpInfo *bmp);
+
+/* Check whether rows carry padding bytes */
+int bmp_has_padding(const BmpInfo *bmp);
+
+/* File offset of carrier byte 'pos' */
+size_t bmp_file_offset(const BmpInfo *bmp, size_t pos);
+
+/* File offset just past carrier byte pos - 1 (pixel_offset for pos 0) */
+size_t bmp_file_end(const BmpInfo *bmp, size_t pos);
+
+/* Carrier bytes stored before file offset 'off' */
+size_t bmp_carrier_pos(const BmpInfo *bmp, size_t off);
+
+/* Most file bytes that 'len' consecutive carrier bytes can span */
+size_t bmp_file_span_max(const BmpInfo *bmp, size_t len);
+
+/* Embed 'count' bytes at 'depth' into carrier bytes pos.. of 'buf',
+ * which holds the image bytes from file offset 'buf_off' on
+ */
+void bmp_embed(const BmpInfo *bmp, char *buf, size_t buf_off, size_t pos, const char *data, size_t count, int depth);
+
+/* Extract 'count' bytes at 'depth' from carrier bytes pos.. of 'buf' */
+void bmp_extract(const BmpInfo *bmp, char *data, const char *buf, size_t buf_off, size_t pos, size_t count, int depth);
+
+/* Check that carrier bytes pos.. of 'buf' hold 'count' bytes of 'data' at 'depth'
+ * Return Value: e_failure at the first byte that does not read back
+ */
+Status bmp_verify(const BmpInfo *bmp, const char *buf, size_t buf_off, size_t pos, const char *data, size_t count, int depth);
+
+#endif
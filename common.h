@@ -4,4 +4,70 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/* Versioned container header: STEGO_HEADER_SIZE bytes at one bit per
+ * carrier byte right at the pixel data, written with one kernel call
+ *   0  MAGIC_STRING
+ *   2  STEGO_VERSION_MARK | version (legacy images have 0 here, the high
+ *      byte of their extension size field)
+ *   3  header bytes, so later versions can append fields before the CRC
+ *   4  flags: the extension size field below, 32-bit big-endian
+ *   8  payload bytes, 64-bit big-endian
+ *  16  extension, NUL padded
+ *  24  reserved, zero
+ *  28  CRC32C of every byte before it, 32-bit big-endian, always the
+ *      last four bytes of the header
+ * Shards of a secret split over several images (EXTN_SHARD_FLAG) grow
+ * the header to STEGO_SHARD_HEADER_SIZE, the CRC moving to its end:
+ *  28  shard index, 16-bit big-endian
+ *  30  shard count, 16-bit big-endian
+ *  32  secret offset of the shard, 64-bit big-endian
+ *  40  secret bytes over all shards, 64-bit big-endian
+ *  48  set id shared by the shards of one secret, 32-bit
+ *  52  CRC32C
+ * Legacy images hold "#*", the extension size field, the extension
+ * characters and a 32-bit size instead, each at one bit per carrier byte
+ */
+#define STEGO_HEADER_SIZE 32
+#define STEGO_HEADER_MAX 64
+#define STEGO_VERSION 2
+#define STEGO_VERSION_MARK 0x80
+#define STEGO_FLAGS_OFFSET 4
+#define STEGO_SIZE_OFFSET 8
+#define STEGO_EXTN_OFFSET 16
+#define STEGO_EXTN_SIZE 8
+#define STEGO_CRC_OFFSET 28
+#define STEGO_SHARD_HEADER_SIZE 56
+#define STEGO_SHARD_INDEX_OFFSET 28
+#define STEGO_SHARD_COUNT_OFFSET 30
+#define STEGO_SHARD_POS_OFFSET 32
+#define STEGO_SHARD_TOTAL_OFFSET 40
+#define STEGO_SHARD_SET_OFFSET 48
+#define STEGO_SHARD_MAX 0xFFFF
+
+/* Extension size field: low byte is the length, bits 8-9 hold (depth - 1),
+ * bit 10 is set when the payload skips row padding, bit 11 when the data
+ * also runs through the alpha bytes of a 32 bpp image, bit 12 when the data
+ * is scattered in keyed order, bit 13 when it is sealed with a key, and
+ * bits 14-15 hold the CodecType that compressed it
+ * Depth 1 images without row padding keep the original layout
+ * Versioned headers add bit 16: a CRC32C of the payload follows it, and
+ * bit 17: the payload is one shard of a larger secret
+ */
+#define EXTN_LEN_MASK 0xFF
+#define EXTN_DEPTH_SHIFT 8
+#define EXTN_ROWS_FLAG 0x400
+#define EXTN_ALPHA_FLAG 0x800
+#define EXTN_SCATTER_FLAG 0x1000
+#define EXTN_SEALED_FLAG 0x2000
+#define EXTN_CODEC_SHIFT 14
+#define EXTN_FIELD_MAX 0xFFFF
+#define EXTN_CHECKSUM_FLAG 0x10000
+#define EXTN_SHARD_FLAG 0x20000
+#define STEGO_FLAGS_MAX 0x3FFFF
+
+/* Payload checksum: CRC32C, 32-bit big-endian, at one bit per carrier byte
+ * right after the payload (after its last keyed slot when scattered)
+ */
+#define STEGO_CHECKSUM_SIZE 4
+
 #endif
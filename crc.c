@@ -0,0 +1,129 @@
+#include <string.h>
+#include <pthread.h>
+#include "crc.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_X86 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u
+
+typedef uint32_t (*CrcKernel)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t crc_table[8][256]; // slice-by-8: table k advances a byte k places further
+static uint32_t x2n_table[67]; // x^(2^n) mod P, for crc32c_shift up to 2^64 bytes
+static CrcKernel crc_kernel;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* Portable: eight bytes per step through eight tables */
+static uint32_t crc32c_slice8(uint32_t crc, const unsigned char *p, size_t len)
+{
+    for (; len > 0 && ((uintptr_t)p & 7) != 0; len--)
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ crc >> 8;
+
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][lo >> 8 & 0xFF] ^
+              crc_table[5][lo >> 16 & 0xFF] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xFF] ^ crc_table[2][hi >> 8 & 0xFF] ^
+              crc_table[1][hi >> 16 & 0xFF] ^ crc_table[0][hi >> 24];
+    }
+
+    while (len--)
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ crc >> 8;
+    return crc;
+}
+
+#ifdef CRC_X86
+/* SSE4.2: the crc32 instruction computes CRC-32C eight bytes at a time */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c = crc;
+
+    for (; len > 0 && ((uintptr_t)p & 7) != 0; len--)
+        c = _mm_crc32_u8(c, *p++);
+    for (; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    while (len--)
+        c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+#endif
+
+/* Product of two polynomials modulo P, bit-reflected */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? b >> 1 ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* Build the tables and pick the kernel */
+static void crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? c >> 1 ^ CRC32C_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (int k = 1; k < 8; k++)
+        for (int i = 0; i < 256; i++)
+            crc_table[k][i] = crc_table[0][crc_table[k - 1][i] & 0xFF] ^ crc_table[k - 1][i] >> 8;
+
+    x2n_table[0] = 1u << 30;                                    // x^1
+    for (int n = 1; n < 67; n++)
+        x2n_table[n] = multmodp(x2n_table[n - 1], x2n_table[n - 1]);
+
+    crc_kernel = crc32c_slice8;
+#ifdef CRC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        crc_kernel = crc32c_sse42;
+#endif
+}
+
+/* Extend 'crc' (0 to start) over 'len' bytes */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return ~crc_kernel(~crc, data, len);
+}
+
+/* Move the CRC of a piece past 'len' bytes that follow it */
+uint32_t crc32c_shift(uint32_t crc, uint64_t len)
+{
+    uint32_t p = 1u << 31;                                      // x^0
+
+    pthread_once(&crc_once, crc32c_init);
+    for (int n = 3; len != 0; len >>= 1, n++)                   // x^(8 * len)
+        if (len & 1)
+            p = multmodp(x2n_table[n], p);
+    return multmodp(p, crc);
+}
+
+/* Fold the CRC of a piece with 'len' bytes after it into '*sum', from any thread */
+void crc32c_fold(uint32_t *sum, uint32_t crc, uint64_t len)
+{
+    __atomic_fetch_xor(sum, crc32c_shift(crc, len), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,21 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC-32C (Castagnoli, reflected polynomial 0x82F63B78) */
+
+/* Extend 'crc' (0 to start) over 'len' bytes */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/* Move the CRC of a piece past 'len' bytes that follow it: the CRC of a
+ * whole is the XOR of every piece's CRC moved past the rest, so pieces
+ * can be summed on separate threads in any order
+ */
+uint32_t crc32c_shift(uint32_t crc, uint64_t len);
+
+/* Fold the CRC of a piece with 'len' bytes after it into '*sum', from any thread */
+void crc32c_fold(uint32_t *sum, uint32_t crc, uint64_t len);
+
+#endif
@@ -1,234 +1,1335 @@
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
-#include "decode.h"
-#include "common.h"
-#include "types.h"
-
-static char decode_byte_from_lsb(char *image_buffer); // Decode one byte from 8 image bytes
-static int decode_int_from_lsb(char *image_buffer);   // Decode integer from 32 image bytes
-static Status create_output_file_name(DecodeInfo *decInfo); // Create final output file name with extension
-
-/* Read and validate decode arguments */
-Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
-{
-    // Validate that input stego image is a .bmp file
-    if (strstr(argv[2], ".bmp"))
-    {
-        decInfo->op_image_fname = argv[2];
-    }
-    else
-    {
-        return e_failure;
-    }
-
-    if (argv[3] != NULL)
-    {
-        decInfo->out_fname = argv[3];
-    }
-    else
-    {
-        decInfo->out_fname = malloc(50);
-        strcpy(decInfo->out_fname, "default");
-    }
-
-    return e_success;
-}
-
-/* Open stego image file */
-Status open_decode_files(DecodeInfo *decInfo)
-{
-    // Open the stego image in binary read mode
-    decInfo->fptr_op_image = fopen(decInfo->op_image_fname, "rb");
-
-    // Check if file opened successfully
-    if (decInfo->fptr_op_image == NULL)
-    {
-        perror("fopen"); // Print error if file open fails
-        fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo->op_image_fname);
-        return e_failure;
-    }
-
-    return e_success;
-}
-
-/* Skip the 54-byte BMP header */
-Status skip_bmp_header(FILE *fptr_op_image)
-{
-    // Move the file pointer after 54-byte header
-    fseek(fptr_op_image, 54, SEEK_SET);
-    return e_success;
-}
-
-/* Decode one byte (8 bits) from 8 image bytes */
-static char decode_byte_from_lsb(char *image_buffer)
-{
-    char data = 0;
-
-    // Combine 8 LSBs into one byte
-    for (int i = 0; i < 8; i++)
-        data = (data << 1) | (image_buffer[i] & 1);
-
-    return data;
-}
-
-/* Decode one integer (32 bits) from 32 image bytes */
-static int decode_int_from_lsb(char *image_buffer)
-{
-    int value = 0;
-
-    // Combine 32 LSBs into one integer
-    for (int i = 0; i < 32; i++)
-        value = (value << 1) | (image_buffer[i] & 1);
-
-    return value;
-}
-
-/* Decode and verify magic string */
-Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
-{
-    char image_buffer[8], magic_read[10];
-
-    // Decode each byte of magic string
-    for (int i = 0; i < strlen(magic_string); i++)
-    {
-        fread(image_buffer, 1, 8, decInfo->fptr_op_image);     // Read 8 bytes from image
-        magic_read[i] = decode_byte_from_lsb(image_buffer);    // Decode 1 character
-    }
-
-    magic_read[strlen(magic_string)] = '\0'; // Null terminate string
-
-    // Compare decoded magic string with the expected one
-    if (strcmp(magic_read, magic_string) == 0)
-    {
-        return e_success;  // If match found
-    }
-    else
-    {
-        return e_failure;  // If mismatch
-    }
-}
-
-
-/* Decode 32 bits to get extension size */
-long decode_secret_extn_file_size(DecodeInfo *decInfo)
-{
-    char image_buffer[32];
-
-    // Read 32 bytes for extension size
-    fread(image_buffer, 1, 32, decInfo->fptr_op_image);
-
-    // Convert 32 bits into integer value
-    return decode_int_from_lsb(image_buffer);
-}
-
-/* Decode extension string (.txt, .c, .sh, etc.) */
-Status decode_secret_file_extn(int extn_size, DecodeInfo *decInfo)
-{
-    char image_buffer[8];
-
-    // Decode each character of file extension
-    for (int i = 0; i < extn_size; i++)
-    {
-        fread(image_buffer, 1, 8, decInfo->fptr_op_image); // Read 8 bytes per char
-        decInfo->extn_secret_file[i] = decode_byte_from_lsb(image_buffer); // Decode char
-    }
-
-    decInfo->extn_secret_file[extn_size] = '\0'; // Null terminate decoded extension
-
-    return e_success;
-}
-
-/* Decode 32 bits to get secret file size */
-long decode_secret_file_size(DecodeInfo *decInfo)
-{
-    char image_buffer[32];
-
-    // Read 32 bytes from image
-    fread(image_buffer, 1, 32, decInfo->fptr_op_image);
-
-    // Convert to integer (file size)
-    return decode_int_from_lsb(image_buffer);
-}
-
-/* Decode the actual secret data */
-Status decode_secret_file_data(DecodeInfo *decInfo)
-{
-    char image_buffer[8], ch;
-
-    // Decode each byte of secret data
-    for (int i = 0; i < decInfo->size_secret_file; i++)
-    {
-        fread(image_buffer, 1, 8, decInfo->fptr_op_image); // Read 8 bytes
-        ch = decode_byte_from_lsb(image_buffer);           // Extract one char
-        fwrite(&ch, 1, 1, decInfo->out_secret);            // Write to output file
-    }
-
-    return e_success;
-}
-
-/* Create output file name by adding decoded extension */
-static Status create_output_file_name(DecodeInfo *decInfo)
-{
-    char full_name[100];
-
-    // Combine output base name + decoded extension
-    snprintf(full_name, sizeof(full_name), "%s%s", decInfo->out_fname, decInfo->extn_secret_file);
-
-    // Allocate memory for final file name
-    decInfo->out_fname = malloc(strlen(full_name) + 1);
-    if (decInfo->out_fname == NULL)
-    {
-        fprintf(stderr, "ERROR: Memory allocation failed for output filename\n");
-        return e_failure;
-    }
-
-    strcpy(decInfo->out_fname, full_name); // Copy final file name
-
-    return e_success;
-}
-
-/* Perform the decoding operation */
-Status do_decoding(DecodeInfo *decInfo)
-{
-    // Step 1: Open the stego image file
-    if (open_decode_files(decInfo) == e_failure)
-        return e_failure;
-
-    // Step 2: Skip 54-byte BMP header
-    if (skip_bmp_header(decInfo->fptr_op_image) == e_failure)
-        return e_failure;
-
-    // Step 3: Decode and check magic string
-    if (decode_magic_string(MAGIC_STRING, decInfo) == e_failure)
-        return e_failure;
-
-    // Step 4: Decode size of file extension
-    long extn_size = decode_secret_extn_file_size(decInfo);
-
-    // Step 5: Decode the extension string
-    if (decode_secret_file_extn(extn_size, decInfo) == e_failure)
-        return e_failure;
-
-    // Step 6: Create output filename with decoded extension
-    if (create_output_file_name(decInfo) == e_failure)
-        return e_failure;
-
-    // Step 7: Open decoded output file
-    decInfo->out_secret = fopen(decInfo->out_fname, "w");
-    if (decInfo->out_secret == NULL)
-        return e_failure;
-
-    // Step 8: Decode secret file size
-    decInfo->size_secret_file = decode_secret_file_size(decInfo);
-
-    // Step 9: Decode and write secret data
-    if (decode_secret_file_data(decInfo) == e_failure)
-        return e_failure;
-
-    // Step 10: Close both files
-    fclose(decInfo->fptr_op_image);
-    fclose(decInfo->out_secret);
-
-    return e_success;
-}
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "decode.h"
+#include "common.h"
+#include "types.h"
+#include "lsb.h"
+#include "parallel.h"
+#include "scatter.h"
+#include "aead.h"
+#include "pack.h"
+#include "crc.h"
+#include "stego.h"
+#include "pipeline.h"
+
+/* Image bytes behind one 32-bit header field: 32 carrier bytes in rows of at least one */
+#define FIELD_BUFFER_SIZE (32 * 4 + 4)
+
+/* Image bytes behind the rest of a container header, past its first six bytes */
+#define HEADER_BUFFER_SIZE ((STEGO_HEADER_MAX - 6) * 8 * 4 + 4)
+
+static Status decode_int_from_lsb(DecodeInfo *decInfo, long *value); // Decode integer from 32 carrier bytes
+static const char *read_image_bytes(DecodeInfo *decInfo, char *image_buffer, size_t count); // Next image bytes
+
+/* Read and validate decode arguments */
+Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
+{
+    // Validate that input stego image is a .bmp file, "-" reads stdin
+    if (strcmp(argv[2], "-") == 0 || strstr(argv[2], ".bmp"))
+    {
+        decInfo->op_image_fname = argv[2];
+    }
+    else
+    {
+        return e_failure;
+    }
+
+    if (argv[3] != NULL)
+    {
+        decInfo->out_fname = argv[3];
+    }
+    else
+    {
+        decInfo->out_fname = malloc(50);
+        strcpy(decInfo->out_fname, "default");
+    }
+
+    return e_success;
+}
+
+/* Open stego image file */
+Status open_decode_files(DecodeInfo *decInfo)
+{
+    // Open the stego image in binary read mode, "-" streams it from stdin
+    if (strcmp(decInfo->op_image_fname, "-") == 0)
+        decInfo->fptr_op_image = stdin;
+    else
+        decInfo->fptr_op_image = fopen(decInfo->op_image_fname, "rb");
+
+    // Check if file opened successfully
+    if (decInfo->fptr_op_image == NULL)
+    {
+        perror("fopen"); // Print error if file open fails
+        fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo->op_image_fname);
+        return e_failure;
+    }
+
+    return e_success;
+}
+
+/* Map the stego image into memory
+ * Return Value: e_failure when the image cannot be mapped (pipes, devices),
+ * the FILE* path is used instead
+ */
+Status map_decode_files(DecodeInfo *decInfo)
+{
+    struct stat st;
+
+    if (fstat(fileno(decInfo->fptr_op_image), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 54)
+        return e_failure;
+
+    decInfo->op_map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(decInfo->fptr_op_image), 0);
+    if (decInfo->op_map == MAP_FAILED)
+    {
+        decInfo->op_map = NULL;
+        return e_failure;
+    }
+
+    decInfo->op_map_size = st.st_size;
+    madvise(decInfo->op_map, decInfo->op_map_size, MADV_SEQUENTIAL);
+    return e_success;
+}
+
+/* Release file pointers and mappings */
+void close_decode_files(DecodeInfo *decInfo)
+{
+    if (decInfo->op_map)
+        munmap(decInfo->op_map, decInfo->op_map_size);
+    if (decInfo->out_map)
+        munmap(decInfo->out_map, decInfo->size_secret_file);
+    // Standard streams stay open for the caller
+    if (decInfo->fptr_op_image && decInfo->fptr_op_image != stdin)
+        fclose(decInfo->fptr_op_image);
+    if (decInfo->out_secret == stdout)
+        fflush(stdout);
+    else if (decInfo->out_secret)
+        fclose(decInfo->out_secret);
+
+    decInfo->op_map = decInfo->out_map = NULL;
+    decInfo->fptr_op_image = NULL;
+    decInfo->out_secret = NULL;
+}
+
+/* Skip the BMP header, and any palette or masks, up to the pixel data */
+Status skip_bmp_header(DecodeInfo *decInfo)
+{
+    char image_buffer[BMP_HEADER_SIZE];
+    const char *header;
+
+    // Read past the header instead of seeking, so the image may be a pipe
+    decInfo->op_pos = decInfo->carrier_pos = 0;
+    header = read_image_bytes(decInfo, image_buffer, BMP_HEADER_SIZE);
+    if (header == NULL || bmp_parse((const unsigned char *)header, &decInfo->bmp) == e_failure)
+        return e_failure;
+
+    while (decInfo->op_pos < decInfo->bmp.pixel_offset)
+    {
+        size_t count = decInfo->bmp.pixel_offset - decInfo->op_pos;
+        if (read_image_bytes(decInfo, image_buffer, count < sizeof(image_buffer) ? count : sizeof(image_buffer)) == NULL)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/* Get the next 'count' image bytes
+ * Mapped image: pointer straight into the mapping
+ * Otherwise: read into image_buffer through the FILE*
+ * Return Value: pointer to the bytes, NULL if the image is too short
+ */
+static const char *read_image_bytes(DecodeInfo *decInfo, char *image_buffer, size_t count)
+{
+    if (decInfo->op_map)
+    {
+        if (decInfo->op_map_size - decInfo->op_pos < count)
+            return NULL;
+        decInfo->op_pos += count;
+        return decInfo->op_map + decInfo->op_pos - count;
+    }
+
+    if (fread(image_buffer, 1, count, decInfo->fptr_op_image) != count)
+        return NULL;
+    decInfo->op_pos += count;
+    return image_buffer;
+}
+
+/* Extract 'count' bytes at 'depth' bits per carrier byte from the read cursor on
+ * image_buffer holds bmp_file_span_max(LSB_SPAN(count, depth)) bytes for unmapped images
+ */
+static Status extract_carrier(DecodeInfo *decInfo, char *data, size_t count, int depth, char *image_buffer)
+{
+    size_t start = decInfo->op_pos;
+    size_t end = bmp_file_end(&decInfo->bmp, decInfo->carrier_pos + LSB_SPAN(count, depth));
+
+    // Row padding before and between the carrier bytes is read and skipped
+    const char *image_bytes = read_image_bytes(decInfo, image_buffer, end - start);
+    if (image_bytes == NULL)
+        return e_failure;
+
+    bmp_extract(&decInfo->bmp, data, image_bytes, start, decInfo->carrier_pos, count, depth);
+    decInfo->carrier_pos += LSB_SPAN(count, depth);
+    return e_success;
+}
+
+/* Decode one integer (32 bits) from the next 32 carrier bytes */
+static Status decode_int_from_lsb(DecodeInfo *decInfo, long *value)
+{
+    char image_buffer[FIELD_BUFFER_SIZE];
+    unsigned char bytes[4];
+
+    // Combine 32 LSBs into one integer, MSB first
+    if (extract_carrier(decInfo, (char *)bytes, 4, MIN_DEPTH, image_buffer) == e_failure)
+        return e_failure;
+    *value = (int)((uint)bytes[0] << 24 | (uint)bytes[1] << 16 | (uint)bytes[2] << 8 | bytes[3]);
+    return e_success;
+}
+
+/* Read the header fields again flat from byte 54, the layout of older images
+ * Unmapped images seek back there; a stream cannot go back
+ */
+static Status restart_flat(DecodeInfo *decInfo)
+{
+    if (!decInfo->op_map && fseek(decInfo->fptr_op_image, BMP_HEADER_SIZE, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "ERROR: No stego header in the pixel rows of %s, and older images written flat from byte %d "
+                        "can only be read from a seekable file\n", decInfo->op_image_fname, BMP_HEADER_SIZE);
+        return e_failure;
+    }
+    bmp_set_flat(&decInfo->bmp, BMP_HEADER_SIZE);
+    decInfo->op_pos = BMP_HEADER_SIZE;
+    decInfo->carrier_pos = 0;
+    return e_success;
+}
+
+/* Decode and verify magic string */
+Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
+{
+    char image_buffer[FIELD_BUFFER_SIZE], magic_read[10];
+
+    // Decode each byte of magic string
+    for (int i = 0; i < strlen(magic_string); i++)
+    {
+        if (extract_carrier(decInfo, &magic_read[i], 1, MIN_DEPTH, image_buffer) == e_failure) // Decode 1 character
+            return e_failure;
+    }
+
+    magic_read[strlen(magic_string)] = '\0'; // Null terminate string
+
+    // Compare decoded magic string with the expected one
+    if (strcmp(magic_read, magic_string) == 0)
+    {
+        return e_success;  // If match found
+    }
+    else if (!(bmp_is_flat(&decInfo->bmp) && decInfo->bmp.pixel_offset == BMP_HEADER_SIZE))
+    {
+        // Older images run flat from byte 54 whatever the layout, retry that way
+        if (restart_flat(decInfo) == e_failure)
+            return e_failure;
+        return decode_magic_string(magic_string, decInfo);
+    }
+    else
+    {
+        return e_failure;  // If mismatch
+    }
+}
+
+
+/* Read a big-endian header field of 'len' bytes */
+static uint64_t get_be(const unsigned char *p, int len)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < len; i++)
+        value = value << 8 | p[i];
+    return value;
+}
+
+/* Decode the rest of a versioned header whose first word 'field' follows the magic
+ * Returns the flags, or -1 if the header is damaged or from a newer version
+ */
+static long decode_container_header(DecodeInfo *decInfo, long field)
+{
+    unsigned char header[STEGO_HEADER_MAX];
+    char image_buffer[HEADER_BUFFER_SIZE];
+    size_t size = field >> 16 & 0xFF;
+    StegoHeader h;
+
+    if ((field >> 24 & 0xFF) != (STEGO_VERSION_MARK | STEGO_VERSION) || size < STEGO_HEADER_SIZE || size > STEGO_HEADER_MAX)
+    {
+        fprintf(stderr, "ERROR: Unsupported stego header version %ld\n", field >> 24 & 0x7F);
+        return -1;
+    }
+
+    // Everything past the magic and the word already read, in one call
+    memcpy(header, MAGIC_STRING, strlen(MAGIC_STRING));
+    header[2] = field >> 24, header[3] = field >> 16, header[4] = field >> 8, header[5] = field;
+    if (extract_carrier(decInfo, (char *)header + 6, size - 6, MIN_DEPTH, image_buffer) == e_failure)
+        return -1;
+    if (stego_header_unpack(header, size, &h) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Stego header is damaged\n");
+        return -1;
+    }
+
+    // Extension, 64-bit payload size and the shard fields; the flags keep the legacy field layout
+    strcpy(decInfo->extn_secret_file, h.extn);
+    decInfo->size_secret_file = h.payload_size;
+    decInfo->shard = h.shard;
+    decInfo->version = STEGO_VERSION;
+    return h.flags;
+}
+
+/* Decode 32 bits to get extension size */
+long decode_secret_extn_file_size(DecodeInfo *decInfo)
+{
+    long field;
+
+    // Convert 32 bits into integer value, the bits above the length hold the depth
+    decInfo->version = 0;
+    memset(&decInfo->shard, 0, sizeof(decInfo->shard));
+    if (decode_int_from_lsb(decInfo, &field) == e_failure)
+        return -1;
+    if (field & (long)STEGO_VERSION_MARK << 24)
+        field = decode_container_header(decInfo, (uint)field);  // Versioned header: the flags are further on
+    if (field < 0 || field > (decInfo->version ? STEGO_FLAGS_MAX : EXTN_FIELD_MAX))
+        return -1;
+    decInfo->checksum = (field & EXTN_CHECKSUM_FLAG) != 0;
+    decInfo->depth = (field >> EXTN_DEPTH_SHIFT & 3) + 1;
+    decInfo->alpha = (field & EXTN_ALPHA_FLAG) != 0;
+    decInfo->scatter = (field & EXTN_SCATTER_FLAG) != 0;
+    decInfo->encrypt = (field & EXTN_SEALED_FLAG) != 0;
+    decInfo->codec = field >> EXTN_CODEC_SHIFT & 3;
+    if (decInfo->codec > e_codec_lz)
+        return -1;                                              // Codec this build does not know
+
+    // Older images run through row padding as if it were pixels
+    if (decInfo->version == 0 && !(field & EXTN_ROWS_FLAG) && bmp_has_padding(&decInfo->bmp))
+    {
+        bmp_set_flat(&decInfo->bmp, decInfo->bmp.pixel_offset);
+        if (bmp_file_end(&decInfo->bmp, decInfo->carrier_pos) != decInfo->op_pos)
+        {
+            // Header fields crossed a row end: read them again flat from byte 54
+            if (restart_flat(decInfo) == e_failure || decode_magic_string(MAGIC_STRING, decInfo) == e_failure)
+                return -1;
+            return decode_secret_extn_file_size(decInfo);
+        }
+    }
+    return field & EXTN_LEN_MASK;
+}
+
+/* Decode extension string (.txt, .c, .sh, etc.) */
+Status decode_secret_file_extn(int extn_size, DecodeInfo *decInfo)
+{
+    char image_buffer[FIELD_BUFFER_SIZE];
+
+    // Reject sizes that would overflow the extension buffer
+    if (extn_size < 0 || extn_size >= MAX_FILE_SUFFIX)
+        return e_failure;
+
+    // Decode each character of file extension
+    for (int i = 0; i < extn_size; i++)
+    {
+        if (extract_carrier(decInfo, &decInfo->extn_secret_file[i], 1, MIN_DEPTH, image_buffer) == e_failure)
+            return e_failure;
+    }
+
+    decInfo->extn_secret_file[extn_size] = '\0'; // Null terminate decoded extension
+
+    return e_success;
+}
+
+/* Decode 32 bits to get secret file size */
+long decode_secret_file_size(DecodeInfo *decInfo)
+{
+    long size;
+
+    // Convert the next 32 LSBs to integer (file size)
+    if (decode_int_from_lsb(decInfo, &size) == e_failure)
+        return -1;
+    return size;
+}
+
+/* Decode the container header: versioned images carry everything in one block,
+ * legacy ones follow the extension size field with the extension and a 32-bit size
+ */
+Status decode_stego_header(DecodeInfo *decInfo)
+{
+    if (decode_magic_string(MAGIC_STRING, decInfo) == e_failure)
+        return e_failure;
+
+    long extn_size = decode_secret_extn_file_size(decInfo);
+    if (extn_size < 0)
+        return e_failure;
+    if (decInfo->version == 0)
+    {
+        if (decode_secret_file_extn(extn_size, decInfo) == e_failure)
+            return e_failure;
+        decInfo->size_secret_file = decode_secret_file_size(decInfo);
+    }
+    return decInfo->size_secret_file < 0 ? e_failure : e_success;
+}
+
+/* Map the decoded output file once its size is known */
+static Status map_output_file(DecodeInfo *decInfo)
+{
+    if (decInfo->out_secret == NULL || decInfo->shard.count)
+        return e_failure;                                       // Verifying, or other shards share the file
+
+    int fd = fileno(decInfo->out_secret);
+
+    if (decInfo->size_secret_file == 0 || ftruncate(fd, decInfo->size_secret_file) != 0)
+        return e_failure;
+
+    decInfo->out_map = mmap(NULL, decInfo->size_secret_file, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (decInfo->out_map == MAP_FAILED)
+    {
+        decInfo->out_map = NULL;
+        ftruncate(fd, 0);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Secret bytes on their way to the output: written as is, or as compressed frames */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    char *frame; // frame being gathered (PACK_FRAME_MAX bytes)
+    size_t held; // bytes of it gathered so far
+    char *chunk; // decoded chunk (PACK_CHUNK_SIZE bytes)
+} SecretSink;
+
+/* Prepare the output side for the secret data */
+static Status open_secret_sink(DecodeInfo *decInfo, SecretSink *sink)
+{
+    sink->decInfo = decInfo;
+    sink->held = 0;
+    sink->frame = NULL;
+    if (decInfo->codec == e_codec_none)
+        return e_success;
+
+    sink->frame = malloc(PACK_FRAME_MAX + PACK_CHUNK_SIZE);
+    sink->chunk = sink->frame + PACK_FRAME_MAX;
+    return sink->frame ? e_success : e_failure;
+}
+
+/* Write 'count' secret data bytes, decompressing whole frames as they complete
+ * Without an output file (verifying) frames are still decompressed, then dropped
+ */
+static Status write_secret(SecretSink *sink, const char *data, size_t count)
+{
+    FILE *out = sink->decInfo->out_secret;
+
+    if (sink->frame == NULL)
+        return out == NULL || fwrite(data, 1, count, out) == count ? e_success : e_failure;
+
+    while (count > 0)
+    {
+        // Header first, then the body it announces
+        size_t need = sink->held < PACK_HEADER_SIZE ? PACK_HEADER_SIZE : pack_frame_size(sink->frame);
+        if (need == 0)
+        {
+            fprintf(stderr, "ERROR: Compressed payload is corrupt\n");
+            return e_failure;
+        }
+        size_t take = need - sink->held < count ? need - sink->held : count;
+        memcpy(sink->frame + sink->held, data, take);
+        sink->held += take;
+        data += take;
+        count -= take;
+
+        if (sink->held == need && need > PACK_HEADER_SIZE)
+        {
+            long len = unpack_frame(sink->frame, need, sink->chunk);
+            if (len < 0)
+            {
+                fprintf(stderr, "ERROR: Compressed payload is corrupt\n");
+                return e_failure;
+            }
+            if (out != NULL && fwrite(sink->chunk, 1, len, out) != (size_t)len)
+                return e_failure;
+            sink->held = 0;
+        }
+    }
+    return e_success;
+}
+
+/* Release the sink; a frame left half gathered means the payload was cut short */
+static Status close_secret_sink(SecretSink *sink, Status status)
+{
+    if (status == e_success && sink->held != 0)
+    {
+        fprintf(stderr, "ERROR: Compressed payload is truncated\n");
+        status = e_failure;
+    }
+    free(sink->frame);
+    return status;
+}
+
+/* Shared state of a parallel data stage */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    size_t data_pos; // carrier offset of the first data carrier byte
+} DataJob;
+
+/* Worker: extract secret bytes [begin, end) from their own carrier offsets
+ * and fold the CRC of the slice into the payload CRC
+ */
+static Status decode_data_slice(void *arg, size_t begin, size_t end)
+{
+    DataJob *job = arg;
+    DecodeInfo *decInfo = job->decInfo;
+    const BmpInfo *bmp = &decInfo->bmp;
+    const int depth = decInfo->depth;
+    size_t pos = job->data_pos + LSB_SPAN(begin, depth);        // begin is a whole number of units
+
+    // Mapped image and output: no copies at all
+    if (decInfo->op_map && decInfo->out_map)
+    {
+        bmp_extract(bmp, decInfo->out_map + begin, decInfo->op_map, 0, pos, end - begin, depth);
+        crc32c_fold(&decInfo->payload_crc, crc32c(0, decInfo->out_map + begin, end - begin), decInfo->size_secret_file - end);
+        return e_success;
+    }
+
+    // Otherwise: private block buffer, positional reads and writes
+    size_t chunk = (decInfo->chunk_size ? decInfo->chunk_size : DEFAULT_CHUNK_SIZE) / 8;
+    chunk = chunk / LSB_GROUP(depth) * LSB_GROUP(depth);
+    size_t image_size = bmp_file_span_max(bmp, LSB_SPAN(chunk, depth));
+    char *image_buffer = malloc(image_size + chunk);
+    if (image_buffer == NULL)
+        return e_failure;
+
+    char *secret_buffer = image_buffer + image_size;
+    int op_fd = fileno(decInfo->fptr_op_image);
+    int out_fd = decInfo->out_secret ? fileno(decInfo->out_secret) : -1;
+    Status status = e_success;
+    uint crc = 0;
+
+    for (size_t i = begin; i < end; i += chunk, pos += LSB_SPAN(chunk, depth))
+    {
+        size_t count = end - i < chunk ? end - i : chunk;
+        size_t off = bmp_file_end(bmp, pos), len = bmp_file_end(bmp, pos + LSB_SPAN(count, depth)) - off;
+
+        if (pread_full(op_fd, image_buffer, len, off) == e_failure)
+        {
+            status = e_failure;
+            break;
+        }
+        bmp_extract(bmp, secret_buffer, image_buffer, off, pos, count, depth);
+        crc = crc32c(crc, secret_buffer, count);
+        if (out_fd >= 0 && pwrite_full(out_fd, secret_buffer, count, decInfo->shard.offset + i) == e_failure)
+        {
+            status = e_failure;
+            break;
+        }
+    }
+
+    free(image_buffer);
+    crc32c_fold(&decInfo->payload_crc, crc, decInfo->size_secret_file - end);
+    return status;
+}
+
+/* Extract the whole secret with worker threads, each on its own slice */
+static Status decode_secret_data_parallel(DecodeInfo *decInfo)
+{
+    DataJob job = { decInfo, decInfo->carrier_pos };
+    size_t size = decInfo->size_secret_file;
+    size_t end = bmp_file_end(&decInfo->bmp, decInfo->carrier_pos + LSB_SPAN(size, decInfo->depth));
+
+    if (decInfo->op_map)
+    {
+        if (decInfo->op_map_size < end)
+            return e_failure;
+        map_output_file(decInfo);                               // pwrite covers a failed mapping
+    }
+    else if (decInfo->out_secret && fflush(decInfo->out_secret) != 0)
+    {
+        return e_failure;
+    }
+
+    if (parallel_for(decInfo->threads, size, LSB_GROUP(decInfo->depth), decode_data_slice, &job) == e_failure)
+        return e_failure;
+
+    decInfo->carrier_pos += LSB_SPAN(size, decInfo->depth);
+    decInfo->op_pos = end;
+    if (!decInfo->op_map && fseek(decInfo->fptr_op_image, end, SEEK_SET) != 0)
+        return e_failure;
+    return e_success;
+}
+
+/* Shared state of a pipelined data stage */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    size_t data_pos; // carrier offset of the first data carrier byte
+    size_t first; // image offset the first block is read from
+    size_t image_size; // image bytes at the start of a block, its secret bytes follow
+    SecretSink sink; // output side, used by the writer thread only
+} PipeJob;
+
+/* Image bytes [*start, *stop) behind secret bytes [begin, end) of a block; blocks are read back to back
+ * Return Value: carrier offset of the block's first data carrier byte
+ */
+static size_t pipe_block(const PipeJob *job, size_t begin, size_t end, size_t *start, size_t *stop)
+{
+    const BmpInfo *bmp = &job->decInfo->bmp;
+    const int depth = job->decInfo->depth;
+    size_t pos = job->data_pos + LSB_SPAN(begin, depth);
+
+    *start = begin == 0 ? job->first : bmp_file_end(bmp, pos);
+    *stop = bmp_file_end(bmp, job->data_pos + LSB_SPAN(end, depth));
+    return pos;
+}
+
+/* Reader stage: the next image bytes, straight from the stream (pipes included) */
+static Status pipe_read(void *arg, char *block, size_t begin, size_t end)
+{
+    PipeJob *job = arg;
+    size_t start, stop;
+
+    pipe_block(job, begin, end, &start, &stop);
+    return fread(block, 1, stop - start, job->decInfo->fptr_op_image) == stop - start ? e_success : e_failure;
+}
+
+/* Extractor stage: blocks arrive in order, so the payload CRC simply runs on */
+static Status pipe_extract(void *arg, char *block, size_t begin, size_t end)
+{
+    PipeJob *job = arg;
+    DecodeInfo *decInfo = job->decInfo;
+    char *secret = block + job->image_size;
+    size_t start, stop;
+    size_t pos = pipe_block(job, begin, end, &start, &stop);
+
+    bmp_extract(&decInfo->bmp, secret, block, start, pos, end - begin, decInfo->depth);
+    decInfo->payload_crc = crc32c(decInfo->payload_crc, secret, end - begin);
+    return e_success;
+}
+
+/* Writer stage: secret bytes to the output, decompressed when the payload is */
+static Status pipe_write(void *arg, char *block, size_t begin, size_t end)
+{
+    PipeJob *job = arg;
+    return write_secret(&job->sink, block + job->image_size, end - begin);
+}
+
+/* Extract the whole secret through the reader, extractor and writer threads */
+static Status decode_secret_data_pipelined(DecodeInfo *decInfo)
+{
+    const int depth = decInfo->depth, group = LSB_GROUP(depth);
+    size_t size = decInfo->size_secret_file;
+    size_t chunk = (decInfo->chunk_size ? decInfo->chunk_size : DEFAULT_CHUNK_SIZE) / 8 / group * group;
+    PipeJob job = { .decInfo = decInfo,
+                    .data_pos = decInfo->carrier_pos,
+                    .first = decInfo->op_pos,
+                    .image_size = bmp_file_span_max(&decInfo->bmp, LSB_SPAN(chunk, depth)) };
+
+    if (open_secret_sink(decInfo, &job.sink) == e_failure)
+        return e_failure;
+
+    Status status = pipeline_run(0, size, chunk, job.image_size + chunk, pipe_read, pipe_extract, pipe_write, &job);
+    if (status == e_success)
+    {
+        decInfo->carrier_pos += LSB_SPAN(size, depth);
+        decInfo->op_pos = bmp_file_end(&decInfo->bmp, decInfo->carrier_pos);
+    }
+    return close_secret_sink(&job.sink, status);
+}
+
+/* Shared state of a scattered data stage */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    size_t data_pos; // carrier offset of the first data carrier byte
+    Scatter sc; // keyed order over the carrier bytes left after the header
+} ScatterJob;
+
+/* Worker: extract secret bytes [begin, end) from their keyed carrier slots */
+static Status decode_scatter_slice(void *arg, size_t begin, size_t end)
+{
+    ScatterJob *job = arg;
+    DecodeInfo *decInfo = job->decInfo;
+
+    scatter_extract(&job->sc, &decInfo->bmp, decInfo->out_map + begin, decInfo->op_map, job->data_pos,
+                    LSB_SPAN(begin, decInfo->depth), end - begin, decInfo->depth);
+    crc32c_fold(&decInfo->payload_crc, crc32c(0, decInfo->out_map + begin, end - begin), decInfo->size_secret_file - end);
+    return e_success;
+}
+
+/* Start a scattered data stage over the carrier bytes after the header fields
+ * 'size' data bytes must fit, and the mapping must hold every carrier byte
+ */
+static Status begin_scatter(DecodeInfo *decInfo, ScatterJob *job, size_t size)
+{
+    const BmpInfo *bmp = &decInfo->bmp;
+
+    if (decInfo->key == NULL)
+    {
+        fprintf(stderr, "ERROR: Scattered data needs the --key it was encoded with\n");
+        return e_failure;
+    }
+    if (!decInfo->op_map)
+    {
+        fprintf(stderr, "ERROR: Scattered data needs a memory-mapped image\n");
+        return e_failure;
+    }
+    if (LSB_SPAN(size, decInfo->depth) > bmp->usable - decInfo->carrier_pos ||
+        decInfo->op_map_size < bmp_file_end(bmp, bmp->usable))
+        return e_failure;
+
+    job->decInfo = decInfo;
+    job->data_pos = decInfo->carrier_pos;
+    scatter_init(&job->sc, decInfo->key, bmp->usable - job->data_pos);
+
+    // The read cursor moves past the data at once
+    decInfo->carrier_pos += LSB_SPAN(size, decInfo->depth);
+    decInfo->op_pos = bmp_file_end(bmp, decInfo->carrier_pos);
+    return e_success;
+}
+
+/* Extract a secret spread in keyed order over the rest of the carrier */
+static Status decode_secret_data_scattered(DecodeInfo *decInfo)
+{
+    const BmpInfo *bmp = &decInfo->bmp;
+    const int depth = decInfo->depth;
+    ScatterJob job;
+    size_t size = decInfo->size_secret_file;
+
+    if (begin_scatter(decInfo, &job, size) == e_failure)
+        return e_failure;
+
+    // Mapped output: slices extract straight into it
+    if (size == 0)
+        return e_success;
+    if (decInfo->codec == e_codec_none && map_output_file(decInfo) == e_success)
+        return parallel_for(decInfo->streaming ? 1 : decInfo->threads, size, LSB_GROUP(depth), decode_scatter_slice, &job);
+
+    // Streamed or compressed output: one block at a time
+    size_t chunk = (decInfo->chunk_size ? decInfo->chunk_size : DEFAULT_CHUNK_SIZE) / 8 / LSB_GROUP(depth) * LSB_GROUP(depth);
+    char *secret_buffer = malloc(chunk);
+    SecretSink sink;
+    if (secret_buffer == NULL || open_secret_sink(decInfo, &sink) == e_failure)
+    {
+        free(secret_buffer);
+        return e_failure;
+    }
+
+    Status status = e_success;
+    for (size_t i = 0; i < size && status == e_success; i += chunk)
+    {
+        size_t count = size - i < chunk ? size - i : chunk;
+
+        scatter_extract(&job.sc, bmp, secret_buffer, decInfo->op_map, job.data_pos, LSB_SPAN(i, depth), count, depth);
+        decInfo->payload_crc = crc32c(decInfo->payload_crc, secret_buffer, count);
+        status = write_secret(&sink, secret_buffer, count);
+    }
+
+    free(secret_buffer);
+    return close_secret_sink(&sink, status);
+}
+
+/* Shared state of an opening batch */
+typedef struct
+{
+    const AeadKey *key;
+    size_t plain; // secret bytes in the whole secret
+    size_t base; // secret offset of the batch
+    const char *in; // batch records
+    char *out; // batch plaintext
+} OpenJob;
+
+/* Worker: verify and decrypt batch bytes [begin, end), begin is a whole number of chunks */
+static Status open_slice(void *arg, size_t begin, size_t end)
+{
+    OpenJob *job = arg;
+
+    return aead_open_range(job->key, job->plain, job->base + begin, job->base + end,
+                           job->in + begin / AEAD_CHUNK_SIZE * AEAD_RECORD_SIZE, job->out + begin);
+}
+
+/* Extract the sealed stream a batch at a time, verify and decrypt it
+ * (then decompress it when it was compressed before sealing). Every chunk is checked before its plaintext is written, so a corrupt
+ * payload stops the decode at the first bad batch
+ */
+static Status decode_secret_data_sealed(DecodeInfo *decInfo)
+{
+    const int depth = decInfo->depth;
+    const size_t group = LSB_GROUP(depth);
+    const size_t batch = (decInfo->threads > 1 ? decInfo->threads : 1) * AEAD_BATCH_CHUNKS * AEAD_CHUNK_SIZE;
+    size_t sealed = decInfo->size_secret_file, extracted = 0, done = 0, held = 0;
+    long plain = aead_plain_size(sealed);
+    AeadKey key;
+    SecretSink sink;
+    ScatterJob scatter;
+    Status status = e_success;
+
+    if (plain < 0)
+    {
+        fprintf(stderr, "ERROR: Sealed payload has an invalid size\n");
+        return e_failure;
+    }
+    if (decInfo->key == NULL)
+    {
+        fprintf(stderr, "ERROR: Sealed payload needs the --key it was encoded with\n");
+        return e_failure;
+    }
+    if (decInfo->scatter && begin_scatter(decInfo, &scatter, sealed) == e_failure)
+        return e_failure;
+
+    // [salt and records of one batch, plus a unit remainder][carrier bytes of one batch][plaintext of one batch]
+    size_t in_size = AEAD_SALT_SIZE + aead_records_size(batch) + group;
+    size_t image_size = decInfo->op_map ? 0 : bmp_file_span_max(&decInfo->bmp, LSB_SPAN(in_size, depth));
+    char *in = malloc(in_size + image_size + batch);
+    if (in == NULL || open_secret_sink(decInfo, &sink) == e_failure)
+    {
+        free(in);
+        return e_failure;
+    }
+    char *image_buffer = in + in_size, *out = image_buffer + image_size;
+
+    for (int first = 1; status == e_success && (first || (size_t)plain > done); first = 0)
+    {
+        size_t count = plain - done < batch ? plain - done : batch;
+        size_t need = (first ? AEAD_SALT_SIZE : 0) + aead_records_size(count);
+
+        // Whole kernel units only, up to two bytes of the next batch come along
+        if (need > held)
+        {
+            size_t len = (need - held + group - 1) / group * group;
+            if (len > sealed - extracted)
+                len = sealed - extracted;
+            if (decInfo->scatter)
+                scatter_extract(&scatter.sc, &decInfo->bmp, in + held, decInfo->op_map, scatter.data_pos,
+                                LSB_SPAN(extracted, depth), len, depth);
+            else if (extract_carrier(decInfo, in + held, len, depth, image_buffer) == e_failure)
+            {
+                status = e_failure;
+                break;
+            }
+            decInfo->payload_crc = crc32c(decInfo->payload_crc, in + held, len);
+            extracted += len;
+            held += len;
+        }
+        if (first)
+            aead_derive_key(&key, decInfo->key, (unsigned char *)in);
+
+        OpenJob job = { &key, plain, done, in + (first ? AEAD_SALT_SIZE : 0), out };
+        if (parallel_for(decInfo->threads, count, AEAD_CHUNK_SIZE, open_slice, &job) == e_failure)
+        {
+            fprintf(stderr, "ERROR: Payload failed authentication at secret offset %zu (wrong key or corrupt image)\n", done);
+            status = e_failure;
+        }
+        else
+        {
+            status = write_secret(&sink, out, count);
+        }
+        done += count;
+        memmove(in, in + need, held - need);
+        held -= need;
+    }
+
+    free(in);
+    return close_secret_sink(&sink, status);
+}
+
+/* Random access to the payload for a byte range of the secret */
+typedef struct
+{
+    DecodeInfo *decInfo;
+    ScatterJob scatter; // keyed order when scattered; data_pos is set either way
+    size_t block; // payload bytes extracted per step
+    char *raw; // one step plus the unit it may start inside
+    char *image_buffer; // image bytes of one step (unmapped images)
+    AeadKey key; // sealed payloads: chunk key
+    size_t plain; // secret bytes behind the sealed stream
+    long opened; // chunk held in 'chunk', -1 for none
+    char *record; // sealed record of one chunk
+    char *chunk; // opened chunk
+    char *frame; // compressed frame
+    char *unpacked; // the frame decompressed
+} RangeReader;
+
+/* Extract payload bytes [begin, begin + count) straight from their carrier bytes */
+static Status range_extract(RangeReader *rr, char *out, size_t begin, size_t count)
+{
+    DecodeInfo *decInfo = rr->decInfo;
+    const BmpInfo *bmp = &decInfo->bmp;
+    const int depth = decInfo->depth;
+    const size_t group = LSB_GROUP(depth), data_pos = rr->scatter.data_pos;
+
+    while (count > 0)
+    {
+        // Units start on whole groups: extract from the start of the one holding 'begin'
+        size_t skip = begin % group, len = count < rr->block ? count : rr->block;
+        size_t slot = LSB_SPAN(begin - skip, depth);
+
+        if (decInfo->scatter)
+            scatter_extract(&rr->scatter.sc, bmp, rr->raw, decInfo->op_map, data_pos, slot, skip + len, depth);
+        else if (decInfo->op_map)
+            bmp_extract(bmp, rr->raw, decInfo->op_map, 0, data_pos + slot, skip + len, depth);
+        else
+        {
+            size_t off = bmp_file_end(bmp, data_pos + slot);
+            size_t end = bmp_file_end(bmp, data_pos + slot + LSB_SPAN(skip + len, depth));
+            if (pread_full(fileno(decInfo->fptr_op_image), rr->image_buffer, end - off, off) == e_failure)
+                return e_failure;
+            bmp_extract(bmp, rr->raw, rr->image_buffer, off, data_pos + slot, skip + len, depth);
+        }
+        memcpy(out, rr->raw + skip, len);
+        out += len;
+        begin += len;
+        count -= len;
+    }
+    return e_success;
+}
+
+/* Read bytes [begin, begin + count) of the stored secret: opened chunk by chunk when sealed */
+static Status range_read(RangeReader *rr, char *out, size_t begin, size_t count)
+{
+    if (!rr->decInfo->encrypt)
+        return range_extract(rr, out, begin, count);
+
+    while (count > 0)
+    {
+        size_t index = begin / AEAD_CHUNK_SIZE, base = index * AEAD_CHUNK_SIZE;
+        size_t len = rr->plain - base < AEAD_CHUNK_SIZE ? rr->plain - base : AEAD_CHUNK_SIZE;
+
+        // Only the records the range touches are extracted and checked
+        if (rr->opened != (long)index)
+        {
+            if (range_extract(rr, rr->record, AEAD_SALT_SIZE + index * AEAD_RECORD_SIZE, len + AEAD_TAG_SIZE) == e_failure)
+                return e_failure;
+            if (aead_open_range(&rr->key, rr->plain, base, base + len, rr->record, rr->chunk) == e_failure)
+            {
+                fprintf(stderr, "ERROR: Payload failed authentication at secret offset %zu (wrong key or corrupt image)\n", base);
+                return e_failure;
+            }
+            rr->opened = index;
+        }
+
+        size_t take = base + len - begin < count ? base + len - begin : count;
+        memcpy(out, rr->chunk + (begin - base), take);
+        out += take;
+        begin += take;
+        count -= take;
+    }
+    return e_success;
+}
+
+/* Write the secret bytes of [base, base + len) that fall inside [offset, end)
+ * Return Value: bytes written
+ */
+static size_t write_window(DecodeInfo *decInfo, const char *data, size_t base, size_t len, size_t offset, size_t end)
+{
+    size_t from = base > offset ? base : offset, to = base + len < end ? base + len : end;
+
+    if (from >= to)
+        return 0;
+    return fwrite(data + (from - base), 1, to - from, decInfo->out_secret) == to - from ? to - from : (size_t)-1;
+}
+
+/* Compressed secret: frames before the range are stepped over by their headers alone
+ * (every frame but the last holds a whole chunk), the ones inside it are decompressed
+ * Return Value: secret bytes written, -1 on failure
+ */
+static long range_unpack(RangeReader *rr, size_t stream, size_t offset, size_t end)
+{
+    size_t pos = 0, base = 0, written = 0;
+
+    if (offset == end)
+        return 0;
+    while (pos < stream && base < end)
+    {
+        char *frame = rr->frame;
+        if (range_read(rr, frame, pos, PACK_HEADER_SIZE) == e_failure)
+            return -1;
+        size_t size = pack_frame_size(frame);
+        if (size == 0 || size > stream - pos)
+        {
+            fprintf(stderr, "ERROR: Compressed payload is corrupt\n");
+            return -1;
+        }
+        if (base + PACK_CHUNK_SIZE <= offset && pos + size < stream)
+        {
+            pos += size;
+            base += PACK_CHUNK_SIZE;
+            continue;
+        }
+
+        long len;
+        if (range_read(rr, frame + PACK_HEADER_SIZE, pos + PACK_HEADER_SIZE, size - PACK_HEADER_SIZE) == e_failure ||
+            (len = unpack_frame(frame, size, rr->unpacked)) < 0)
+        {
+            fprintf(stderr, "ERROR: Compressed payload is corrupt\n");
+            return -1;
+        }
+        size_t done = write_window(rr->decInfo, rr->unpacked, base, len, offset, end);
+        if (done == (size_t)-1)
+            return -1;
+        written += done;
+        pos += size;
+        base += len;
+    }
+    if (offset > base)
+    {
+        fprintf(stderr, "ERROR: Offset %zu is past the end of the secret (%zu bytes)\n", offset, base);
+        return -1;
+    }
+    return written;
+}
+
+/* Uncompressed secret: the range is read by position, a step at a time
+ * Return Value: secret bytes written, -1 on failure
+ */
+static long range_copy(RangeReader *rr, char *out, size_t stream, size_t offset, size_t end)
+{
+    if (offset > stream)
+    {
+        fprintf(stderr, "ERROR: Offset %zu is past the end of the secret (%zu bytes)\n", offset, stream);
+        return -1;
+    }
+    if (end > stream)
+        end = stream;
+
+    for (size_t i = offset; i < end; i += rr->block)
+    {
+        size_t count = end - i < rr->block ? end - i : rr->block;
+        if (range_read(rr, out, i, count) == e_failure ||
+            fwrite(out, 1, count, rr->decInfo->out_secret) != count)
+            return -1;
+    }
+    return end - offset;
+}
+
+/* Extract only secret bytes [range_offset, range_offset + range_length): the carrier
+ * bytes behind them are found by position, so the cost follows the range, not the payload
+ * The payload CRC covers all of it and is not checked; sealed chunks still are
+ */
+static Status decode_secret_data_range(DecodeInfo *decInfo)
+{
+    const BmpInfo *bmp = &decInfo->bmp;
+    const int depth = decInfo->depth, group = LSB_GROUP(depth);
+    size_t size = decInfo->size_secret_file, stream = size;
+    size_t offset = decInfo->range_offset;
+    size_t end = decInfo->range_length > SIZE_MAX - offset ? SIZE_MAX : offset + decInfo->range_length;
+    RangeReader rr;
+
+    memset(&rr, 0, sizeof(rr));
+    rr.decInfo = decInfo;
+    rr.opened = -1;
+    if (decInfo->encrypt && decInfo->key == NULL)
+    {
+        fprintf(stderr, "ERROR: Sealed payload needs the --key it was encoded with\n");
+        return e_failure;
+    }
+    if (decInfo->scatter)
+    {
+        if (begin_scatter(decInfo, &rr.scatter, size) == e_failure)
+            return e_failure;
+    }
+    else
+    {
+        if (LSB_SPAN(size, depth) > bmp->usable - decInfo->carrier_pos ||
+            (decInfo->op_map && decInfo->op_map_size < bmp_file_end(bmp, decInfo->carrier_pos + LSB_SPAN(size, depth))))
+            return e_failure;
+        if (!decInfo->op_map && lseek(fileno(decInfo->fptr_op_image), 0, SEEK_CUR) < 0)
+        {
+            fprintf(stderr, "ERROR: --offset and --length need a seekable image\n");
+            return e_failure;
+        }
+        rr.scatter.data_pos = decInfo->carrier_pos;
+    }
+
+    // [one step and a unit][its image bytes][sealed record][opened chunk][compressed frame][decompressed frame][output]
+    rr.block = (decInfo->chunk_size ? decInfo->chunk_size : DEFAULT_CHUNK_SIZE) / 8 / group * group;
+    size_t image_size = decInfo->op_map ? 0 : bmp_file_span_max(bmp, LSB_SPAN(rr.block + group, depth));
+    rr.raw = malloc(rr.block + group + image_size + AEAD_RECORD_SIZE + AEAD_CHUNK_SIZE + PACK_FRAME_MAX + PACK_CHUNK_SIZE +
+                    rr.block);
+    if (rr.raw == NULL)
+        return e_failure;
+    rr.image_buffer = rr.raw + rr.block + group;
+    rr.record = rr.image_buffer + image_size;
+    rr.chunk = rr.record + AEAD_RECORD_SIZE;
+    rr.frame = rr.chunk + AEAD_CHUNK_SIZE;
+    rr.unpacked = rr.frame + PACK_FRAME_MAX;
+    char *out = rr.unpacked + PACK_CHUNK_SIZE;
+
+    // Sealed: the key comes from the salt at the front, the range is in secret bytes
+    long written = 0;
+    if (decInfo->encrypt)
+    {
+        unsigned char salt[AEAD_SALT_SIZE];
+        long plain = aead_plain_size(size);
+
+        if (plain < 0)
+        {
+            fprintf(stderr, "ERROR: Sealed payload has an invalid size\n");
+            written = -1;
+        }
+        else if (range_extract(&rr, (char *)salt, 0, AEAD_SALT_SIZE) == e_failure)
+        {
+            written = -1;
+        }
+        else
+        {
+            aead_derive_key(&rr.key, decInfo->key, salt);
+            rr.plain = stream = plain;
+        }
+    }
+    if (written == 0)
+        written = decInfo->codec == e_codec_none ? range_copy(&rr, out, stream, offset, end)
+                                                 : range_unpack(&rr, stream, offset, end);
+
+    free(rr.raw);
+    if (written < 0)
+        return e_failure;
+    decInfo->range_length = (size_t)written;                    // What the data stage reports
+    return e_success;
+}
+
+/* Extract the payload through the path its header calls for */
+static Status decode_payload(DecodeInfo *decInfo)
+{
+    const int depth = decInfo->depth, group = LSB_GROUP(depth);
+
+    if (decInfo->encrypt)
+        return decode_secret_data_sealed(decInfo);
+    if (decInfo->scatter)
+        return decode_secret_data_scattered(decInfo);
+
+    // Pipeline: reads, extraction and writes overlap on their own threads, streams included
+    if (decInfo->io_mode == e_io_pipeline && !decInfo->op_map && decInfo->size_secret_file > 0)
+        return decode_secret_data_pipelined(decInfo);
+
+    // Compressed data only has a known size once decompressed: no positional writes
+    if (decInfo->codec == e_codec_none && decInfo->threads > 1 && !decInfo->streaming &&
+        decInfo->size_secret_file >= 2 * PARALLEL_MIN_SLICE)
+        return decode_secret_data_parallel(decInfo);
+
+    // Mapped image and output: decode straight from one mapping into the other
+    if (decInfo->codec == e_codec_none && decInfo->op_map && map_output_file(decInfo) == e_success)
+    {
+        if (extract_carrier(decInfo, decInfo->out_map, decInfo->size_secret_file, depth, NULL) == e_failure)
+            return e_failure;
+        decInfo->payload_crc = crc32c(0, decInfo->out_map, decInfo->size_secret_file);
+        return e_success;
+    }
+
+    // Decode block by block: bounded memory, a single forward pass over the image
+    size_t chunk = (decInfo->chunk_size ? decInfo->chunk_size : DEFAULT_CHUNK_SIZE) / 8 / group * group;
+    size_t image_size = bmp_file_span_max(&decInfo->bmp, LSB_SPAN(chunk, depth));
+    char *block = malloc(image_size + chunk);
+    SecretSink sink;
+    if (block == NULL || open_secret_sink(decInfo, &sink) == e_failure)
+    {
+        free(block);
+        return e_failure;
+    }
+
+    char *secret_buffer = block + image_size;
+    Status status = e_success;
+    size_t size = (size_t)decInfo->size_secret_file;            // Checked >= 0 by decode_secret_file_data
+    for (size_t i = 0; i < size; i += chunk)
+    {
+        size_t count = size - i < chunk ? size - i : chunk;
+
+        if (extract_carrier(decInfo, secret_buffer, count, depth, block) == e_failure) // Read one block, extract the chars
+        {
+            status = e_failure;
+            break;
+        }
+        decInfo->payload_crc = crc32c(decInfo->payload_crc, secret_buffer, count);
+        if (write_secret(&sink, secret_buffer, count) == e_failure)   // Write to output file
+        {
+            status = e_failure;
+            break;
+        }
+    }
+
+    free(block);
+    return close_secret_sink(&sink, status);
+}
+
+/* Compare the payload CRC stored right after the payload with the one computed */
+static Status check_payload_crc(DecodeInfo *decInfo, size_t data_pos)
+{
+    char image_buffer[FIELD_BUFFER_SIZE];
+    unsigned char crc[STEGO_CHECKSUM_SIZE];
+    size_t slot = LSB_SPAN(decInfo->size_secret_file, decInfo->depth), domain = decInfo->bmp.usable - data_pos;
+    Scatter sc;
+
+    if (!decInfo->scatter)
+    {
+        if (extract_carrier(decInfo, (char *)crc, STEGO_CHECKSUM_SIZE, MIN_DEPTH, image_buffer) == e_failure)
+            return e_failure;
+    }
+    else
+    {
+        // Its slots follow the payload's in the same keyed order
+        if (slot + STEGO_CHECKSUM_SIZE * 8 > domain)
+            return e_failure;
+        scatter_init(&sc, decInfo->key, domain);
+        scatter_extract(&sc, &decInfo->bmp, (char *)crc, decInfo->op_map, data_pos, slot, STEGO_CHECKSUM_SIZE, MIN_DEPTH);
+    }
+
+    if (get_be(crc, STEGO_CHECKSUM_SIZE) != decInfo->payload_crc)
+    {
+        fprintf(stderr, "ERROR: Payload checksum mismatch (corrupt or truncated image)\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Decode the actual secret data, then check it against its CRC */
+Status decode_secret_file_data(DecodeInfo *decInfo)
+{
+    // Reject sizes the image cannot hold
+    if (decInfo->size_secret_file < 0)
+        return e_failure;
+
+    // 32 bpp: the data may run through the alpha bytes, the header fields never do
+    if (decInfo->alpha && bmp_use_alpha(&decInfo->bmp) == e_success)
+        decInfo->carrier_pos = bmp_carrier_pos(&decInfo->bmp, decInfo->op_pos);
+
+    // A range leaves most of the payload unread, so there is no CRC to check
+    if (decInfo->range)
+        return decode_secret_data_range(decInfo);
+
+    size_t data_pos = decInfo->carrier_pos;
+    decInfo->payload_crc = 0;
+    if (decode_payload(decInfo) == e_failure)
+        return e_failure;
+    if (!decInfo->checksum)
+    {
+        if (decInfo->verify)
+            fprintf(stderr, "WARNING: %s has no payload checksum, only its structure was checked\n", decInfo->op_image_fname);
+        return e_success;
+    }
+    return check_payload_crc(decInfo, data_pos);
+}
+
+/* Create output file name by adding decoded extension */
+Status create_output_file_name(DecodeInfo *decInfo)
+{
+    char full_name[100];
+
+    // stdout has no name to extend
+    if (strcmp(decInfo->out_fname, "-") == 0)
+        return e_success;
+
+    // Combine output base name + decoded extension
+    snprintf(full_name, sizeof(full_name), "%s%s", decInfo->out_fname, decInfo->extn_secret_file);
+
+    // Allocate memory for final file name
+    decInfo->out_fname = malloc(strlen(full_name) + 1);
+    if (decInfo->out_fname == NULL)
+    {
+        fprintf(stderr, "ERROR: Memory allocation failed for output filename\n");
+        return e_failure;
+    }
+
+    strcpy(decInfo->out_fname, full_name); // Copy final file name
+
+    return e_success;
+}
+
+/* Decode the payload and record its stage */
+static Status decode_data_stage(DecodeInfo *decInfo, StatsMark *mark)
+{
+    if (decode_secret_file_data(decInfo) == e_failure)
+        return e_failure;
+    STATS_LAP(decInfo->stats, mark, e_stage_data,
+              decInfo->range ? (uint64_t)decInfo->range_length
+                             : (uint64_t)decInfo->size_secret_file + (decInfo->checksum ? STEGO_CHECKSUM_SIZE : 0));
+    return e_success;
+}
+
+/* Run the decoding stages over the opened stego image, timing each from 'mark' on */
+static Status decode_stages(DecodeInfo *decInfo, StatsMark *mark)
+{
+    Stats *st = decInfo->stats;
+    STATS_LAP(st, mark, e_stage_open, 0);
+
+    // Step 2: Skip BMP header up to the pixel data
+    if (skip_bmp_header(decInfo) == e_failure)
+        return e_failure;
+    STATS_LAP(st, mark, e_stage_bmp_header, decInfo->bmp.pixel_offset);
+
+    // Step 3: Decode the container header: magic, data layout, extension and size
+    if (decode_stego_header(decInfo) == e_failure)
+        return e_failure;
+    STATS_LAP(st, mark, e_stage_stego_header, decInfo->carrier_pos / 8);   // One bit per carrier byte
+
+    // Scattered data is only reachable through the map: fail before any output exists
+    if (decInfo->scatter && !decInfo->op_map)
+    {
+        fprintf(stderr, "ERROR: %s holds scattered data, which needs a memory-mapped image (--io auto or mmap)\n",
+                decInfo->op_image_fname);
+        return e_failure;
+    }
+
+    // Verifying: the payload is extracted and checked, nothing is written
+    if (decInfo->verify)
+    {
+        decInfo->streaming = decInfo->fptr_op_image == stdin;
+        return decode_data_stage(decInfo, mark);
+    }
+
+    // A shard alone is only part of the secret
+    if (decInfo->shard.count)
+    {
+        fprintf(stderr, "ERROR: %s holds shard %d of %d, decode the whole set with --shards\n",
+                decInfo->op_image_fname, decInfo->shard.index + 1, decInfo->shard.count);
+        return e_failure;
+    }
+
+    // Step 4: Create output filename with decoded extension
+    if (create_output_file_name(decInfo) == e_failure)
+        return e_failure;
+
+    // Step 5: Open decoded output file, "-" streams it to stdout
+    if (strcmp(decInfo->out_fname, "-") == 0)
+        decInfo->out_secret = stdout;
+    else
+        decInfo->out_secret = fopen(decInfo->out_fname, decInfo->op_map ? "w+" : "w");
+    if (decInfo->out_secret == NULL)
+        return e_failure;
+    decInfo->streaming = decInfo->out_secret == stdout || decInfo->fptr_op_image == stdin;
+
+    // Step 6: Decode and write secret data
+    return decode_data_stage(decInfo, mark);
+}
+
+/* Perform the decoding operation */
+Status do_decoding(DecodeInfo *decInfo)
+{
+    Status status = e_failure;
+    StatsMark mark;
+
+    STATS_MARK(decInfo->stats, &mark);
+    decInfo->fptr_op_image = NULL;
+    decInfo->out_secret = NULL;
+    decInfo->op_map = decInfo->out_map = NULL;
+
+    // Step 1: Open the stego image file and map it when possible
+    if (open_decode_files(decInfo) == e_success)
+    {
+        if (decInfo->io_mode != e_io_stdio && decInfo->io_mode != e_io_pipeline &&
+            map_decode_files(decInfo) == e_failure && decInfo->io_mode == e_io_mmap)
+            fprintf(stderr, "ERROR: Unable to memory-map %s\n", decInfo->op_image_fname);
+        else
+            status = decode_stages(decInfo, &mark);
+    }
+
+    // Step 10: Close both files, a failed decode leaves no partial secret behind
+    int created = decInfo->out_secret != NULL && decInfo->out_secret != stdout;
+    close_decode_files(decInfo);
+    if (status == e_success)
+        STATS_LAP(decInfo->stats, &mark, e_stage_close, 0);
+    else if (created)
+        remove(decInfo->out_fname);
+    return status;
+}
@@ -1,56 +1,98 @@
-#ifndef DECODE_H
-#define DECODE_H
-
-#include "types.h" // Contains user defined types
-#include <stdio.h>
-
-
-#define MAX_SECRET_BUF_SIZE 1
-#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 4
-
-typedef struct _DecodeInfo
-{
-    /* Source Image info */
-    char *op_image_fname;// storing .bmp file name
-    FILE *fptr_op_image;// storing address of .bmp file, opening in r mode
-
-    /* Secret File Info */
-    char *out_fname;// output file file
-    FILE *out_secret;// output file pointer
-    char extn_secret_file[MAX_FILE_SUFFIX];// storing the .txt, .sh, .c extension
-    char secret_data[MAX_SECRET_BUF_SIZE];
-    long size_secret_file; // decoded secret file 
-
-} DecodeInfo;
-
-/* Decoding function prototype */
-
-/* Read and validate Encode args from argv */
-Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
-
-/* Perform the encoding */
-Status do_decoding(DecodeInfo *decInfo);
-
-/* Get File pointers for i/p and o/p files */
-Status open_decode_files(DecodeInfo *decInfo);
-
-/* Copy bmp image header */
-Status skip_bmp_header(FILE *fptr_op_image);
-
-/* Store Magic String */
-Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
-
-/*Extend file size*/
-long decode_secret_extn_file_size(DecodeInfo *decInfo); 
-
-/* Encode secret file extenstion */
-Status decode_secret_file_extn(int extn_size, DecodeInfo *decInfo);
-
-/* Encode secret file size */
-long decode_secret_file_size(DecodeInfo *decInfo);
-
-/* Encode secret file data*/
-Status decode_secret_file_data(DecodeInfo *decInfo);
-
-#endif
+#ifndef DECODE_H
+#define DECODE_H
+
+#include "types.h" // Contains user defined types
+#include "bmp.h"
+#include "stats.h"
+#include <stdio.h>
+
+
+#define MAX_SECRET_BUF_SIZE 1
+#define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
+#define MAX_FILE_SUFFIX 8
+#define DEFAULT_CHUNK_SIZE (1 << 20) // carrier bytes moved per block (1 MiB)
+
+typedef struct _DecodeInfo
+{
+    /* Source Image info */
+    char *op_image_fname;// storing .bmp file name
+    FILE *fptr_op_image;// storing address of .bmp file, opening in r mode
+    BmpInfo bmp; // header layout, parsed by skip_bmp_header
+
+    /* Secret File Info */
+    char *out_fname;// output file file
+    FILE *out_secret;// output file pointer
+    char extn_secret_file[MAX_FILE_SUFFIX];// storing the .txt, .sh, .c extension
+    char secret_data[MAX_SECRET_BUF_SIZE];
+    long size_secret_file; // decoded secret file 
+
+    /* Memory-mapped files (NULL when using stdio) */
+    IOMode io_mode; // stdio streams or memory-mapped files
+    char *op_map; // stego image, read only
+    size_t op_map_size; // bytes in op_map
+    size_t op_pos; // image bytes consumed (read cursor inside op_map)
+    size_t carrier_pos; // carrier offset of the read cursor (see bmp.h)
+    char *out_map; // decoded output, sized with ftruncate
+    size_t chunk_size; // carrier bytes per block for worker threads
+    int threads; // worker threads for the secret data stage
+    int depth; // LSBs per carrier byte used for the secret data, from the header
+    int alpha; // the secret data also uses the alpha bytes, from the header
+    int scatter; // the secret data is spread in keyed order, from the header
+    CodecType codec; // compression of the secret data, from the header
+    int encrypt; // the secret data is a sealed stream, from the header
+    const char *key; // passphrase for the scatter order and the encryption
+    int streaming; // image or output is a standard stream: no threads
+    int version; // container header version, 0 for legacy images
+    int checksum; // a CRC32C follows the payload, from the header
+    uint payload_crc; // CRC32C of the payload bytes extracted so far
+    int verify; // check the payload without writing an output file
+    ShardInfo shard; // the secret bytes this image carries when split over several
+    Stats *stats; // per-stage timings and counters (--stats), NULL when off
+    int range; // extract only secret bytes [range_offset, range_offset + range_length)
+    size_t range_offset; // first secret byte to extract (--offset)
+    size_t range_length; // secret bytes from there (--length), SIZE_MAX for the rest; bytes written afterwards
+
+} DecodeInfo;
+
+/* Decoding function prototype */
+
+/* Read and validate Encode args from argv */
+Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
+
+/* Perform the encoding */
+Status do_decoding(DecodeInfo *decInfo);
+
+/* Get File pointers for i/p and o/p files */
+Status open_decode_files(DecodeInfo *decInfo);
+
+/* Map the stego image into memory */
+Status map_decode_files(DecodeInfo *decInfo);
+
+/* Release file pointers and mappings */
+void close_decode_files(DecodeInfo *decInfo);
+
+/* Copy bmp image header */
+Status skip_bmp_header(DecodeInfo *decInfo);
+
+/* Store Magic String */
+Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
+
+/*Extend file size*/
+long decode_secret_extn_file_size(DecodeInfo *decInfo); 
+
+/* Encode secret file extenstion */
+Status decode_secret_file_extn(int extn_size, DecodeInfo *decInfo);
+
+/* Encode secret file size */
+long decode_secret_file_size(DecodeInfo *decInfo);
+
+/* Output name: the output base name plus the decoded extension */
+Status create_output_file_name(DecodeInfo *decInfo);
+
+/* Decode the container header: magic, layout flags, extension and size */
+Status decode_stego_header(DecodeInfo *decInfo);
+
+/* Encode secret file data*/
+Status decode_secret_file_data(DecodeInfo *decInfo);
+
+#endif
@@ -1,32 +1,217 @@
+#define _GNU_SOURCE // copy_file_range
+
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fs.h>
+#include <sys/stat.h>
 #include "encode.h"
 #include "types.h"
 #include "common.h"
+#include "lsb.h"
+#include "parallel.h"
+#include "bmp.h"
+#include "scatter.h"
+#include "aead.h"
+#include "pack.h"
+#include "crc.h"
+#include "stego.h"
+#include "uring.h"
+#include "pipeline.h"
+#include "stats.h"
+
+static char *image_window(EncodeInfo *encInfo, size_t need); // Carrier bytes at the embed cursor
+static void reset_image_window(EncodeInfo *encInfo);        // Point the window at the image start
+static Status measure_packed_size(EncodeInfo *encInfo);     // Compressed size of the secret
+static Status resume_after_data(EncodeInfo *encInfo, size_t size); // Sequential path after out-of-band data
 
 /* Function Definitions */
 
 /* Get image size
  * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * Output: pixel bytes usable as carrier (row padding excluded), 0 if not a BMP
  */
 uint get_image_size_for_bmp(FILE *fptr_image)
 {
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
+    unsigned char header[BMP_HEADER_SIZE];
+    BmpInfo bmp;
 
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("width = %u\n", width);+
-
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("height = %u\n", height);
+    // Parse the header at offset 0
+    fseek(fptr_image, 0, SEEK_SET);
+    if (fread(header, 1, BMP_HEADER_SIZE, fptr_image) != BMP_HEADER_SIZE || bmp_parse(header, &bmp) == e_failure)
+        return 0;
 
     // Return image capacity
-    return width * height * 3;
+    return bmp.usable;
+}
+
+/* Check whether a stream supports seeking (false for pipes and terminals) */
+static int is_seekable(FILE *fptr)
+{
+    return fseek(fptr, 0, SEEK_CUR) == 0;
+}
+
+/* Check whether a name refers to a pipe or character device */
+static int is_stream_name(const char *name)
+{
+    struct stat st;
+    return strcmp(name, "-") == 0 || (stat(name, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)));
+}
+
+/* Check whether the stego image is rewritten in place (carrier and output are one file) */
+static int is_in_place(const EncodeInfo *encInfo)
+{
+    return encInfo->fptr_src_image == encInfo->fptr_stego_image;
+}
+
+/* Create the stego image as a copy of the source image
+ * Shares the extents with a reflink where the filesystem allows it,
+ * else copies inside the kernel with copy_file_range
+ */
+static Status clone_carrier(EncodeInfo *encInfo)
+{
+    char buf[64 * 1024];
+    ssize_t count;
+    struct stat st_src, st_stego;
+    Status status = e_success;
+
+    // Truncating the stego image must not wipe out the source
+    if (stat(encInfo->src_image_fname, &st_src) == 0 && stat(encInfo->stego_image_fname, &st_stego) == 0 &&
+        st_src.st_dev == st_stego.st_dev && st_src.st_ino == st_stego.st_ino)
+    {
+        fprintf(stderr, "ERROR: %s cannot be cloned onto itself\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    int src_fd = open(encInfo->src_image_fname, O_RDONLY);
+    if (src_fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    int stego_fd = open(encInfo->stego_image_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stego_fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
+        close(src_fd);
+        return e_failure;
+    }
+
+    if (ioctl(stego_fd, FICLONE, src_fd) != 0)
+    {
+        // No reflink support: copy inside the kernel, the offsets advance as it goes
+        while ((count = copy_file_range(src_fd, NULL, stego_fd, NULL, 1 << 30, 0)) > 0)
+            ;
+        // Refused (older kernels, across filesystems): finish through a user-space buffer
+        if (count < 0)
+        {
+            off_t off = lseek(stego_fd, 0, SEEK_CUR);
+            while ((count = read(src_fd, buf, sizeof(buf))) > 0)
+            {
+                if (pwrite_full(stego_fd, buf, count, off) == e_failure)
+                {
+                    count = -1;
+                    break;
+                }
+                off += count;
+            }
+        }
+        if (count < 0)
+        {
+            fprintf(stderr, "ERROR: Unable to copy %s to %s\n", encInfo->src_image_fname, encInfo->stego_image_fname);
+            status = e_failure;
+        }
+    }
+
+    close(src_fd);
+    if (close(stego_fd) != 0)
+        status = e_failure;
+    return status;
+}
+
+/* An in-place target must be a copy of the carrier: same size, same header up to the pixel data
+ * Rewriting the carrier itself needs no check
+ */
+static Status check_in_place_target(EncodeInfo *encInfo)
+{
+    unsigned char header[BMP_HEADER_SIZE];
+    struct stat src_st, stego_st;
+    BmpInfo bmp;
+    Status status = e_failure;
+    int src_fd = open(encInfo->src_image_fname, O_RDONLY);
+    int stego_fd = open(encInfo->stego_image_fname, O_RDONLY);
+
+    if (src_fd < 0 || stego_fd < 0 || fstat(src_fd, &src_st) != 0 || fstat(stego_fd, &stego_st) != 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open %s or %s\n", encInfo->src_image_fname, encInfo->stego_image_fname);
+    }
+    else if (src_st.st_dev == stego_st.st_dev && src_st.st_ino == stego_st.st_ino)
+    {
+        status = e_success;
+    }
+    else if (src_st.st_size == stego_st.st_size && pread_full(src_fd, header, BMP_HEADER_SIZE, 0) == e_success &&
+             bmp_parse(header, &bmp) == e_success && bmp.pixel_offset <= (size_t)src_st.st_size)
+    {
+        // Everything before the pixel data (bfOffBits, palette and masks included) must match
+        char *headers = malloc(2 * bmp.pixel_offset); // source, then target
+        if (headers != NULL && pread_full(src_fd, headers, bmp.pixel_offset, 0) == e_success &&
+            pread_full(stego_fd, headers + bmp.pixel_offset, bmp.pixel_offset, 0) == e_success &&
+            memcmp(headers, headers + bmp.pixel_offset, bmp.pixel_offset) == 0)
+            status = e_success;
+        free(headers);
+    }
+    if (status == e_failure && src_fd >= 0 && stego_fd >= 0)
+        fprintf(stderr, "ERROR: %s is not a copy of %s (size or BMP header differ)\n", encInfo->stego_image_fname,
+                encInfo->src_image_fname);
+
+    if (src_fd >= 0)
+        close(src_fd);
+    if (stego_fd >= 0)
+        close(stego_fd);
+    return status;
+}
+
+/* Open the stego image for an in-place rewrite, it doubles as the carrier */
+static Status open_in_place(EncodeInfo *encInfo)
+{
+    if (strcmp(encInfo->src_image_fname, "-") == 0 || strcmp(encInfo->stego_image_fname, "-") == 0)
+    {
+        fprintf(stderr, "ERROR: In-place encoding needs regular files, not streams\n");
+        return e_failure;
+    }
+    if (encInfo->write_mode == e_write_reflink && clone_carrier(encInfo) == e_failure)
+        return e_failure;
+    if (check_in_place_target(encInfo) == e_failure)
+        return e_failure;
+
+    // Secret file, "-" streams it from stdin
+    if (strcmp(encInfo->secret_fname, "-") == 0)
+        encInfo->fptr_secret = stdin;
+    else
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    if (encInfo->fptr_secret == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+        return e_failure;
+    }
+
+    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "r+b"); // existing image, kept as is past the payload
+    if (encInfo->fptr_stego_image == NULL)
+    {
+        perror("fopen");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
+        return e_failure;
+    }
+    encInfo->fptr_src_image = encInfo->fptr_stego_image;
+    encInfo->streaming = !is_seekable(encInfo->fptr_secret);
+    return e_success;
 }
 
 /* 
@@ -38,8 +223,18 @@ uint get_image_size_for_bmp(FILE *fptr_image)
  */
 Status open_files(EncodeInfo *encInfo)
 {
-    // Src Image file
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb"); //opeming file in read binary(rb) mode
+    encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+    encInfo->src_map = encInfo->stego_map = encInfo->secret_map = NULL;
+
+    // Rewrite an existing copy of the carrier instead of writing a new image
+    if (encInfo->write_mode != e_write_copy)
+        return open_in_place(encInfo);
+
+    // Src Image file, "-" streams it from stdin
+    if (strcmp(encInfo->src_image_fname, "-") == 0)
+        encInfo->fptr_src_image = stdin;
+    else
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb"); //opeming file in read binary(rb) mode
     // Do Error handling
     if (encInfo->fptr_src_image == NULL)
     {
@@ -49,8 +244,11 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
-    // Secret file
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    // Secret file, "-" streams it from stdin
+    if (strcmp(encInfo->secret_fname, "-") == 0)
+        encInfo->fptr_secret = stdin;
+    else
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
     // Do Error handling
     if (encInfo->fptr_secret == NULL)
     {
@@ -60,16 +258,23 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
-    // Stego Image file
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "wb"); // opening file in write binary (wb) mode
-    printf("DEBUG: trying to create %s\n", encInfo->stego_image_fname);
+    // Stego Image file, "-" streams it to stdout
+    if (strcmp(encInfo->stego_image_fname, "-") == 0)
+    {
+        encInfo->fptr_stego_image = stdout;
+        encInfo->quiet = 1;                                     // stdout carries the image now
+    }
+    else
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w+b"); // read/write binary so the file can also be mapped
+    if (!encInfo->quiet)
+        printf("DEBUG: trying to create %s\n", encInfo->stego_image_fname);
 if (encInfo->fptr_stego_image == NULL)
 {
     perror("fopen");
     fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->stego_image_fname);
     return e_failure;
 }
-else
+else if (!encInfo->quiet)
 {
     printf("DEBUG: stego image file opened successfully!\n");
 }
@@ -83,6 +288,10 @@ else
     	return e_failure;
     }
 
+    // Pipes can only be read or written front to back
+    encInfo->streaming = !is_seekable(encInfo->fptr_src_image) || !is_seekable(encInfo->fptr_secret) ||
+                         !is_seekable(encInfo->fptr_stego_image);
+
     // No failure return e_success
     return e_success;
 }
@@ -90,8 +299,12 @@ else
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
-    // Validate source image file (.bmp)
-    if (argv[2][0] != '.')
+    // Validate source image file (.bmp), "-" reads it from stdin
+    if (strcmp(argv[2], "-") == 0)
+    {
+        encInfo->src_image_fname = argv[2];
+    }
+    else if (argv[2][0] != '.')
     {
         if (strstr(argv[2], ".bmp"))
             encInfo->src_image_fname = argv[2];
@@ -106,8 +319,15 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     {
         return e_failure;
     }
+    // Streamed secret ("-", a pipe or /dev/fd/N): extension from --extn, else .txt
+    if (is_stream_name(argv[3]))
+    {
+        encInfo->secret_fname = argv[3];
+        if (encInfo->extn_secret_file[0] == '\0')
+            strcpy(encInfo->extn_secret_file, ".txt");
+    }
     // Validate secret file (.txt / .c / .sh)
-    if (argv[3][0] != '.')
+    else if (argv[3][0] != '.')
     {
         if (strstr(argv[3], ".txt") || strstr(argv[3], ".c") || strstr(argv[3], ".sh"))
         {
@@ -115,7 +335,11 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 
             // Extract and store file extension (like ".txt")
             char *dot = strchr(argv[3], '.');
-            if (dot != NULL)
+            if (dot != NULL && strlen(dot) >= MAX_FILE_SUFFIX)
+            {
+                return e_failure;                              // Extension does not fit the header
+            }
+            else if (dot != NULL)
             {
                 strcpy(encInfo->extn_secret_file, dot);
             }
@@ -130,14 +354,22 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     else
         return e_failure;
 
-    // If output name not given, use default "default.bmp"
+    // If output name not given, use default "default.bmp",
+    // or rewrite the source image itself in place
     if (argv[4] == NULL)
     {
-        encInfo->stego_image_fname = "default.bmp";
+        if (encInfo->write_mode == e_write_in_place)
+            encInfo->stego_image_fname = encInfo->src_image_fname;
+        else
+            encInfo->stego_image_fname = "default.bmp";
     }
     else
     {
-        if (argv[4][0] != '.')
+        if (strcmp(argv[4], "-") == 0)
+        {
+            encInfo->stego_image_fname = argv[4];               // Write the stego image to stdout
+        }
+        else if (argv[4][0] != '.')
         {
             if (strstr(argv[4], ".bmp"))
             {
@@ -156,31 +388,92 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 /* Encode integer (32 bits) into 32 LSBs of image buffer */
 Status encode_int_to_image(int size, char *image_buffer)
 {
-    for (int i = 31; i >= 0; i--)
-    {
-        int bit_data = (size >> i) & 1;                  // Extract each bit from MSB to LSB
-        image_buffer[31 - i] = image_buffer[31 - i] & (~1); // Clear LSB
-        image_buffer[31 - i] = image_buffer[31 - i] | bit_data; // Set LSB with bit_data
-    }
+    char bytes[4] = { size >> 24, size >> 16, size >> 8, size }; // MSB first
+    lsb_embed_bytes(image_buffer, bytes, 4);
     return e_success;
 }
 
 /* Check whether image has enough capacity to store secret data */
 Status check_capacity(EncodeInfo *encInfo)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image); // Total bytes in image
+    // The header comes from the first block, so the carrier may be a pipe
+    unsigned char *header = (unsigned char *)image_window(encInfo, BMP_HEADER_SIZE);
+    if (header == NULL)
+        return e_failure;
+    if (bmp_parse(header, &encInfo->bmp) == e_failure)
+    {
+        fprintf(stderr, "ERROR: %s is not an uncompressed BMP image\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+
+    if (!encInfo->quiet)
+    {
+        printf("width = %u\n", encInfo->bmp.width);
+        printf("height = %u\n", encInfo->bmp.height);
+    }
+    encInfo->image_capacity = encInfo->bmp.usable;              // Pixel bytes, row padding excluded
+    encInfo->bits_per_pixel = encInfo->bmp.bits_per_pixel;
+
+    // Get secret file size: given on the command line, the file size,
+    // or an 8-byte big-endian length prefix in front of a streamed secret
+    if (encInfo->secret_size_given)
+    {
+        // Size already known, nothing to measure
+    }
+    else if (is_seekable(encInfo->fptr_secret))
+    {
+        fseek(encInfo->fptr_secret, 0, SEEK_END);
+        encInfo->size_secret_file = ftell(encInfo->fptr_secret);
+        rewind(encInfo->fptr_secret);
+    }
+    else
+    {
+        unsigned char prefix[8];
+        if (fread(prefix, 1, 8, encInfo->fptr_secret) != 8)
+        {
+            fprintf(stderr, "ERROR: Missing length prefix on %s\n", encInfo->secret_fname);
+            return e_failure;
+        }
+        encInfo->size_secret_file = 0;
+        for (int i = 0; i < 8; i++)
+            encInfo->size_secret_file = encInfo->size_secret_file << 8 | prefix[i];
+    }
+
+    // Unset depth means the original one bit per carrier byte
+    if (encInfo->depth < MIN_DEPTH)
+        encInfo->depth = MIN_DEPTH;
+
+    // Carrier bytes required: header at 1 bit per byte, data at 'depth' bits per byte
+    size_t header_size = (encInfo->shard.count ? STEGO_SHARD_HEADER_SIZE : STEGO_HEADER_SIZE) * 8;
 
-    // Get secret file size
-    fseek(encInfo->fptr_secret, 0, SEEK_END);
-    encInfo->size_secret_file = ftell(encInfo->fptr_secret);
-    rewind(encInfo->fptr_secret);
+    // Data through the alpha bytes too: it starts where the header fields end, in that layout
+    BmpInfo data_bmp = encInfo->bmp;
+    if (encInfo->alpha && bmp_use_alpha(&data_bmp) == e_success)
+        header_size = bmp_carrier_pos(&data_bmp, bmp_file_end(&encInfo->bmp, header_size));
 
-    // Total bits required for encoding all data
-    long total_size_needed = (strlen(MAGIC_STRING) * 8) + 32 +
-                             (strlen(encInfo->extn_secret_file) * 8) + 32 +
-                             (encInfo->size_secret_file * 8);
+    // Pixel rows the header claims must be in the file (a pipe is only known short when it ends)
+    struct stat st;
+    size_t file_size = encInfo->src_map ? encInfo->map_size : SIZE_MAX;
+    if (encInfo->src_map == NULL && fstat(fileno(encInfo->fptr_src_image), &st) == 0 && S_ISREG(st.st_mode))
+        file_size = st.st_size;
+    if (bmp_file_end(&data_bmp, data_bmp.usable) > file_size)
+    {
+        fprintf(stderr, "ERROR: %s is shorter than its BMP header says\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    // A compressed secret is measured by a first pass, a sealed one grows by the salt and one tag per chunk
+    encInfo->packed_size = encInfo->size_secret_file;
+    if (encInfo->codec != e_codec_none && encInfo->size_secret_file >= 0 && measure_packed_size(encInfo) == e_failure)
+        return e_failure;
+    encInfo->payload_size = encInfo->encrypt ? (long)aead_stream_size(encInfo->packed_size) : encInfo->packed_size;
+    long total_size_needed = header_size + LSB_SPAN(encInfo->payload_size, encInfo->depth) + STEGO_CHECKSUM_SIZE * 8;
 
-    if (encInfo->image_capacity > total_size_needed)
+    if (encInfo->size_secret_file < 0)
+    {
+        fprintf(stderr, "ERROR: Invalid secret size\n");
+        return e_failure;
+    }
+    else if (data_bmp.usable > (size_t)total_size_needed)
     {
         return e_success;
     }
@@ -191,166 +484,1339 @@ Status check_capacity(EncodeInfo *encInfo)
     }
 }
 
-/* Copy 54-byte BMP header from source to destination */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+/* Allocate the block buffer shared by every encoding stage
+ * Layout: [chunk_size carrier bytes][chunk_size / 8 secret bytes]
+ */
+Status alloc_io_buffer(EncodeInfo *encInfo)
 {
-    char image_buffer[54];
-    rewind(fptr_src_image);                         // Move to beginning
-    fread(image_buffer, 1, 54, fptr_src_image);     // Read header
-    fwrite(image_buffer, 1, 54, fptr_dest_image);   // Write header
-    return e_success;
-}
+    if (encInfo->chunk_size == 0)
+        encInfo->chunk_size = DEFAULT_CHUNK_SIZE;
+    if (encInfo->chunk_size < MIN_CHUNK_SIZE)
+        encInfo->chunk_size = MIN_CHUNK_SIZE;
+    encInfo->chunk_size &= ~(size_t)7;                          // Keep whole secret bytes per block
 
-/* Encode a single byte into 8 LSBs of image data */
-Status encode_byte_to_lsb(char data, char *image_buffer)
-{
-    for (int i = 7; i >= 0; i--)
+    // Reuse a buffer kept from an earlier job when it is big enough
+    if (encInfo->io_buf != NULL && encInfo->io_buf_size >= encInfo->chunk_size)
+    {
+        encInfo->chunk_size = encInfo->io_buf_size;
+        reset_image_window(encInfo);
+        return e_success;
+    }
+
+    free(encInfo->io_buf);
+    encInfo->io_buf_size = encInfo->chunk_size;
+    encInfo->io_buf = malloc(encInfo->chunk_size + encInfo->chunk_size / 8);
+    if (encInfo->io_buf == NULL)
     {
-        int bit_data = (data >> i) & 1;             // Extract bit (MSB → LSB)
-        image_buffer[7 - i] = image_buffer[7 - i] & (~1); // Clear LSB
-        image_buffer[7 - i] = image_buffer[7 - i] | bit_data; // Write bit into LSB
+        fprintf(stderr, "ERROR: Unable to allocate %zu byte I/O buffer\n", encInfo->chunk_size);
+        return e_failure;
     }
+    reset_image_window(encInfo);
     return e_success;
 }
 
-/* Encode magic string (used for identification) */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+/* Map source, secret and stego files into memory
+ * Output: src_map, secret_map and a stego_map sized like the source image
+ * Return Value: e_failure when a file cannot be mapped (pipes, devices),
+ * nothing stays mapped and the stdio path takes over
+ */
+Status map_files(EncodeInfo *encInfo)
 {
-    char image_buffer[8];
-    for (int i = 0; i < strlen(magic_string); i++)
+    struct stat st_src, st_secret;
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+
+    if (fstat(fileno(encInfo->fptr_src_image), &st_src) != 0 || !S_ISREG(st_src.st_mode) || st_src.st_size < 54)
+        return e_failure;
+    if (fstat(fileno(encInfo->fptr_secret), &st_secret) != 0 || !S_ISREG(st_secret.st_mode))
+        return e_failure;
+    if (!is_in_place(encInfo) && (fflush(encInfo->fptr_stego_image) != 0 || ftruncate(stego_fd, st_src.st_size) != 0))
+        return e_failure;
+
+    encInfo->map_size = st_src.st_size;
+    encInfo->stego_map = mmap(NULL, encInfo->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, stego_fd, 0);
+    if (is_in_place(encInfo))
+        encInfo->src_map = encInfo->stego_map;                  // One shared mapping, only touched pages are written back
+    else
+        encInfo->src_map = mmap(NULL, encInfo->map_size, PROT_READ, MAP_PRIVATE, fileno(encInfo->fptr_src_image), 0);
+    encInfo->secret_map_size = st_secret.st_size;
+    if (st_secret.st_size > 0)
+        encInfo->secret_map = mmap(NULL, st_secret.st_size, PROT_READ, MAP_PRIVATE, fileno(encInfo->fptr_secret), 0);
+
+    if (encInfo->src_map == MAP_FAILED || encInfo->stego_map == MAP_FAILED || encInfo->secret_map == MAP_FAILED)
     {
-        fread(image_buffer, 1, 8, encInfo->fptr_src_image);     // Read 8 bytes
-        encode_byte_to_lsb(magic_string[i], image_buffer);      // Encode 1 char
-        fwrite(image_buffer, 1, 8, encInfo->fptr_stego_image);  // Write back
+        if (encInfo->src_map != MAP_FAILED && encInfo->src_map != encInfo->stego_map)
+            munmap(encInfo->src_map, encInfo->map_size);
+        if (encInfo->stego_map != MAP_FAILED)
+            munmap(encInfo->stego_map, encInfo->map_size);
+        if (encInfo->secret_map != NULL && encInfo->secret_map != MAP_FAILED)
+            munmap(encInfo->secret_map, encInfo->secret_map_size);
+        encInfo->src_map = encInfo->stego_map = encInfo->secret_map = NULL;
+        return e_failure;
     }
+    if (encInfo->secret_map)
+        encInfo->secret_map += encInfo->shard.offset;           // A shard starts further into the secret
+
+    if (!is_in_place(encInfo))
+        madvise(encInfo->src_map, encInfo->map_size, MADV_SEQUENTIAL);
+    if (encInfo->chunk_size == 0)
+        encInfo->chunk_size = DEFAULT_CHUNK_SIZE;
+    reset_image_window(encInfo);
     return e_success;
 }
 
-/* Encode size of secret file extension (32 bits) */
-Status encode_secret_extn_file_size(long file_size, EncodeInfo *encInfo)
+/* Point the window at the start of the stego image (mapping or block buffer) */
+static void reset_image_window(EncodeInfo *encInfo)
 {
-    char image_buffer[32];
-    fread(image_buffer, 1, 32, encInfo->fptr_src_image);        // Read 32 bytes
-    encode_int_to_image(file_size, image_buffer);               // Encode size
-    fwrite(image_buffer, 1, 32, encInfo->fptr_stego_image);     // Write encoded bytes
-    return e_success;
+    encInfo->win = encInfo->stego_map ? encInfo->stego_map : encInfo->io_buf;
+    encInfo->win_len = encInfo->win_pos = encInfo->win_off = 0;
+    encInfo->carrier_pos = 0;
 }
 
-/* Encode file extension (.txt / .c / .sh) */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+/* Release file pointers, mappings and block buffer */
+void close_files(EncodeInfo *encInfo)
 {
-    char image_buffer[8];
-    for (int i = 0; i < strlen(file_extn); i++)
+    if (encInfo->stego_map)
     {
-        fread(image_buffer, 1, 8, encInfo->fptr_src_image);      // Read 8 bytes
-        encode_byte_to_lsb(file_extn[i], image_buffer);          // Encode one char
-        fwrite(image_buffer, 1, 8, encInfo->fptr_stego_image);   // Write encoded bytes
+        if (encInfo->src_map != encInfo->stego_map)
+            munmap(encInfo->src_map, encInfo->map_size);
+        munmap(encInfo->stego_map, encInfo->map_size);
+        if (encInfo->secret_map)
+            munmap(encInfo->secret_map - encInfo->shard.offset, encInfo->secret_map_size);
     }
-    return e_success;
+    // Standard streams stay open for the caller
+    if (encInfo->fptr_src_image && encInfo->fptr_src_image != stdin && !is_in_place(encInfo))
+        fclose(encInfo->fptr_src_image);
+    if (encInfo->fptr_secret && encInfo->fptr_secret != stdin)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_stego_image == stdout)
+        fflush(stdout);
+    else if (encInfo->fptr_stego_image)
+        fclose(encInfo->fptr_stego_image);
+    if (!encInfo->keep_io_buf)
+    {
+        free(encInfo->io_buf);
+        encInfo->io_buf = NULL;
+    }
+
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_stego_image = NULL;
+    encInfo->src_map = encInfo->stego_map = encInfo->secret_map = NULL;
 }
 
-/* Encode size of secret file (32 bits) */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
+/* Write out the consumed part of the window and keep the unconsumed tail */
+static Status flush_image_window(EncodeInfo *encInfo)
 {
-    char image_buffer[32];
-    fread(image_buffer, 1, 32, encInfo->fptr_src_image);         // Read 32 bytes
-    encode_int_to_image(file_size, image_buffer);                // Encode size
-    fwrite(image_buffer, 1, 32, encInfo->fptr_stego_image);      // Write encoded bytes
+    if (encInfo->stego_map)
+        return e_success;                                       // Mapped output is written in place
+
+    if (encInfo->win_pos > 0)
+    {
+        // In place: positional write back over the carrier bytes the window was read from
+        if (is_in_place(encInfo) ?
+            pwrite_full(fileno(encInfo->fptr_stego_image), encInfo->io_buf, encInfo->win_pos, encInfo->win_off) == e_failure :
+            fwrite(encInfo->io_buf, 1, encInfo->win_pos, encInfo->fptr_stego_image) != encInfo->win_pos)
+        {
+            fprintf(stderr, "ERROR: Unable to write %s\n", encInfo->stego_image_fname);
+            return e_failure;
+        }
+        memmove(encInfo->io_buf, encInfo->io_buf + encInfo->win_pos, encInfo->win_len - encInfo->win_pos);
+        encInfo->win_len -= encInfo->win_pos;
+        encInfo->win_off += encInfo->win_pos;
+        encInfo->win_pos = 0;
+    }
     return e_success;
 }
 
-/* Encode secret file content (character by character) */
-Status encode_secret_file_data(EncodeInfo *encInfo)
+/* Get at least 'need' carrier bytes at the embed cursor
+ * Flushes and refills the window with a whole block when it runs dry
+ * Return Value: pointer into the window, NULL if the carrier is too short
+ */
+static char *image_window(EncodeInfo *encInfo, size_t need)
 {
-    rewind(encInfo->fptr_secret);                                // Move to start of secret file
-    char image_buffer[8], ch;
-
-    for (int i = 0; i < encInfo->size_secret_file; i++)
+    if (encInfo->stego_map && encInfo->win_len - encInfo->win_pos < need)
     {
-        fread(&ch, 1, 1, encInfo->fptr_secret);                  // Read 1 byte from secret file
-        fread(image_buffer, 1, 8, encInfo->fptr_src_image);      // Read 8 bytes from image
-        encode_byte_to_lsb(ch, image_buffer);                    // Encode that byte
-        fwrite(image_buffer, 1, 8, encInfo->fptr_stego_image);   // Write encoded bytes
+        // Populate the next block of the mapped output from the mapped source
+        size_t len = encInfo->win_len + encInfo->chunk_size;
+        if (len < encInfo->win_pos + need)
+            len = encInfo->win_pos + need;
+        if (len > encInfo->map_size)
+            len = encInfo->map_size;
+
+        if (encInfo->src_map != encInfo->stego_map)
+            memcpy(encInfo->win + encInfo->win_len, encInfo->src_map + encInfo->win_len, len - encInfo->win_len);
+        encInfo->win_len = len;
+        if (encInfo->win_len - encInfo->win_pos < need)
+        {
+            fprintf(stderr, "ERROR: Unexpected end of %s\n", encInfo->src_image_fname);
+            return NULL;
+        }
     }
+    else if (encInfo->win_len - encInfo->win_pos < need)
+    {
+        if (flush_image_window(encInfo) == e_failure)
+            return NULL;
 
-    return e_success;
+        if (is_in_place(encInfo))
+        {
+            ssize_t count = pread(fileno(encInfo->fptr_src_image), encInfo->io_buf + encInfo->win_len,
+                                  encInfo->chunk_size - encInfo->win_len, encInfo->win_off + encInfo->win_len);
+            if (count > 0)
+                encInfo->win_len += count;
+        }
+        else
+            encInfo->win_len += fread(encInfo->io_buf + encInfo->win_len, 1,
+                                      encInfo->chunk_size - encInfo->win_len, encInfo->fptr_src_image);
+        if (encInfo->win_len < need)
+        {
+            fprintf(stderr, "ERROR: Unexpected end of %s\n", encInfo->src_image_fname);
+            return NULL;
+        }
+    }
+    return encInfo->win + encInfo->win_pos;
 }
 
-/* Copy remaining image data after encoding is done */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+/* Copy the BMP header (and any palette or masks up to the pixels) from source to destination */
+Status copy_bmp_header(EncodeInfo *encInfo)
 {
-    char ch;
-    while (fread(&ch, 1, 1, fptr_src) > 0)                      // Copy byte by byte till EOF
-    {                       
-        fwrite(&ch, 1, 1, fptr_dest);
+    size_t left = encInfo->bmp.pixel_offset - (encInfo->win_off + encInfo->win_pos);
+
+    // Header passes through unchanged, block by block when it outgrows one
+    while (left > 0)
+    {
+        if (image_window(encInfo, 1) == NULL)
+            return e_failure;
+        size_t count = encInfo->win_len - encInfo->win_pos < left ? encInfo->win_len - encInfo->win_pos : left;
+        encInfo->win_pos += count;
+        left -= count;
     }
+    encInfo->carrier_pos = 0;
+    return e_success;
+}
 
-    // Verify same file size after copy
-    if (ftell(fptr_src) == ftell(fptr_dest))
-        return e_success;
-    else
-        return e_failure;
+/* Encode a single byte into 8 LSBs of image data */
+Status encode_byte_to_lsb(char data, char *image_buffer)
+{
+    lsb_embed_bytes(image_buffer, &data, 1);                    // Bit (MSB → LSB) per image byte
+    return e_success;
 }
 
-/* Perform the encoding */
-Status do_encoding(EncodeInfo *encInfo)
+/* Embed 'count' bytes at 'depth' into carrier bytes pos.. of 'buf'
+ * With --verify-on-write the run is extracted again from the buffer it
+ * was written to and compared with 'data', before the buffer goes out
+ */
+static Status place_carrier(EncodeInfo *encInfo, char *buf, size_t buf_off, size_t pos, const char *data, size_t count, int depth)
 {
-    //Open all required files
-    if (open_files(encInfo) == e_failure)
+    bmp_embed(&encInfo->bmp, buf, buf_off, pos, data, count, depth);
+    if (encInfo->verify_write && bmp_verify(&encInfo->bmp, buf, buf_off, pos, data, count, depth) == e_failure)
     {
+        fprintf(stderr, "ERROR: Data embedded at carrier byte %zu of %s does not read back\n", pos, encInfo->stego_image_fname);
         return e_failure;
     }
+    return e_success;
+}
 
-    //Check if image has enough capacity
-    if (check_capacity(encInfo) == e_failure)
+/* Embed 'count' bytes at 'depth' into scattered slots from 'slot' on, read back with --verify-on-write */
+static Status place_scattered(EncodeInfo *encInfo, const Scatter *sc, size_t data_pos, size_t slot, const char *data,
+                              size_t count, int depth)
+{
+    if (!encInfo->verify_write)
     {
-        return e_failure;
+        scatter_embed(sc, &encInfo->bmp, encInfo->stego_map, data_pos, slot, data, count, depth);
+        return e_success;
     }
-
-    //Copy 54-byte BMP header
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
+    if (scatter_embed_verified(sc, &encInfo->bmp, encInfo->stego_map, data_pos, slot, data, count, depth) == e_failure)
     {
+        fprintf(stderr, "ERROR: Data embedded at slot %zu of %s does not read back\n", slot, encInfo->stego_image_fname);
         return e_failure;
     }
+    return e_success;
+}
+
+/* Embed 'count' bytes at 'depth' bits per carrier byte from the embed cursor on
+ * Runs stop at the end of the window; row padding passes through untouched
+ */
+static Status embed_carrier(const char *data, size_t count, int depth, EncodeInfo *encInfo)
+{
+    const BmpInfo *bmp = &encInfo->bmp;
+    const size_t group = LSB_GROUP(depth), span = group * 8 / depth;
 
-    //Encode magic string to mark image as stego
-    if (encode_magic_string(MAGIC_STRING, encInfo) == e_failure)
+    while (count > 0)
     {
-        return e_failure;
+        size_t pos = encInfo->carrier_pos;
+        size_t first = LSB_SPAN(count < group ? count : group, depth);
+        size_t cursor = encInfo->win_off + encInfo->win_pos;
+        if (image_window(encInfo, bmp_file_end(bmp, pos + first) - cursor) == NULL)
+            return e_failure;
+
+        // Whole units held by the window
+        size_t run = (bmp_carrier_pos(bmp, encInfo->win_off + encInfo->win_len) - pos) / span * group;
+        if (run > count || run == 0)
+            run = count;
+        if (place_carrier(encInfo, encInfo->win, encInfo->win_off, pos, data, run, depth) == e_failure)
+            return e_failure;
+
+        encInfo->carrier_pos = pos + LSB_SPAN(run, depth);
+        encInfo->win_pos = bmp_file_end(bmp, encInfo->carrier_pos) - encInfo->win_off;
+        data += run;
+        count -= run;
     }
+    return e_success;
+}
+
+/* Encode 'len' bytes into consecutive carrier bytes of the window */
+static Status encode_bytes_to_image(const char *data, size_t len, EncodeInfo *encInfo)
+{
+    return embed_carrier(data, len, MIN_DEPTH, encInfo);       // Bit (MSB → LSB) per image byte
+}
+
+/* Store 'len' bytes of 'value' big-endian */
+static void put_be(unsigned char *p, uint64_t value, int len)
+{
+    for (int i = len - 1; i >= 0; i--, value >>= 8)
+        p[i] = value;
+}
+
+/* Encode the versioned container header: magic, flags, 64-bit payload size,
+ * extension, the shard fields of a split secret and the CRC, built in
+ * memory and embedded with one kernel call
+ */
+Status encode_stego_header(EncodeInfo *encInfo)
+{
+    unsigned char header[STEGO_HEADER_MAX];
+    StegoHeader h;
+
+    // Extension length and how the data is laid out, as in the legacy extension size field
+    h.flags = strlen(encInfo->extn_secret_file) | (encInfo->depth - 1) << EXTN_DEPTH_SHIFT | EXTN_CHECKSUM_FLAG;
+    if (bmp_has_padding(&encInfo->bmp))
+        h.flags |= EXTN_ROWS_FLAG;                              // Payload follows the rows, not the file
+    if (encInfo->alpha && encInfo->bmp.pixel_bytes == 4)
+        h.flags |= EXTN_ALPHA_FLAG;
+    if (encInfo->scatter)
+        h.flags |= EXTN_SCATTER_FLAG;
+    if (encInfo->encrypt)
+        h.flags |= EXTN_SEALED_FLAG;
+    h.flags |= (long)encInfo->codec << EXTN_CODEC_SHIFT;
+    h.payload_size = encInfo->payload_size;
+    strcpy(h.extn, encInfo->extn_secret_file);
+    h.shard = encInfo->shard;
+
+    return encode_bytes_to_image((const char *)header, stego_header_pack(&h, header), encInfo);
+}
+
+/* Embed a chunk of secret bytes in runs that fit the current window
+ * Runs hold whole kernel units, only the last unit of the secret may be partial
+ */
+static Status embed_secret_chunk(const char *secret_buffer, size_t count, EncodeInfo *encInfo)
+{
+    encInfo->payload_crc = crc32c(encInfo->payload_crc, secret_buffer, count);
+    return embed_carrier(secret_buffer, count, encInfo->depth, encInfo);
+}
+
+/* Shared state of a parallel data stage */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    size_t data_pos; // carrier offset of the first data carrier byte
+} DataJob;
+
+/* Worker: embed secret bytes [begin, end) at their own carrier offsets
+ * Bit i of the secret always lands in carrier byte data_pos + i; the slice
+ * owns the file bytes up to the next slice, row padding included, and
+ * folds the CRC of its bytes into the payload CRC
+ */
+static Status encode_data_slice(void *arg, size_t begin, size_t end)
+{
+    DataJob *job = arg;
+    EncodeInfo *encInfo = job->encInfo;
+    const BmpInfo *bmp = &encInfo->bmp;
+    const int depth = encInfo->depth;
+    size_t pos = job->data_pos + LSB_SPAN(begin, depth);        // begin is a whole number of units
 
-    //Encode file extension size (.txt -> 4)
-    long extn_size = strlen(encInfo->extn_secret_file);
-    if (encode_secret_extn_file_size(extn_size, encInfo) == e_failure)
+    // Mapped: copy the carrier range and embed in place
+    if (encInfo->stego_map)
     {
-        return e_failure;
+        size_t off = bmp_file_end(bmp, pos), len = bmp_file_end(bmp, pos + LSB_SPAN(end - begin, depth)) - off;
+        if (encInfo->src_map != encInfo->stego_map)
+            memcpy(encInfo->stego_map + off, encInfo->src_map + off, len);
+        crc32c_fold(&encInfo->payload_crc, crc32c(0, encInfo->secret_map + begin, end - begin), encInfo->size_secret_file - end);
+        return place_carrier(encInfo, encInfo->stego_map, 0, pos, encInfo->secret_map + begin, end - begin, depth);
     }
 
-    //Encode file extension characters
-    if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == e_failure)
-    {
+    // Stdio files: private block buffer, positional reads and writes
+    size_t chunk = encInfo->chunk_size / 8 / LSB_GROUP(depth) * LSB_GROUP(depth);
+    size_t image_size = bmp_file_span_max(bmp, LSB_SPAN(chunk, depth));
+    char *image_buffer = malloc(image_size + chunk);
+    if (image_buffer == NULL)
         return e_failure;
-    }
 
-    //Encode secret file size (in bytes)
-    if (encode_secret_file_size(encInfo->size_secret_file, encInfo) == e_failure)
+    char *secret_buffer = image_buffer + image_size;
+    int src_fd = fileno(encInfo->fptr_src_image);
+    int secret_fd = fileno(encInfo->fptr_secret);
+    int stego_fd = fileno(encInfo->fptr_stego_image);
+    Status status = e_success;
+    uint crc = 0;
+
+    for (size_t i = begin; i < end && status == e_success; i += chunk, pos += LSB_SPAN(chunk, depth))
     {
-        return e_failure;
+        size_t count = end - i < chunk ? end - i : chunk;
+        size_t off = bmp_file_end(bmp, pos), len = bmp_file_end(bmp, pos + LSB_SPAN(count, depth)) - off;
+
+        if (pread_full(secret_fd, secret_buffer, count, encInfo->shard.offset + i) == e_failure ||
+            pread_full(src_fd, image_buffer, len, off) == e_failure)
+        {
+            fprintf(stderr, "ERROR: Unable to read block at secret offset %zu\n", i);
+            status = e_failure;
+            break;
+        }
+        crc = crc32c(crc, secret_buffer, count);
+        if (place_carrier(encInfo, image_buffer, off, pos, secret_buffer, count, depth) == e_failure)
+            status = e_failure;
+        else if (pwrite_full(stego_fd, image_buffer, len, off) == e_failure)
+        {
+            fprintf(stderr, "ERROR: Unable to write %s\n", encInfo->stego_image_fname);
+            status = e_failure;
+        }
     }
 
-    //Encode secret file data
-    if (encode_secret_file_data(encInfo) == e_failure)
+    free(image_buffer);
+    crc32c_fold(&encInfo->payload_crc, crc, encInfo->size_secret_file - end);
+    return status;
+}
+
+/* Embed the whole secret with worker threads, each on its own slice */
+static Status encode_secret_data_parallel(EncodeInfo *encInfo)
+{
+    DataJob job = { encInfo, encInfo->carrier_pos };
+    size_t size = encInfo->size_secret_file;
+    size_t end = bmp_file_end(&encInfo->bmp, encInfo->carrier_pos + LSB_SPAN(size, encInfo->depth));
+
+    // Mapped: every slice must land inside the mapping; stdio: everything
+    // before the data goes out first, workers write after it
+    if (encInfo->stego_map)
+    {
+        if (encInfo->map_size < end)
+            return e_failure;
+    }
+    else if (flush_image_window(encInfo) == e_failure || fflush(encInfo->fptr_stego_image) != 0)
     {
         return e_failure;
     }
 
-    //Copy remaining image data to stego file
-    if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == e_failure)
-    {
+    if (parallel_for(encInfo->threads, size, LSB_GROUP(encInfo->depth), encode_data_slice, &job) == e_failure)
         return e_failure;
+    return resume_after_data(encInfo, size);
+}
+
+/* Continue sequentially right after 'size' data bytes written out of band */
+static Status resume_after_data(EncodeInfo *encInfo, size_t size)
+{
+    encInfo->carrier_pos += LSB_SPAN(size, encInfo->depth);
+    size_t off = bmp_file_end(&encInfo->bmp, encInfo->carrier_pos);
+    if (encInfo->stego_map)
+    {
+        encInfo->win_pos = off;                                 // Window is the whole stego file
+        if (encInfo->win_len < encInfo->win_pos)
+            encInfo->win_len = encInfo->win_pos;
+        return e_success;
     }
 
-    //Encoding successful
+    encInfo->win_len = encInfo->win_pos = 0;
+    encInfo->win_off = off;
+    if (is_in_place(encInfo))
+        return e_success;                                       // Window refills with pread at win_off
+    if (fseek(encInfo->fptr_src_image, off, SEEK_SET) != 0 ||
+        fseek(encInfo->fptr_stego_image, off, SEEK_SET) != 0)
+        return e_failure;
     return e_success;
 }
- 
+
+/* One block of the io_uring pipeline: file bytes [off, off + len) of the
+ * carrier, with secret bytes [begin, begin + count) embedded into them
+ * (count 0 when the block is only copied)
+ */
+typedef struct
+{
+    char *image; // carrier bytes, read from the source and written to the stego image
+    char *secret; // secret bytes of the block
+    size_t off, len;
+    size_t pos; // carrier offset of the block's first data carrier byte
+    size_t begin, count;
+    int pending; // requests in flight: the reads, then the write
+    int writing; // reads done, the block is on its way out
+    size_t done[3]; // bytes moved by the source read, secret read and write
+} UringBlock;
+
+/* State of one pass over the ring */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    Uring ring;
+    UringBlock blocks[URING_DEPTH];
+    size_t next; // next secret byte (data) or file offset (copy) to hand out
+    size_t end; // end of the secret (data) or of the file (copy)
+    size_t chunk; // secret bytes (data) or file bytes (copy) per block
+    size_t data_pos; // carrier offset of the first data carrier byte
+    int copy; // blocks are copied, nothing is embedded
+    int src_fd, secret_fd, stego_fd;
+    int active; // blocks in flight
+    int failed;
+} UringJob;
+
+/* (Re)queue what is left of request 'which' of block 'b': 0 source read, 1 secret read, 2 write */
+static Status uring_issue(UringJob *job, UringBlock *b, int which)
+{
+    uint64_t tag = (uint64_t)(b - job->blocks) << 2 | which;
+    size_t done = b->done[which];
+
+    if (which == 0)
+        return uring_queue(&job->ring, 0, job->src_fd, b->image + done, b->len - done, b->off + done, tag);
+    if (which == 1)
+        return uring_queue(&job->ring, 0, job->secret_fd, b->secret + done, b->count - done,
+                           job->encInfo->shard.offset + b->begin + done, tag);
+    return uring_queue(&job->ring, 1, job->stego_fd, b->image + done, b->len - done, b->off + done, tag);
+}
+
+/* Give block 'b' the next range and queue its reads
+ * Return Value: 0 when nothing is left to hand out
+ */
+static int uring_start_block(UringJob *job, UringBlock *b)
+{
+    const BmpInfo *bmp = &job->encInfo->bmp;
+    const int depth = job->encInfo->depth;
+
+    if (job->failed || job->next >= job->end)
+        return 0;
+
+    b->begin = job->next;
+    b->count = 0;
+    if (job->copy)
+    {
+        b->off = job->next;
+        b->len = job->end - job->next < job->chunk ? job->end - job->next : job->chunk;
+        job->next += b->len;
+    }
+    else
+    {
+        // Same geometry as a worker slice: bit i of the secret lands in carrier byte data_pos + i
+        b->count = job->end - job->next < job->chunk ? job->end - job->next : job->chunk;
+        b->pos = job->data_pos + LSB_SPAN(b->begin, depth);
+        b->off = bmp_file_end(bmp, b->pos);
+        b->len = bmp_file_end(bmp, b->pos + LSB_SPAN(b->count, depth)) - b->off;
+        job->next += b->count;
+    }
+    b->done[0] = b->done[1] = b->done[2] = 0;
+    b->writing = 0;
+    b->pending = b->count ? 2 : 1;
+    uring_issue(job, b, 0);
+    if (b->count)
+        uring_issue(job, b, 1);
+    job->active++;
+    return 1;
+}
+
+/* Handle one completion: resubmit short transfers, embed a block once
+ * its reads are in, recycle it once its write is out
+ */
+static void uring_complete(UringJob *job, uint64_t tag, int res)
+{
+    UringBlock *b = &job->blocks[tag >> 2];
+    int which = tag & 3;
+    size_t want = which == 1 ? b->count : b->len;
+
+    if (res <= 0 && !job->failed)
+    {
+        fprintf(stderr, "ERROR: %s %s at offset %zu\n", which == 2 ? "Unable to write" : "Unexpected end of",
+                which == 2 ? job->encInfo->stego_image_fname : which == 1 ? job->encInfo->secret_fname : job->encInfo->src_image_fname,
+                which == 1 ? b->begin : b->off);
+        job->failed = 1;
+    }
+    if (res > 0 && !job->failed && (b->done[which] += res) < want)
+    {
+        uring_issue(job, b, which);                             // Short transfer: the rest goes again
+        return;
+    }
+    if (--b->pending > 0)
+        return;
+
+    if (!b->writing && !job->failed)
+    {
+        EncodeInfo *encInfo = job->encInfo;
+        if (b->count)
+        {
+            if (place_carrier(encInfo, b->image, b->off, b->pos, b->secret, b->count, encInfo->depth) == e_failure)
+                job->failed = 1;
+            crc32c_fold(&encInfo->payload_crc, crc32c(0, b->secret, b->count), job->end - b->begin - b->count);
+        }
+        if (!job->failed)
+        {
+            b->writing = 1;
+            b->pending = 1;
+            uring_issue(job, b, 2);
+            return;
+        }
+    }
+    job->active--;
+    uring_start_block(job, b);
+}
+
+/* Run secret bytes [0, size) (or, with copy, file bytes [begin, size)) through
+ * URING_DEPTH blocks: while one block is embedded, the next ones are being
+ * read and the previous ones written
+ */
+static Status run_uring(EncodeInfo *encInfo, size_t begin, size_t size, int copy)
+{
+    UringJob job;
+    const size_t group = LSB_GROUP(encInfo->depth);
+    size_t chunk = copy ? encInfo->chunk_size : encInfo->chunk_size / 8 / group * group;
+    size_t image_size = copy ? chunk : bmp_file_span_max(&encInfo->bmp, LSB_SPAN(chunk, encInfo->depth));
+    size_t block_size = image_size + (copy ? 0 : chunk);
+
+    memset(&job, 0, sizeof(job));
+    if (uring_init(&job.ring, URING_DEPTH * 2) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to set up io_uring\n");
+        return e_failure;
+    }
+    char *buf = malloc(URING_DEPTH * block_size);
+    if (buf == NULL)
+    {
+        uring_exit(&job.ring);
+        return e_failure;
+    }
+
+    job.encInfo = encInfo;
+    job.next = begin;
+    job.end = size;
+    job.chunk = chunk;
+    job.data_pos = encInfo->carrier_pos;
+    job.copy = copy;
+    job.src_fd = fileno(encInfo->fptr_src_image);
+    job.secret_fd = fileno(encInfo->fptr_secret);
+    job.stego_fd = fileno(encInfo->fptr_stego_image);
+    for (int i = 0; i < URING_DEPTH; i++)
+    {
+        job.blocks[i].image = buf + i * block_size;
+        job.blocks[i].secret = job.blocks[i].image + image_size;
+        uring_start_block(&job, &job.blocks[i]);
+    }
+
+    // On failure nothing new starts, but every request in flight is reaped before the buffers go
+    while (job.active > 0)
+    {
+        uint64_t tag;
+        int res;
+        if (uring_wait(&job.ring, &tag, &res) == e_failure)
+        {
+            fprintf(stderr, "ERROR: io_uring wait failed\n");
+            job.failed = 1;
+            break;
+        }
+        uring_complete(&job, tag, res);
+    }
+
+    uring_exit(&job.ring);
+    free(buf);
+    return job.failed ? e_failure : e_success;
+}
+
+/* Shared state of a pipelined data stage or tail copy */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    size_t data_pos; // carrier offset of the first data carrier byte
+    size_t image_size; // carrier bytes at the start of a block, its secret bytes follow
+    int copy; // blocks are copied, nothing is embedded
+} PipeJob;
+
+/* File bytes [*off, *off + *len) behind range [begin, end) of a pipeline block
+ * Return Value: carrier offset of the block's first data carrier byte
+ */
+static size_t pipe_block(const PipeJob *job, size_t begin, size_t end, size_t *off, size_t *len)
+{
+    const BmpInfo *bmp = &job->encInfo->bmp;
+    const int depth = job->encInfo->depth;
+    size_t pos = job->data_pos + LSB_SPAN(begin, depth);
+
+    if (job->copy)
+    {
+        *off = begin;
+        *len = end - begin;
+        return 0;
+    }
+    *off = bmp_file_end(bmp, pos);
+    *len = bmp_file_end(bmp, pos + LSB_SPAN(end - begin, depth)) - *off;
+    return pos;
+}
+
+/* Reader stage: the block's carrier bytes, then its secret bytes after them */
+static Status pipe_read(void *arg, char *block, size_t begin, size_t end)
+{
+    PipeJob *job = arg;
+    EncodeInfo *encInfo = job->encInfo;
+    size_t off, len;
+
+    pipe_block(job, begin, end, &off, &len);
+    if (pread_full(fileno(encInfo->fptr_src_image), block, len, off) == e_failure ||
+        (!job->copy && pread_full(fileno(encInfo->fptr_secret), block + job->image_size, end - begin,
+                                  encInfo->shard.offset + begin) == e_failure))
+    {
+        fprintf(stderr, "ERROR: Unable to read block at %s offset %zu\n", job->copy ? "image" : "secret", begin);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Embedder stage: blocks arrive in order, so the payload CRC simply runs on */
+static Status pipe_embed(void *arg, char *block, size_t begin, size_t end)
+{
+    PipeJob *job = arg;
+    EncodeInfo *encInfo = job->encInfo;
+    const char *secret = block + job->image_size;
+    size_t off, len;
+    size_t pos = pipe_block(job, begin, end, &off, &len);
+
+    encInfo->payload_crc = crc32c(encInfo->payload_crc, secret, end - begin);
+    return place_carrier(encInfo, block, off, pos, secret, end - begin, encInfo->depth);
+}
+
+/* Writer stage: the block goes back to its own place in the stego image */
+static Status pipe_write(void *arg, char *block, size_t begin, size_t end)
+{
+    PipeJob *job = arg;
+    size_t off, len;
+
+    pipe_block(job, begin, end, &off, &len);
+    if (pwrite_full(fileno(job->encInfo->fptr_stego_image), block, len, off) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to write %s\n", job->encInfo->stego_image_fname);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Run secret bytes [0, size) (or, with copy, file bytes [begin, size)) through
+ * the reader, embedder and writer threads, PIPELINE_DEPTH blocks at most
+ */
+static Status run_pipeline(EncodeInfo *encInfo, size_t begin, size_t size, int copy)
+{
+    const size_t group = LSB_GROUP(encInfo->depth);
+    size_t chunk = copy ? encInfo->chunk_size : encInfo->chunk_size / 8 / group * group;
+    PipeJob job = { encInfo, encInfo->carrier_pos, copy ? chunk : bmp_file_span_max(&encInfo->bmp, LSB_SPAN(chunk, encInfo->depth)),
+                    copy };
+
+    return pipeline_run(begin, size, chunk, job.image_size + (copy ? 0 : chunk), pipe_read, copy ? NULL : pipe_embed,
+                        pipe_write, &job);
+}
+
+/* Move blocks through io_uring or the thread pipeline, as --io asks */
+static Status run_overlapped(EncodeInfo *encInfo, size_t begin, size_t size, int copy)
+{
+    if (encInfo->io_mode == e_io_uring)
+        return run_uring(encInfo, begin, size, copy);
+    return run_pipeline(encInfo, begin, size, copy);
+}
+
+/* Embed the whole secret with overlapped reads and writes, then continue sequentially after it */
+static Status encode_secret_data_overlapped(EncodeInfo *encInfo)
+{
+    size_t size = encInfo->size_secret_file;
+
+    // Everything before the data goes out first, the blocks are written after it
+    if (flush_image_window(encInfo) == e_failure || fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+    if (run_overlapped(encInfo, 0, size, 0) == e_failure)
+        return e_failure;
+    return resume_after_data(encInfo, size);
+}
+
+/* Shared state of a scattered data stage */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    size_t data_pos; // carrier offset of the first data carrier byte
+    Scatter sc; // keyed order over the carrier bytes left after the header
+} ScatterJob;
+
+/* Worker: embed secret bytes [begin, end) into their keyed carrier slots */
+static Status encode_scatter_slice(void *arg, size_t begin, size_t end)
+{
+    ScatterJob *job = arg;
+    EncodeInfo *encInfo = job->encInfo;
+
+    crc32c_fold(&encInfo->payload_crc, crc32c(0, encInfo->secret_map + begin, end - begin), encInfo->size_secret_file - end);
+    return place_scattered(encInfo, &job->sc, job->data_pos, LSB_SPAN(begin, encInfo->depth), encInfo->secret_map + begin,
+                           end - begin, encInfo->depth);
+}
+
+/* Start a scattered data stage: the whole image goes into the mapping,
+ * since any carrier byte after the header fields may change
+ */
+static Status begin_scatter(EncodeInfo *encInfo, ScatterJob *job)
+{
+    if (!encInfo->stego_map)
+    {
+        fprintf(stderr, "ERROR: Scattered data needs memory-mapped files\n");
+        return e_failure;
+    }
+    if (encInfo->map_size < bmp_file_end(&encInfo->bmp, encInfo->bmp.usable))
+    {
+        fprintf(stderr, "ERROR: %s ends before its last pixel row, scattered data may land there\n", encInfo->src_image_fname);
+        return e_failure;
+    }
+    if (encInfo->src_map != encInfo->stego_map)
+        memcpy(encInfo->stego_map + encInfo->win_len, encInfo->src_map + encInfo->win_len, encInfo->map_size - encInfo->win_len);
+    encInfo->win_len = encInfo->map_size;
+
+    job->encInfo = encInfo;
+    job->data_pos = encInfo->carrier_pos;
+    scatter_init(&job->sc, encInfo->key, encInfo->bmp.usable - job->data_pos);
+    return e_success;
+}
+
+/* Finish a scattered data stage: the cursor moves past the 'size' data bytes */
+static void end_scatter(EncodeInfo *encInfo, size_t size)
+{
+    encInfo->carrier_pos += LSB_SPAN(size, encInfo->depth);
+    encInfo->win_pos = bmp_file_end(&encInfo->bmp, encInfo->carrier_pos);
+}
+
+/* Embed the whole secret in keyed order over the rest of the carrier
+ * Every slot's position is computed on its own, so slices run in parallel
+ */
+static Status encode_secret_data_scattered(EncodeInfo *encInfo)
+{
+    ScatterJob job;
+    size_t size = encInfo->size_secret_file;
+
+    if (begin_scatter(encInfo, &job) == e_failure)
+        return e_failure;
+    if (parallel_for(encInfo->threads, size, LSB_GROUP(encInfo->depth), encode_scatter_slice, &job) == e_failure)
+        return e_failure;
+
+    end_scatter(encInfo, size);
+    return e_success;
+}
+
+/* Secret bytes on their way to the embedder: the raw secret, or its compressed frames */
+typedef struct
+{
+    EncodeInfo *encInfo;
+    size_t raw_pos; // secret bytes consumed
+    size_t batch; // secret bytes compressed at a time
+    char *raw; // secret bytes of one batch (unmapped secrets)
+    char *frames; // one PACK_FRAME_MAX slot per chunk of a batch
+    size_t frame_len[MAX_THREADS * PACK_BATCH_CHUNKS]; // bytes used in each slot
+    char *buf; // bytes ready to hand out
+    size_t buf_len; // valid bytes in buf
+    size_t buf_pos; // bytes of buf handed out
+} SecretStream;
+
+/* Shared state of a compression batch */
+typedef struct
+{
+    const char *raw; // secret bytes of the batch
+    SecretStream *stream;
+} PackJob;
+
+/* Worker: compress batch bytes [begin, end), begin is a whole number of chunks */
+static Status pack_slice(void *arg, size_t begin, size_t end)
+{
+    PackJob *job = arg;
+
+    for (size_t i = begin; i < end; i += PACK_CHUNK_SIZE)
+    {
+        size_t c = i / PACK_CHUNK_SIZE, len = end - i < PACK_CHUNK_SIZE ? end - i : PACK_CHUNK_SIZE;
+        job->stream->frame_len[c] = pack_frame(job->raw + i, len, job->stream->frames + c * PACK_FRAME_MAX);
+    }
+    return e_success;
+}
+
+/* Start reading the secret from its first byte; reads return at most 'max_read' bytes */
+static Status open_secret_stream(EncodeInfo *encInfo, SecretStream *stream, size_t max_read)
+{
+    int threads = encInfo->threads > 1 ? encInfo->threads : 1;
+    int mapped = encInfo->secret_map != NULL || encInfo->size_secret_file == 0;
+
+    memset(stream, 0, sizeof(*stream));
+    stream->encInfo = encInfo;
+    if (!encInfo->secret_map && is_seekable(encInfo->fptr_secret))
+        fseek(encInfo->fptr_secret, encInfo->shard.offset, SEEK_SET); // Move to start of secret (or of its shard)
+
+    // Raw secret: unmapped bytes are read straight into buf
+    if (encInfo->codec == e_codec_none)
+    {
+        stream->buf = mapped ? NULL : malloc(max_read);
+        return mapped || stream->buf ? e_success : e_failure;
+    }
+
+    // [leftover and one batch of frames][frame slots][raw batch]
+    stream->batch = (size_t)threads * PACK_BATCH_CHUNKS * PACK_CHUNK_SIZE;
+    size_t frames_size = (size_t)threads * PACK_BATCH_CHUNKS * PACK_FRAME_MAX;
+    stream->buf = malloc(max_read + 2 * frames_size + (mapped ? 0 : stream->batch));
+    if (stream->buf == NULL)
+        return e_failure;
+    stream->frames = stream->buf + max_read + frames_size;
+    stream->raw = mapped ? NULL : stream->frames + frames_size;
+    return e_success;
+}
+
+/* Compress the next batch of the secret and append its frames to buf */
+static Status fill_secret_stream(SecretStream *stream)
+{
+    EncodeInfo *encInfo = stream->encInfo;
+    size_t count = encInfo->size_secret_file - stream->raw_pos;
+    PackJob job = { stream->raw, stream };
+
+    if (count > stream->batch)
+        count = stream->batch;
+    if (stream->raw == NULL)
+        job.raw = encInfo->secret_map + stream->raw_pos;
+    else if (fread(stream->raw, 1, count, encInfo->fptr_secret) != count)
+    {
+        fprintf(stderr, "ERROR: Unable to read %s\n", encInfo->secret_fname);
+        return e_failure;
+    }
+    parallel_for(encInfo->threads, count, PACK_CHUNK_SIZE, pack_slice, &job);
+
+    // Frames in chunk order after what is still unread
+    memmove(stream->buf, stream->buf + stream->buf_pos, stream->buf_len - stream->buf_pos);
+    stream->buf_len -= stream->buf_pos;
+    stream->buf_pos = 0;
+    for (size_t c = 0; c * PACK_CHUNK_SIZE < count; c++)
+    {
+        memcpy(stream->buf + stream->buf_len, stream->frames + c * PACK_FRAME_MAX, stream->frame_len[c]);
+        stream->buf_len += stream->frame_len[c];
+    }
+    stream->raw_pos += count;
+    return e_success;
+}
+
+/* Next 'count' bytes of the secret stream, NULL if it ends or fails first */
+static const char *read_secret_stream(SecretStream *stream, size_t count)
+{
+    EncodeInfo *encInfo = stream->encInfo;
+
+    if (encInfo->codec == e_codec_none)
+    {
+        if (stream->buf == NULL)
+        {
+            stream->raw_pos += count;
+            return encInfo->secret_map + stream->raw_pos - count;   // Whole secret is already in memory
+        }
+        if (fread(stream->buf, 1, count, encInfo->fptr_secret) != count)
+        {
+            fprintf(stderr, "ERROR: Unable to read %s\n", encInfo->secret_fname);
+            return NULL;
+        }
+        return stream->buf;
+    }
+
+    while (stream->buf_len - stream->buf_pos < count && stream->raw_pos < (size_t)encInfo->size_secret_file)
+    {
+        if (fill_secret_stream(stream) == e_failure)
+            return NULL;
+    }
+    if (stream->buf_len - stream->buf_pos < count)
+        return NULL;
+    stream->buf_pos += count;
+    return stream->buf + stream->buf_pos - count;
+}
+
+/* Compressed size of the secret: a first pass that keeps no frames */
+static Status measure_packed_size(EncodeInfo *encInfo)
+{
+    SecretStream stream;
+    Status status = e_success;
+
+    if (!encInfo->secret_map && !is_seekable(encInfo->fptr_secret))
+    {
+        fprintf(stderr, "ERROR: Compressing %s needs a seekable secret\n", encInfo->secret_fname);
+        return e_failure;
+    }
+    if (open_secret_stream(encInfo, &stream, 0) == e_failure)
+        return e_failure;
+
+    encInfo->packed_size = 0;
+    while (stream.raw_pos < (size_t)encInfo->size_secret_file && status == e_success)
+    {
+        status = fill_secret_stream(&stream);
+        encInfo->packed_size += stream.buf_len;
+        stream.buf_len = 0;
+    }
+    free(stream.buf);
+    return status;
+}
+
+/* Embed the compressed secret a block at a time, in order or scattered */
+static Status encode_secret_data_packed(EncodeInfo *encInfo)
+{
+    const size_t chunk = encInfo->chunk_size / 8 / LSB_GROUP(encInfo->depth) * LSB_GROUP(encInfo->depth);
+    size_t size = encInfo->packed_size;
+    SecretStream stream;
+    ScatterJob scatter;
+    Status status = e_success;
+
+    if (encInfo->scatter && begin_scatter(encInfo, &scatter) == e_failure)
+        return e_failure;
+    if (open_secret_stream(encInfo, &stream, chunk) == e_failure)
+        return e_failure;
+
+    for (size_t done = 0; done < size && status == e_success; done += chunk)
+    {
+        size_t count = size - done < chunk ? size - done : chunk;
+        const char *data = read_secret_stream(&stream, count);
+
+        if (data == NULL)
+            status = e_failure;
+        else if (encInfo->scatter)
+        {
+            encInfo->payload_crc = crc32c(encInfo->payload_crc, data, count);
+            status = place_scattered(encInfo, &scatter.sc, scatter.data_pos, LSB_SPAN(done, encInfo->depth), data, count,
+                                     encInfo->depth);
+        }
+        else
+            status = embed_secret_chunk(data, count, encInfo);
+    }
+
+    if (encInfo->scatter && status == e_success)
+        end_scatter(encInfo, size);
+    free(stream.buf);
+    return status;
+}
+
+/* Shared state of a sealing batch */
+typedef struct
+{
+    const AeadKey *key;
+    size_t plain; // secret bytes in the whole secret
+    size_t base; // secret offset of the batch
+    const char *in; // batch plaintext
+    char *out; // batch records
+} SealJob;
+
+/* Worker: seal batch bytes [begin, end), begin is a whole number of chunks */
+static Status seal_slice(void *arg, size_t begin, size_t end)
+{
+    SealJob *job = arg;
+
+    aead_seal_range(job->key, job->plain, job->base + begin, job->base + end, job->in + begin,
+                    job->out + begin / AEAD_CHUNK_SIZE * AEAD_RECORD_SIZE);
+    return e_success;
+}
+
+/* Encrypt the secret in chunks as it is read and embed the sealed stream
+ * A batch of chunks is sealed on the worker threads, then embedded in order;
+ * only a batch of plaintext and records is ever held in memory
+ */
+static Status encode_secret_data_sealed(EncodeInfo *encInfo)
+{
+    const size_t group = LSB_GROUP(encInfo->depth);
+    const size_t batch = (encInfo->threads > 1 ? encInfo->threads : 1) * AEAD_BATCH_CHUNKS * AEAD_CHUNK_SIZE;
+    size_t plain = encInfo->packed_size, done = 0, held = AEAD_SALT_SIZE, payload_off = 0;
+    unsigned char salt[AEAD_SALT_SIZE];
+    AeadKey key;
+    SecretStream stream;
+    ScatterJob scatter;
+    Status status = e_success;
+
+    if (aead_random_salt(salt) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to get random bytes for the salt\n");
+        return e_failure;
+    }
+    if (encInfo->scatter && begin_scatter(encInfo, &scatter) == e_failure)
+        return e_failure;
+    aead_derive_key(&key, encInfo->key, salt);
+
+    // Records of one batch, after a unit remainder or the salt
+    char *out = malloc(AEAD_SALT_SIZE + aead_records_size(batch));
+    if (out == NULL)
+        return e_failure;
+    if (open_secret_stream(encInfo, &stream, batch) == e_failure)
+    {
+        free(out);
+        return e_failure;
+    }
+
+    memcpy(out, salt, AEAD_SALT_SIZE);
+    do
+    {
+        size_t count = plain - done < batch ? plain - done : batch;
+        SealJob job = { &key, plain, done, read_secret_stream(&stream, count), out + held };
+
+        if (job.in == NULL && count > 0)
+        {
+            status = e_failure;
+            break;
+        }
+        parallel_for(encInfo->threads, count, AEAD_CHUNK_SIZE, seal_slice, &job);
+        held += aead_records_size(count);
+        done += count;
+
+        // Whole kernel units go out now, a partial one waits for the next batch
+        size_t len = done == plain ? held : held / group * group;
+        if (encInfo->scatter)
+        {
+            encInfo->payload_crc = crc32c(encInfo->payload_crc, out, len);
+            status = place_scattered(encInfo, &scatter.sc, scatter.data_pos, LSB_SPAN(payload_off, encInfo->depth), out, len,
+                                     encInfo->depth);
+        }
+        else
+            status = embed_secret_chunk(out, len, encInfo);
+        if (status == e_failure)
+            break;
+        payload_off += len;
+        memmove(out, out + len, held - len);
+        held -= len;
+    } while (done < plain);
+
+    if (encInfo->scatter && status == e_success)
+        end_scatter(encInfo, payload_off);
+    free(stream.buf);
+    free(out);
+    return status;
+}
+
+/* Embed the payload through the path its options call for */
+static Status encode_payload(EncodeInfo *encInfo)
+{
+    if (encInfo->encrypt)
+        return encode_secret_data_sealed(encInfo);
+    if (encInfo->codec != e_codec_none)
+        return encode_secret_data_packed(encInfo);
+    if (encInfo->scatter)
+        return encode_secret_data_scattered(encInfo);
+
+    if ((encInfo->io_mode == e_io_uring || encInfo->io_mode == e_io_pipeline) && !encInfo->streaming &&
+        encInfo->size_secret_file > 0)
+        return encode_secret_data_overlapped(encInfo);
+    if (encInfo->threads > 1 && !encInfo->streaming && encInfo->size_secret_file >= 2 * PARALLEL_MIN_SLICE)
+        return encode_secret_data_parallel(encInfo);
+
+    if (encInfo->stego_map)
+    {
+        if (encInfo->size_secret_file == 0)
+            return e_success;
+        return embed_secret_chunk(encInfo->secret_map, encInfo->size_secret_file, encInfo); // Whole secret is already in memory
+    }
+
+    char *secret_buffer = encInfo->io_buf + encInfo->chunk_size; // Secret chunk lives after the window
+    long remaining = encInfo->size_secret_file;
+
+    if (!encInfo->streaming)
+        fseek(encInfo->fptr_secret, encInfo->shard.offset, SEEK_SET); // Move to start of secret (or of its shard)
+    while (remaining > 0)
+    {
+        size_t count = encInfo->chunk_size / 8 / LSB_GROUP(encInfo->depth) * LSB_GROUP(encInfo->depth);
+        if ((long)count > remaining)
+            count = remaining;
+
+        if (fread(secret_buffer, 1, count, encInfo->fptr_secret) != count)
+        {
+            fprintf(stderr, "ERROR: Unable to read %s\n", encInfo->secret_fname);
+            return e_failure;
+        }
+
+        if (embed_secret_chunk(secret_buffer, count, encInfo) == e_failure)
+            return e_failure;
+        remaining -= count;
+    }
+
+    return e_success;
+}
+
+/* Embed the payload CRC right after the payload, in keyed order when scattered */
+static Status encode_payload_crc(EncodeInfo *encInfo, size_t data_pos)
+{
+    unsigned char crc[STEGO_CHECKSUM_SIZE];
+    Scatter sc;
+
+    put_be(crc, encInfo->payload_crc, STEGO_CHECKSUM_SIZE);
+    if (!encInfo->scatter)
+        return encode_bytes_to_image((const char *)crc, STEGO_CHECKSUM_SIZE, encInfo);
+
+    scatter_init(&sc, encInfo->key, encInfo->bmp.usable - data_pos);
+    return place_scattered(encInfo, &sc, data_pos, LSB_SPAN(encInfo->payload_size, encInfo->depth), (const char *)crc,
+                           STEGO_CHECKSUM_SIZE, MIN_DEPTH);
+}
+
+/* Encode secret file content, one block at a time, and its CRC after it */
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    // 32 bpp: the data may run through the alpha bytes, the header fields never do
+    if (encInfo->alpha && bmp_use_alpha(&encInfo->bmp) == e_success)
+        encInfo->carrier_pos = bmp_carrier_pos(&encInfo->bmp, encInfo->win_off + encInfo->win_pos);
+
+    size_t data_pos = encInfo->carrier_pos;
+    encInfo->payload_crc = 0;
+    if (encode_payload(encInfo) == e_failure)
+        return e_failure;
+    return encode_payload_crc(encInfo, data_pos);
+}
+
+/* Copy remaining image data after encoding is done */
+Status copy_remaining_img_data(EncodeInfo *encInfo)
+{
+    size_t count;
+
+    // In place: the tail already holds the carrier, only the window's rewritten bytes go back
+    if (is_in_place(encInfo))
+    {
+        if (encInfo->stego_map)
+            return e_success;
+        return flush_image_window(encInfo);
+    }
+
+    // Mapped output: the tail goes straight from source map to stego map
+    if (encInfo->stego_map)
+    {
+        memcpy(encInfo->win + encInfo->win_len, encInfo->src_map + encInfo->win_len, encInfo->map_size - encInfo->win_len);
+        encInfo->win_len = encInfo->win_pos = encInfo->map_size;
+        return e_success;
+    }
+
+    // Everything left in the window is untouched carrier data
+    encInfo->win_pos = encInfo->win_len;
+    if (flush_image_window(encInfo) == e_failure)
+        return e_failure;
+
+    // io_uring or pipeline: the tail goes through the blocks from where the source stream stands
+    if ((encInfo->io_mode == e_io_uring || encInfo->io_mode == e_io_pipeline) && !encInfo->streaming)
+    {
+        struct stat st;
+        long begin = ftell(encInfo->fptr_src_image);
+        if (begin < 0 || fstat(fileno(encInfo->fptr_src_image), &st) != 0 || fflush(encInfo->fptr_stego_image) != 0)
+            return e_failure;
+        return run_overlapped(encInfo, begin, st.st_size, 1);
+    }
+
+    while ((count = fread(encInfo->io_buf, 1, encInfo->chunk_size, encInfo->fptr_src_image)) > 0)
+    {
+        if (fwrite(encInfo->io_buf, 1, count, encInfo->fptr_stego_image) != count)
+        {
+            fprintf(stderr, "ERROR: Unable to write %s\n", encInfo->stego_image_fname);
+            return e_failure;
+        }
+    }
+
+    // Every byte read went out again; fail on read errors or a short final write
+    if (ferror(encInfo->fptr_src_image) || fflush(encInfo->fptr_stego_image) != 0)
+        return e_failure;
+    else
+        return e_success;
+}
+
+/* Push the finished stego image to stable storage (--verify-on-write)
+ * Pipes have nothing to sync and are only flushed
+ */
+static Status sync_stego_image(EncodeInfo *encInfo)
+{
+    int fd = fileno(encInfo->fptr_stego_image);
+    struct stat st;
+
+    if (encInfo->stego_map && msync(encInfo->stego_map, encInfo->map_size, MS_SYNC) != 0)
+        return e_failure;
+    if (fflush(encInfo->fptr_stego_image) != 0 || fstat(fd, &st) != 0)
+        return e_failure;
+    if (S_ISREG(st.st_mode) && fsync(fd) != 0)
+        return e_failure;
+    return e_success;
+}
+
+/* Run the encoding stages over the opened files, timing each from 'mark' on */
+static Status encode_stages(EncodeInfo *encInfo, StatsMark *mark)
+{
+    Stats *st = encInfo->stats;
+    STATS_LAP(st, mark, e_stage_open, 0);
+
+    //Check if image has enough capacity
+    if (check_capacity(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    STATS_LAP(st, mark, e_stage_capacity, 0);
+
+    //Copy BMP header up to the pixel data
+    if (copy_bmp_header(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    STATS_LAP(st, mark, e_stage_bmp_header, encInfo->bmp.pixel_offset);
+
+    //Encode the container header: magic, version, flags, payload size, extension
+    if (encode_stego_header(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    STATS_LAP(st, mark, e_stage_stego_header, encInfo->carrier_pos / 8);   // One bit per carrier byte
+
+    //Encode secret file data
+    if (encode_secret_file_data(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    STATS_LAP(st, mark, e_stage_data, encInfo->payload_size + STEGO_CHECKSUM_SIZE);
+
+    //Copy remaining image data to stego file
+    if (copy_remaining_img_data(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    STATS_LAP(st, mark, e_stage_tail, is_in_place(encInfo) ? 0 :
+              bmp_file_end(&encInfo->bmp, encInfo->bmp.usable) - bmp_file_end(&encInfo->bmp, encInfo->carrier_pos));
+
+    //Embedded data already read back: make sure it reaches the disk
+    if (encInfo->verify_write)
+    {
+        if (sync_stego_image(encInfo) == e_failure)
+        {
+            fprintf(stderr, "ERROR: Unable to sync %s\n", encInfo->stego_image_fname);
+            return e_failure;
+        }
+        STATS_LAP(st, mark, e_stage_sync, 0);
+    }
+
+    //Encoding successful
+    return e_success;
+}
+
+/* Perform the encoding */
+Status do_encoding(EncodeInfo *encInfo)
+{
+    Status status = e_failure;
+    StatsMark mark;
+
+    //Open all required files, then map them or fall back to the shared block buffer
+    STATS_MARK(encInfo->stats, &mark);
+    if (open_files(encInfo) == e_success)
+    {
+        // io_uring refused by the kernel: the blocking stdio path does the same work
+        if (encInfo->io_mode == e_io_uring && !uring_available())
+        {
+            fprintf(stderr, "WARNING: io_uring unavailable, using stdio\n");
+            encInfo->io_mode = e_io_stdio;
+        }
+
+        if (encInfo->io_mode != e_io_stdio && encInfo->io_mode != e_io_uring && encInfo->io_mode != e_io_pipeline &&
+            map_files(encInfo) == e_success)
+        {
+            if (encInfo->chunk_size == 0)
+                encInfo->chunk_size = DEFAULT_CHUNK_SIZE;
+            status = encode_stages(encInfo, &mark);
+        }
+        else if (encInfo->io_mode == e_io_mmap)
+        {
+            fprintf(stderr, "ERROR: Unable to memory-map %s\n", encInfo->src_image_fname);
+        }
+        else if (alloc_io_buffer(encInfo) == e_success)
+        {
+            status = encode_stages(encInfo, &mark);
+        }
+    }
+
+    close_files(encInfo);
+    if (status == e_success)
+        STATS_LAP(encInfo->stats, &mark, e_stage_close, 0);
+    return status;
+}
@@ -2,6 +2,8 @@
 #define ENCODE_H
 
 #include "types.h" // Contains user defined types
+#include "bmp.h"
+#include "stats.h"
 #include<stdio.h>
 
 /* 
@@ -13,28 +15,67 @@
 
 #define MAX_SECRET_BUF_SIZE 1
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
-#define MAX_FILE_SUFFIX 4
+#define MAX_FILE_SUFFIX 8
+#define DEFAULT_CHUNK_SIZE (1 << 20) // carrier bytes moved per block (1 MiB)
+#define MIN_CHUNK_SIZE 64
 
 typedef struct _EncodeInfo
 {
     /* Source Image info */
     char *src_image_fname;// storing .bmp file name
     FILE *fptr_src_image;// storing address of .bmp file, opening in r mode
-    uint image_capacity;// storing file size 2359351
+    size_t image_capacity;// carrier bytes: pixel bytes without row padding
+    BmpInfo bmp; // header layout, parsed by check_capacity
     uint bits_per_pixel; // optional
     char image_data[MAX_IMAGE_BUF_SIZE]; // optional
 
     /* Secret File Info */
     char *secret_fname;// storing secret file
     FILE *fptr_secret;// opening file in r mode
-    char extn_secret_file[MAX_FILE_SUFFIX];// storing the .txt, .sh extension files with the size of 4
+    char extn_secret_file[MAX_FILE_SUFFIX];// storing the .txt, .sh extension with its terminator
     char secret_data[MAX_SECRET_BUF_SIZE];//
     long size_secret_file; // storing size of the secret file 25
+    long packed_size; // secret bytes after compression (size_secret_file without it)
+    long payload_size; // bytes embedded for the secret: packed_size, or its sealed stream's
+    uint payload_crc; // CRC32C of the payload bytes embedded so far
+    ShardInfo shard; // the secret bytes this image carries when split over several
+    int secret_size_given; // size_secret_file came from --secret-size
 
     /* Stego Image Info */
     char *stego_image_fname; // destination file name
     FILE *fptr_stego_image; // open file in w mode
 
+    /* Block I/O engine */
+    IOMode io_mode; // stdio blocks or memory-mapped files
+    WriteMode write_mode; // full copy, or in-place rewrite of the payload range
+    char *io_buf; // single allocation: carrier window followed by secret chunk
+    size_t io_buf_size; // carrier bytes io_buf was allocated for
+    int keep_io_buf; // keep io_buf after do_encoding so the next job reuses it
+    char *win; // window base: io_buf, or the mapped stego image
+    size_t chunk_size; // carrier bytes per block, 0 selects DEFAULT_CHUNK_SIZE
+    size_t win_len; // valid carrier bytes currently held in the window
+    size_t win_pos; // embed cursor inside the window
+    size_t win_off; // stego file offset of the window start
+    size_t carrier_pos; // carrier offset of the embed cursor (see bmp.h)
+    int threads; // worker threads for the secret data stage
+    int depth; // LSBs per carrier byte used for the secret data, 1-4
+    int alpha; // 32 bpp carriers: the secret data also uses the alpha bytes
+    int scatter; // spread the secret data over the carrier in keyed order
+    CodecType codec; // compression applied before sealing and embedding
+    int encrypt; // seal the secret with ChaCha20-Poly1305 before embedding
+    const char *key; // passphrase for the scatter order and the encryption
+    int verify_write; // read every embedded run back from the write buffer, sync the image at the end
+    int quiet; // suppress DEBUG and size messages on stdout
+    int streaming; // a file is a pipe: single forward pass, no mmap or threads
+    Stats *stats; // per-stage timings and counters (--stats), NULL when off
+
+    /* Memory-mapped files (NULL when using stdio) */
+    char *src_map; // source image, read only
+    char *stego_map; // stego image, sized with ftruncate
+    char *secret_map; // secret file, read only
+    size_t map_size; // bytes in src_map and stego_map
+    size_t secret_map_size; // bytes in secret_map
+
 } EncodeInfo;
 
 /* Encoding function prototype */
@@ -57,20 +98,20 @@ uint get_image_size_for_bmp(FILE *fptr_image);
 /* Get file size */
 uint get_file_size(FILE *fptr);
 
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+/* Allocate the shared block buffer */
+Status alloc_io_buffer(EncodeInfo *encInfo);
 
-/* Store Magic String */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
+/* Map source, secret and stego files into memory */
+Status map_files(EncodeInfo *encInfo);
 
-/*Extend file size*/
-Status encode_secret_extn_file_size(long file_size, EncodeInfo *encInfo); 
+/* Release file pointers and block buffer */
+void close_files(EncodeInfo *encInfo);
 
-/* Encode secret file extenstion */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
+/* Copy bmp image header */
+Status copy_bmp_header(EncodeInfo *encInfo);
 
-/* Encode secret file size */
-Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
+/* Encode the container header (magic, version, flags, payload size, extension) */
+Status encode_stego_header(EncodeInfo *encInfo);
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
@@ -82,6 +123,6 @@ Status encode_int_to_image(int size, char *image_buffer); //32 bytes
 Status encode_byte_to_lsb(char data, char *image_buffer); //8 bytes
 
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+Status copy_remaining_img_data(EncodeInfo *encInfo);
 
 #endif
@@ -0,0 +1,365 @@
+#include <string.h>
+#include <pthread.h>
+#include "lsb.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LSB_X86 1
+#endif
+
+/* Function Definitions */
+
+typedef void (*EmbedKernel)(char *image_buffer, const char *data, size_t count);
+typedef void (*ExtractKernel)(char *data, const char *image_buffer, size_t count);
+
+static void embed_resolve(char *image_buffer, const char *data, size_t count);
+static void extract_resolve(char *data, const char *image_buffer, size_t count);
+
+/* Kernels in use: the resolvers until the first call picks them; any thread
+ * may call in, so the pointers are only read and written atomically
+ */
+static EmbedKernel embed_kernel = embed_resolve;
+static ExtractKernel extract_kernel = extract_resolve;
+static KernelType kernel_in_use = e_kernel_auto;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/* Scalar: one carrier byte per bit, MSB first */
+static void embed_scalar(char *image_buffer, const char *data, size_t count)
+{
+    for (size_t n = 0; n < count; n++, image_buffer += 8)
+    {
+        for (int i = 7; i >= 0; i--)
+        {
+            int bit_data = (data[n] >> i) & 1;                      // Extract bit (MSB → LSB)
+            image_buffer[7 - i] = (image_buffer[7 - i] & ~1) | bit_data; // Write bit into LSB
+        }
+    }
+}
+
+static void extract_scalar(char *data, const char *image_buffer, size_t count)
+{
+    for (size_t n = 0; n < count; n++, image_buffer += 8)
+    {
+        char byte = 0;
+        for (int i = 0; i < 8; i++)
+            byte = (byte << 1) | (image_buffer[i] & 1);             // Combine 8 LSBs into one byte
+        data[n] = byte;
+    }
+}
+
+#ifdef LSB_X86
+/* SSE2: 16 secret bytes per 128 carrier bytes
+ * Encode: unpack each byte over 8 lanes, test one bit per lane
+ * Decode: keep each lane's weight where its LSB is set, psadbw sums the
+ * 8 lanes of a byte, and two packs gather the 16 sums
+ */
+static inline void embed_sse2_lanes(char *image_buffer, __m128i v, __m128i bitsel, __m128i lsb)
+{
+    __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, bitsel), bitsel), lsb);
+    __m128i img = _mm_loadu_si128((const __m128i *)image_buffer);
+    _mm_storeu_si128((__m128i *)image_buffer, _mm_or_si128(_mm_andnot_si128(lsb, img), bits));
+}
+
+static void embed_sse2(char *image_buffer, const char *data, size_t count)
+{
+    const __m128i bitsel = _mm_set1_epi64x(0x0102040810204080LL);  // MSB in the first lane of a byte
+    const __m128i lsb = _mm_set1_epi8(1);
+    size_t n = 0;
+
+    for (; n + 16 <= count; n += 16, image_buffer += 128)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i *)(data + n));
+        __m128i lo = _mm_unpacklo_epi8(d, d), hi = _mm_unpackhi_epi8(d, d);
+        __m128i quad[4] = { _mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+                            _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi) }; // 4 bytes x4 each
+
+        for (int k = 0; k < 4; k++)
+        {
+            embed_sse2_lanes(image_buffer + 32 * k, _mm_unpacklo_epi32(quad[k], quad[k]), bitsel, lsb);
+            embed_sse2_lanes(image_buffer + 32 * k + 16, _mm_unpackhi_epi32(quad[k], quad[k]), bitsel, lsb);
+        }
+    }
+    embed_scalar(image_buffer, data + n, count - n);
+}
+
+/* Two secret bytes, one in the low word of each 64-bit lane */
+static inline __m128i extract_sse2_lanes(const char *image_buffer, __m128i bitsel, __m128i lsb)
+{
+    __m128i img = _mm_loadu_si128((const __m128i *)image_buffer);
+    __m128i set = _mm_cmpeq_epi8(_mm_and_si128(img, lsb), lsb);
+    return _mm_sad_epu8(_mm_and_si128(set, bitsel), _mm_setzero_si128());
+}
+
+static void extract_sse2(char *data, const char *image_buffer, size_t count)
+{
+    const __m128i bitsel = _mm_set1_epi64x(0x0102040810204080LL);
+    const __m128i lsb = _mm_set1_epi8(1);
+    size_t n = 0;
+
+    for (; n + 16 <= count; n += 16, image_buffer += 128)
+    {
+        __m128i sums[8];
+        for (int k = 0; k < 8; k++)
+            sums[k] = extract_sse2_lanes(image_buffer + 16 * k, bitsel, lsb);
+
+        // Sums fit in a byte, so the signed packs never saturate
+        __m128i lo = _mm_packs_epi32(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+        __m128i hi = _mm_packs_epi32(_mm_packs_epi32(sums[4], sums[5]), _mm_packs_epi32(sums[6], sums[7]));
+        _mm_storeu_si128((__m128i *)(data + n), _mm_packus_epi16(lo, hi));
+    }
+    extract_scalar(data + n, image_buffer, count - n);
+}
+
+/* AVX2: 32 secret bytes per 256 carrier bytes
+ * pshufb spreads (encode) or mirrors (decode) bytes inside each 8-lane group
+ */
+__attribute__((target("avx2")))
+static void embed_avx2(char *image_buffer, const char *data, size_t count)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bitsel = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i lsb = _mm256_set1_epi8(1);
+    const __m256i next = _mm256_set1_epi8(4);
+    size_t n = 0;
+
+    for (; n + 32 <= count; n += 32, image_buffer += 256)
+    {
+        for (int half = 0; half < 2; half++)
+        {
+            // 16 secret bytes in both 128-bit lanes, 4 of them spread per step
+            __m256i d = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(data + n + 16 * half)));
+            __m256i sel = spread;
+            for (int k = 0; k < 4; k++, sel = _mm256_add_epi8(sel, next))
+            {
+                char *img_at = image_buffer + 128 * half + 32 * k;
+                __m256i v = _mm256_shuffle_epi8(d, sel);
+                __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v, bitsel), bitsel), lsb);
+                __m256i img = _mm256_loadu_si256((const __m256i *)img_at);
+                _mm256_storeu_si256((__m256i *)img_at, _mm256_or_si256(_mm256_andnot_si256(lsb, img), bits));
+            }
+        }
+    }
+    embed_sse2(image_buffer, data + n, count - n);
+}
+
+__attribute__((target("avx2")))
+static void extract_avx2(char *data, const char *image_buffer, size_t count)
+{
+    const __m256i mirror = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t n = 0;
+
+    for (; n + 32 <= count; n += 32, image_buffer += 256)
+    {
+        for (int k = 0; k < 8; k++)
+        {
+            __m256i img = _mm256_loadu_si256((const __m256i *)(image_buffer + 32 * k));
+            int mask = _mm256_movemask_epi8(_mm256_slli_epi64(_mm256_shuffle_epi8(img, mirror), 7));
+            memcpy(data + n + 4 * k, &mask, 4);
+        }
+    }
+    extract_sse2(data + n, image_buffer, count - n);
+}
+#endif
+
+/* Multi-bit kernels
+ * Written once with 'depth' as a parameter and always inlined into one
+ * wrapper per depth, so every shift and mask is a compile-time constant.
+ * They stay scalar: each carrier byte of a unit takes a different shift,
+ * which SSE2 and AVX2 have no per-byte instruction for
+ */
+static inline __attribute__((always_inline))
+void embed_depth(char *image_buffer, const char *data, size_t count, const int depth)
+{
+    const int group = LSB_GROUP(depth);                          // Secret bytes per unit
+    const int span = group * 8 / depth;                          // Carrier bytes per unit
+    const unsigned mask = (1u << depth) - 1;
+    size_t n = 0;
+
+    for (; n + group <= count; n += group, image_buffer += span)
+    {
+        unsigned bits = 0;
+        for (int g = 0; g < group; g++)
+            bits = bits << 8 | (unsigned char)data[n + g];
+        for (int j = 0; j < span; j++)
+            image_buffer[j] = (image_buffer[j] & ~mask) | ((bits >> (group * 8 - depth * (j + 1))) & mask);
+    }
+
+    // Partial unit at the end of the data, zero padded
+    if (n < count)
+    {
+        unsigned bits = 0;
+        for (int g = 0; g < group; g++)
+            bits = bits << 8 | (n + g < count ? (unsigned char)data[n + g] : 0);
+        for (size_t j = 0; j < LSB_SPAN(count - n, depth); j++)
+            image_buffer[j] = (image_buffer[j] & ~mask) | ((bits >> (group * 8 - depth * (j + 1))) & mask);
+    }
+}
+
+static inline __attribute__((always_inline))
+void extract_depth(char *data, const char *image_buffer, size_t count, const int depth)
+{
+    const int group = LSB_GROUP(depth);
+    const int span = group * 8 / depth;
+    const unsigned mask = (1u << depth) - 1;
+    size_t n = 0;
+
+    for (; n + group <= count; n += group, image_buffer += span)
+    {
+        unsigned bits = 0;
+        for (int j = 0; j < span; j++)
+            bits = bits << depth | (image_buffer[j] & mask);
+        for (int g = 0; g < group; g++)
+            data[n + g] = bits >> (8 * (group - 1 - g));
+    }
+
+    // Partial unit: shift the bits read so far to the top of the unit
+    if (n < count)
+    {
+        unsigned bits = 0;
+        size_t used = LSB_SPAN(count - n, depth);
+        for (size_t j = 0; j < used; j++)
+            bits = bits << depth | (image_buffer[j] & mask);
+        bits <<= group * 8 - depth * used;
+        for (size_t g = 0; g < count - n; g++)
+            data[n + g] = bits >> (8 * (group - 1 - g));
+    }
+}
+
+static void embed_d2(char *image_buffer, const char *data, size_t count) { embed_depth(image_buffer, data, count, 2); }
+static void embed_d3(char *image_buffer, const char *data, size_t count) { embed_depth(image_buffer, data, count, 3); }
+static void embed_d4(char *image_buffer, const char *data, size_t count) { embed_depth(image_buffer, data, count, 4); }
+static void extract_d2(char *data, const char *image_buffer, size_t count) { extract_depth(data, image_buffer, count, 2); }
+static void extract_d3(char *data, const char *image_buffer, size_t count) { extract_depth(data, image_buffer, count, 3); }
+static void extract_d4(char *data, const char *image_buffer, size_t count) { extract_depth(data, image_buffer, count, 4); }
+
+/* Point the kernels at 'type', e_kernel_auto picks the best one the CPU supports */
+static Status set_kernel(KernelType type)
+{
+#ifdef LSB_X86
+    __builtin_cpu_init();
+    if (type == e_kernel_auto)
+        type = __builtin_cpu_supports("avx2") ? e_kernel_avx2 : e_kernel_sse2;
+    if (type == e_kernel_avx2 && !__builtin_cpu_supports("avx2"))
+        return e_failure;
+#else
+    if (type == e_kernel_auto)
+        type = e_kernel_scalar;
+    if (type != e_kernel_scalar)
+        return e_failure;
+#endif
+
+    switch (type)
+    {
+#ifdef LSB_X86
+        case e_kernel_avx2:
+            __atomic_store_n(&embed_kernel, embed_avx2, __ATOMIC_RELEASE);
+            __atomic_store_n(&extract_kernel, extract_avx2, __ATOMIC_RELEASE);
+            break;
+        case e_kernel_sse2:
+            __atomic_store_n(&embed_kernel, embed_sse2, __ATOMIC_RELEASE);
+            __atomic_store_n(&extract_kernel, extract_sse2, __ATOMIC_RELEASE);
+            break;
+#endif
+        default:
+            __atomic_store_n(&embed_kernel, embed_scalar, __ATOMIC_RELEASE);
+            __atomic_store_n(&extract_kernel, extract_scalar, __ATOMIC_RELEASE);
+            break;
+    }
+    __atomic_store_n(&kernel_in_use, type, __ATOMIC_RELEASE);
+    return e_success;
+}
+
+/* Run once, by whichever thread needs a kernel first */
+static void resolve_auto(void)
+{
+    set_kernel(e_kernel_auto);
+}
+
+/* Select the kernel; the automatic pick has run first, so it never overrides this choice */
+Status lsb_select_kernel(KernelType type)
+{
+    pthread_once(&kernel_once, resolve_auto);
+    return set_kernel(type);
+}
+
+/* Name of the kernel in use */
+const char *lsb_kernel_name(void)
+{
+    pthread_once(&kernel_once, resolve_auto);
+    switch (__atomic_load_n(&kernel_in_use, __ATOMIC_ACQUIRE))
+    {
+        case e_kernel_avx2:
+            return "avx2";
+        case e_kernel_sse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+/* First calls pick the kernel once, later calls go straight to it */
+static void embed_resolve(char *image_buffer, const char *data, size_t count)
+{
+    pthread_once(&kernel_once, resolve_auto);
+    lsb_embed_bytes(image_buffer, data, count);
+}
+
+static void extract_resolve(char *data, const char *image_buffer, size_t count)
+{
+    pthread_once(&kernel_once, resolve_auto);
+    lsb_extract_bytes(data, image_buffer, count);
+}
+
+/* Embed 'count' bytes of data into count * 8 carrier bytes */
+void lsb_embed_bytes(char *image_buffer, const char *data, size_t count)
+{
+    __atomic_load_n(&embed_kernel, __ATOMIC_ACQUIRE)(image_buffer, data, count);
+}
+
+/* Extract 'count' bytes of data from count * 8 carrier bytes */
+void lsb_extract_bytes(char *data, const char *image_buffer, size_t count)
+{
+    __atomic_load_n(&extract_kernel, __ATOMIC_ACQUIRE)(data, image_buffer, count);
+}
+
+/* Embed 'count' bytes of data into LSB_SPAN(count, depth) carrier bytes */
+void lsb_embed_depth(char *image_buffer, const char *data, size_t count, int depth)
+{
+    switch (depth)
+    {
+        case 2:
+            embed_d2(image_buffer, data, count);
+            break;
+        case 3:
+            embed_d3(image_buffer, data, count);
+            break;
+        case 4:
+            embed_d4(image_buffer, data, count);
+            break;
+        default:
+            lsb_embed_bytes(image_buffer, data, count);
+            break;
+    }
+}
+
+/* Extract 'count' bytes of data from LSB_SPAN(count, depth) carrier bytes */
+void lsb_extract_depth(char *data, const char *image_buffer, size_t count, int depth)
+{
+    switch (depth)
+    {
+        case 2:
+            extract_d2(data, image_buffer, count);
+            break;
+        case 3:
+            extract_d3(data, image_buffer, count);
+            break;
+        case 4:
+            extract_d4(data, image_buffer, count);
+            break;
+        default:
+            lsb_extract_bytes(data, image_buffer, count);
+            break;
+    }
+}
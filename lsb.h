@@ -0,0 +1,43 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Bulk LSB kernels shared by encoder and decoder
+ * Every secret byte occupies 8 consecutive carrier bytes,
+ * most significant bit first. All kernels are bit-identical.
+ *
+ * Depth 2-4 kernels store 'depth' bits per carrier byte, still MSB first.
+ * Depth 3 packs 3 secret bytes into 8 carrier bytes.
+ */
+
+#define MIN_DEPTH 1
+#define MAX_DEPTH 4
+
+/* Select the kernel, e_kernel_auto picks the best one the CPU supports */
+Status lsb_select_kernel(KernelType type);
+
+/* Name of the kernel in use */
+const char *lsb_kernel_name(void);
+
+/* Embed 'count' bytes of data into count * 8 carrier bytes */
+void lsb_embed_bytes(char *image_buffer, const char *data, size_t count);
+
+/* Extract 'count' bytes of data from count * 8 carrier bytes */
+void lsb_extract_bytes(char *data, const char *image_buffer, size_t count);
+
+/* Secret bytes per kernel unit at 'depth' bits per carrier byte (3 for depth 3, 1 otherwise) */
+#define LSB_GROUP(depth) ((depth) == 3 ? 3 : 1)
+
+/* Carrier bytes holding 'count' secret bytes at 'depth' bits per carrier byte */
+#define LSB_SPAN(count, depth) (((size_t)(count) * 8 + (depth) - 1) / (depth))
+
+/* Embed 'count' bytes of data into LSB_SPAN(count, depth) carrier bytes */
+void lsb_embed_depth(char *image_buffer, const char *data, size_t count, int depth);
+
+/* Extract 'count' bytes of data from LSB_SPAN(count, depth) carrier bytes */
+void lsb_extract_depth(char *data, const char *image_buffer, size_t count, int depth);
+
+#endif
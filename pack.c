@@ -0,0 +1,195 @@
+#include <string.h>
+#include <stdint.h>
+#include "pack.h"
+
+#define PACK_HASH_BITS 13
+#define PACK_MIN_MATCH 4
+#define PACK_LAST_LITERALS 5 // a chunk always ends with literals
+#define PACK_MATCH_LIMIT 12 // no match starts this close to the end
+#define PACK_CHAIN_DEPTH 16 // earlier positions tried per hash
+
+static uint32_t load32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+    return v * 2654435761u >> (32 - PACK_HASH_BITS);
+}
+
+/* Write a length extension: 255 per full step, then the rest */
+static unsigned char *put_length(unsigned char *op, size_t n)
+{
+    for (; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = n;
+    return op;
+}
+
+/* Frame of a stored chunk */
+static size_t store_frame(const char *in, size_t len, char *out)
+{
+    uint32_t header = len | PACK_STORED_FLAG;
+
+    out[0] = header >> 24, out[1] = header >> 16, out[2] = header >> 8, out[3] = header;
+    memcpy(out + PACK_HEADER_SIZE, in, len);
+    return PACK_HEADER_SIZE + len;
+}
+
+/* Compress 'len' bytes (at most PACK_CHUNK_SIZE) into one frame
+ * Greedy matcher over hash chains (PACK_CHAIN_DEPTH candidates per
+ * position); a body that would not be smaller than the chunk is stored instead
+ */
+size_t pack_frame(const char *in, size_t len, char *out)
+{
+    const unsigned char *src = (const unsigned char *)in;
+    unsigned char *op = (unsigned char *)out + PACK_HEADER_SIZE;
+    const unsigned char *op_end = op + len;                 // Body must stay below the chunk size
+    int32_t head[1 << PACK_HASH_BITS];
+    uint16_t prev[PACK_CHUNK_SIZE];                         // Distance to the previous position with the same hash
+    size_t ip = 0, anchor = 0, hashed = 0;
+
+    memset(head, -1, sizeof(head));
+    while (len > PACK_MATCH_LIMIT && ip < len - PACK_MATCH_LIMIT)
+    {
+        // Chain every position up to ip
+        for (; hashed <= ip; hashed++)
+        {
+            uint32_t h = hash32(load32(src + hashed));
+            prev[hashed] = head[h] < 0 || hashed - head[h] > 0xFFFF ? 0 : hashed - head[h];
+            head[h] = hashed;
+        }
+
+        // Longest match among the candidates
+        size_t match = 0, ref = 0, cand = ip;
+        for (int depth = 0; depth < PACK_CHAIN_DEPTH && prev[cand] != 0; depth++)
+        {
+            cand -= prev[cand];
+            if (ip - cand > 0xFFFF)
+                break;
+            size_t n = 0;
+            while (ip + n < len - PACK_LAST_LITERALS && src[cand + n] == src[ip + n])
+                n++;
+            if (n > match)
+                match = n, ref = cand;
+        }
+        if (match < PACK_MIN_MATCH)
+        {
+            ip += 1 + ((ip - anchor) >> 6);                 // Skip faster through data that does not match
+            continue;
+        }
+
+        size_t lit = ip - anchor;
+        if (op + 1 + lit / 255 + 1 + lit + 2 + (match - PACK_MIN_MATCH) / 255 + 1 >= op_end)
+            return store_frame(in, len, out);
+
+        unsigned char *token = op++;
+        *token = (lit < 15 ? lit : 15) << 4 | (match - PACK_MIN_MATCH < 15 ? match - PACK_MIN_MATCH : 15);
+        if (lit >= 15)
+            op = put_length(op, lit - 15);
+        memcpy(op, src + anchor, lit);
+        op += lit;
+        *op++ = (ip - ref) & 0xFF;
+        *op++ = (ip - ref) >> 8;
+        if (match - PACK_MIN_MATCH >= 15)
+            op = put_length(op, match - PACK_MIN_MATCH - 15);
+
+        ip += match;
+        anchor = ip;
+    }
+
+    // Last sequence: literals only
+    size_t lit = len - anchor;
+    if (op + 1 + lit / 255 + 1 + lit >= op_end)
+        return store_frame(in, len, out);
+    *op++ = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15)
+        op = put_length(op, lit - 15);
+    memcpy(op, src + anchor, lit);
+    op += lit;
+
+    uint32_t body = op - (unsigned char *)out - PACK_HEADER_SIZE;
+    out[0] = body >> 24, out[1] = body >> 16, out[2] = body >> 8, out[3] = body;
+    return PACK_HEADER_SIZE + body;
+}
+
+/* Frame bytes announced by a frame header, 0 if the header is invalid */
+size_t pack_frame_size(const char *header)
+{
+    const unsigned char *p = (const unsigned char *)header;
+    uint32_t v = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    uint32_t body = v & ~PACK_STORED_FLAG;
+
+    if (body > PACK_CHUNK_SIZE || (body == 0 && !(v & PACK_STORED_FLAG)))
+        return 0;
+    return PACK_HEADER_SIZE + body;
+}
+
+/* Read a length extension, -1 past the end of the body */
+static long get_length(const unsigned char **ip, const unsigned char *end, size_t n)
+{
+    unsigned char b;
+
+    do
+    {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        n += b;
+    } while (b == 255);
+    return n;
+}
+
+/* Decode one whole frame into 'out' (PACK_CHUNK_SIZE bytes)
+ * Every length and offset is checked, a corrupt body cannot write outside 'out'
+ */
+long unpack_frame(const char *frame, size_t len, char *out)
+{
+    const unsigned char *ip = (const unsigned char *)frame + PACK_HEADER_SIZE;
+    const unsigned char *end = (const unsigned char *)frame + len;
+    size_t op = 0;
+
+    if (len < PACK_HEADER_SIZE || pack_frame_size(frame) != len)
+        return -1;
+    if ((unsigned char)frame[0] & 0x80)
+    {
+        memcpy(out, ip, len - PACK_HEADER_SIZE);            // Stored chunk
+        return len - PACK_HEADER_SIZE;
+    }
+
+    for (;;)
+    {
+        unsigned token = *ip++;
+        long lit = token >> 4, match;
+
+        if (lit == 15 && (lit = get_length(&ip, end, lit)) < 0)
+            return -1;
+        if (lit > end - ip || op + lit > PACK_CHUNK_SIZE)
+            return -1;
+        memcpy(out + op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == end)
+            return op;                                      // Last sequence has no match
+
+        if (end - ip < 2)
+            return -1;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        match = token & 15;
+        if (match == 15 && (match = get_length(&ip, end, match)) < 0)
+            return -1;
+        match += PACK_MIN_MATCH;
+        if (offset == 0 || offset > op || op + match > PACK_CHUNK_SIZE)
+            return -1;
+
+        // Matches may overlap their own output: copy forward byte by byte
+        for (long i = 0; i < match; i++, op++)
+            out[op] = out[op - offset];
+        if (ip >= end)
+            return -1;
+    }
+}
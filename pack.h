@@ -0,0 +1,36 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Secret compression: the secret is cut into PACK_CHUNK_SIZE chunks and
+ * each chunk becomes one frame: [4-byte header][body]
+ * Header (big-endian): body length, top bit set for a stored (raw) body
+ * Bodies are LZ77 sequences in the LZ4 block layout: token byte
+ * (literal length : match length - 4), literals, 16-bit little-endian
+ * offset, with 255-byte length extensions. Chunks are independent, so
+ * frames compress in parallel and decode with a 64K buffer.
+ */
+
+#define PACK_CHUNK_SIZE (64 * 1024)
+#define PACK_HEADER_SIZE 4
+#define PACK_FRAME_MAX (PACK_HEADER_SIZE + PACK_CHUNK_SIZE)
+#define PACK_STORED_FLAG 0x80000000u
+#define PACK_BATCH_CHUNKS 4 // chunks per worker thread compressed at a time
+
+/* Compress 'len' bytes (at most PACK_CHUNK_SIZE) into one frame
+ * Return Value: frame bytes written to 'out' (at most PACK_HEADER_SIZE + len)
+ */
+size_t pack_frame(const char *in, size_t len, char *out);
+
+/* Frame bytes announced by a frame header, 0 if the header is invalid */
+size_t pack_frame_size(const char *header);
+
+/* Decode one whole frame into 'out' (PACK_CHUNK_SIZE bytes)
+ * Return Value: chunk bytes, -1 if the frame is corrupt
+ */
+long unpack_frame(const char *frame, size_t len, char *out);
+
+#endif
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel.h"
+
+/* One worker's share of a parallel_for */
+typedef struct
+{
+    pthread_t tid;
+    SliceFunc func;
+    void *job;
+    size_t begin;
+    size_t end;
+    Status status;
+} Slice;
+
+static void *slice_worker(void *arg)
+{
+    Slice *slice = arg;
+    slice->status = slice->func(slice->job, slice->begin, slice->end);
+    return NULL;
+}
+
+/* Split [0, total) into contiguous slices and run them on up to 'threads' workers */
+Status parallel_for(int threads, size_t total, size_t align, SliceFunc func, void *job)
+{
+    Slice slices[MAX_THREADS];
+    Status status = e_success;
+    int started = 0;
+
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if ((size_t)threads > total / PARALLEL_MIN_SLICE)
+        threads = total / PARALLEL_MIN_SLICE;
+    if (threads <= 1)
+        return func(job, 0, total);                         // Not worth a thread
+
+    // Slice size rounded up to the alignment
+    size_t per = (total + threads - 1) / threads;
+    per = (per + align - 1) / align * align;
+
+    for (int i = 0; i < threads; i++)
+    {
+        Slice *slice = &slices[i];
+        slice->func = func;
+        slice->job = job;
+        slice->begin = i * per < total ? i * per : total;
+        slice->end = slice->begin + per < total ? slice->begin + per : total;
+        slice->status = e_success;
+
+        // Last resort: run the slice on this thread
+        if (pthread_create(&slice->tid, NULL, slice_worker, slice) != 0)
+        {
+            slice_worker(slice);
+            slice->tid = 0;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        if (slices[i].tid)
+            pthread_join(slices[i].tid, NULL);
+        if (slices[i].status == e_failure)
+            status = e_failure;
+    }
+    return status;
+}
+
+/* pread that retries short reads */
+Status pread_full(int fd, void *buf, size_t count, off_t offset)
+{
+    char *p = buf;
+
+    while (count > 0)
+    {
+        ssize_t n = pread(fd, p, count, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        offset += n;
+        count -= n;
+    }
+    return e_success;
+}
+
+/* pwrite that retries short writes */
+Status pwrite_full(int fd, const void *buf, size_t count, off_t offset)
+{
+    const char *p = buf;
+
+    while (count > 0)
+    {
+        ssize_t n = pwrite(fd, p, count, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return e_failure;
+        p += n;
+        offset += n;
+        count -= n;
+    }
+    return e_success;
+}
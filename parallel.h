@@ -0,0 +1,24 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+
+/* Smallest slice worth handing to a worker thread */
+#define PARALLEL_MIN_SLICE (64 * 1024)
+
+/* Work on secret bytes [begin, end) of a job */
+typedef Status (*SliceFunc)(void *job, size_t begin, size_t end);
+
+/* Split [0, total) into contiguous slices and run them on up to 'threads' workers
+ * Slice boundaries are multiples of 'align'
+ * Return Value: e_failure if any slice failed
+ */
+Status parallel_for(int threads, size_t total, size_t align, SliceFunc func, void *job);
+
+/* pread/pwrite that retry short transfers */
+Status pread_full(int fd, void *buf, size_t count, off_t offset);
+Status pwrite_full(int fd, const void *buf, size_t count, off_t offset);
+
+#endif
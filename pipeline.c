@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "pipeline.h"
+
+/* Ring slots: every block and the end mark fit at once, so a push never waits in practice */
+#define RING_SLOTS (PIPELINE_DEPTH * 2)
+
+/* Block handed from one stage to the next; a NULL block marks the end */
+typedef struct
+{
+    char *block;
+    size_t begin, end;
+} PipeItem;
+
+/* Single-producer single-consumer ring; a side with nothing to do sleeps on the other's index */
+typedef struct
+{
+    PipeItem items[RING_SLOTS];
+    unsigned head; // next item to pop, moved by the consumer only
+    unsigned tail; // next item to push, moved by the producer only
+    int push_waits; // producer asleep on head
+    int pop_waits; // consumer asleep on tail
+} SpscRing;
+
+typedef struct
+{
+    SpscRing free_ring; // writer to reader: blocks written out
+    SpscRing read_ring; // reader to worker: blocks read in
+    SpscRing work_ring; // worker to writer: blocks ready to go out
+    StageFunc read, work, write;
+    void *job;
+    size_t begin, total, step;
+    int failed;
+} Pipeline;
+
+/* Sleep until '*word' moves away from 'seen'
+ * The flag is raised before the last look, and the other side looks at the flag
+ * after moving the word, so one of the two always sees the other (no lost wake-up)
+ */
+static void ring_wait(unsigned *word, unsigned seen, int *flag)
+{
+    __atomic_store_n(flag, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen)
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    __atomic_store_n(flag, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Publish a moved index and wake the other side if it sleeps on it */
+static void ring_move(unsigned *word, unsigned value, int *flag)
+{
+    __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(flag, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void ring_push(SpscRing *ring, PipeItem item)
+{
+    unsigned tail = ring->tail;
+
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SLOTS)
+        ring_wait(&ring->head, tail - RING_SLOTS, &ring->push_waits);
+    ring->items[tail % RING_SLOTS] = item;
+    ring_move(&ring->tail, tail + 1, &ring->pop_waits);         // Item visible before the tail moves
+}
+
+static PipeItem ring_pop(SpscRing *ring)
+{
+    unsigned head = ring->head;
+
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head)
+        ring_wait(&ring->tail, head, &ring->pop_waits);
+    PipeItem item = ring->items[head % RING_SLOTS];
+    ring_move(&ring->head, head + 1, &ring->push_waits);
+    return item;
+}
+
+static int has_failed(Pipeline *p)
+{
+    return __atomic_load_n(&p->failed, __ATOMIC_ACQUIRE);
+}
+
+static void set_failed(Pipeline *p)
+{
+    __atomic_store_n(&p->failed, 1, __ATOMIC_RELEASE);
+}
+
+/* Reader: fill free blocks in order, stop at the end or at the first failure */
+static void *reader_thread(void *arg)
+{
+    Pipeline *p = arg;
+    PipeItem end = { NULL, 0, 0 };
+
+    for (size_t i = p->begin; i < p->total && !has_failed(p); i += p->step)
+    {
+        PipeItem item = ring_pop(&p->free_ring);
+        item.begin = i;
+        item.end = p->total - i < p->step ? p->total : i + p->step;
+        if (p->read(p->job, item.block, item.begin, item.end) == e_failure)
+        {
+            set_failed(p);
+            break;
+        }
+        ring_push(&p->read_ring, item);
+    }
+    ring_push(&p->read_ring, end);
+    return NULL;
+}
+
+/* Writer: write blocks out in order and hand them back to the reader */
+static void *writer_thread(void *arg)
+{
+    Pipeline *p = arg;
+
+    for (;;)
+    {
+        PipeItem item = ring_pop(&p->work_ring);
+        if (item.block == NULL)
+            return NULL;
+        if (!has_failed(p) && p->write(p->job, item.block, item.begin, item.end) == e_failure)
+            set_failed(p);
+        ring_push(&p->free_ring, item);
+    }
+}
+
+/* Worker: after a failure blocks still pass through, untouched, so the writer drains */
+static void work_blocks(Pipeline *p)
+{
+    for (;;)
+    {
+        PipeItem item = ring_pop(&p->read_ring);
+        if (item.block && !has_failed(p) && p->work && p->work(p->job, item.block, item.begin, item.end) == e_failure)
+            set_failed(p);
+        ring_push(&p->work_ring, item);
+        if (item.block == NULL)
+            return;
+    }
+}
+
+/* Last resort without threads: every stage in turn on one block */
+static Status run_serial(Pipeline *p, char *block)
+{
+    for (size_t i = p->begin; i < p->total; i += p->step)
+    {
+        size_t end = p->total - i < p->step ? p->total : i + p->step;
+        if (p->read(p->job, block, i, end) == e_failure ||
+            (p->work && p->work(p->job, block, i, end) == e_failure) ||
+            p->write(p->job, block, i, end) == e_failure)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/* Run [begin, total) through the reader, worker and writer stages */
+Status pipeline_run(size_t begin, size_t total, size_t step, size_t block_size, StageFunc read, StageFunc work,
+                    StageFunc write, void *job)
+{
+    Pipeline *p = calloc(1, sizeof(*p));
+    char *blocks = malloc(PIPELINE_DEPTH * block_size);
+    pthread_t reader, writer;
+    Status status;
+
+    if (p == NULL || blocks == NULL)
+    {
+        free(p);
+        free(blocks);
+        return e_failure;
+    }
+    p->read = read;
+    p->work = work;
+    p->write = write;
+    p->job = job;
+    p->begin = begin;
+    p->total = total;
+    p->step = step;
+    for (int i = 0; i < PIPELINE_DEPTH; i++)
+    {
+        PipeItem item = { blocks + i * block_size, 0, 0 };
+        ring_push(&p->free_ring, item);
+    }
+
+    if (pthread_create(&writer, NULL, writer_thread, p) != 0)
+    {
+        status = run_serial(p, blocks);
+    }
+    else if (pthread_create(&reader, NULL, reader_thread, p) != 0)
+    {
+        // Only the writer started: let it finish on an empty run, then go serial
+        PipeItem end = { NULL, 0, 0 };
+        ring_push(&p->work_ring, end);
+        pthread_join(writer, NULL);
+        status = run_serial(p, blocks);
+    }
+    else
+    {
+        work_blocks(p);
+        pthread_join(reader, NULL);
+        pthread_join(writer, NULL);
+        status = p->failed ? e_failure : e_success;
+    }
+
+    free(blocks);
+    free(p);
+    return status;
+}
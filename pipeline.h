@@ -0,0 +1,28 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Three-stage block pipeline: a reader thread, a worker (the calling
+ * thread) and a writer thread joined by lock-free single-producer
+ * single-consumer rings. Blocks go through the stages in order and
+ * come back to the reader once written, so at most PIPELINE_DEPTH
+ * blocks exist and a slow read or write overlaps the work on the others.
+ */
+
+#define PIPELINE_DEPTH 4 // blocks in circulation, the memory bound of a run
+
+/* Stage of the pipeline: handle range [begin, end) held in 'block' */
+typedef Status (*StageFunc)(void *job, char *block, size_t begin, size_t end);
+
+/* Run range [begin, total) in steps of 'step' through read, work and write,
+ * each block 'block_size' bytes; 'work' may be NULL when blocks are only moved
+ * After a failure no new block is read and the blocks in flight are dropped
+ * Return Value: e_failure if any stage failed
+ */
+Status pipeline_run(size_t begin, size_t total, size_t step, size_t block_size, StageFunc read, StageFunc work,
+                    StageFunc write, void *job);
+
+#endif
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "plan.h"
+#include "probe.h"
+#include "batch.h"
+#include "common.h"
+#include "lsb.h"
+#include "aead.h"
+
+/* One image of the index */
+typedef struct
+{
+    char *name; // file name inside the directory
+    long long mtime_sec;
+    long mtime_nsec;
+    long long size; // file size, a second guard next to the mtime
+    uint width, height, bpp; // bpp 0: not a usable BMP
+    int payload; // already carries a secret
+    long long room; // carrier bytes left for data after a fresh header and the CRC
+    long long room_alpha; // the same with the data through the alpha bytes (room without them)
+    int seen; // still in the directory
+    int stale; // probed again by this run
+} PlanEntry;
+
+typedef struct
+{
+    const char *dname;
+    PlanEntry *entries;
+    size_t count, alloc;
+    size_t next; // next entry for a refresh worker
+    pthread_mutex_t lock; // guards next
+} PlanIndex;
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const PlanEntry *)a)->name, ((const PlanEntry *)b)->name);
+}
+
+/* Append an entry owning 'name' */
+static PlanEntry *add_entry(PlanIndex *ix, char *name)
+{
+    if (ix->count == ix->alloc)
+    {
+        size_t size = ix->alloc ? ix->alloc * 2 : 256;
+        PlanEntry *entries = realloc(ix->entries, size * sizeof(PlanEntry));
+        if (entries == NULL)
+            return NULL;
+        ix->entries = entries;
+        ix->alloc = size;
+    }
+    PlanEntry *e = &ix->entries[ix->count++];
+    memset(e, 0, sizeof(*e));
+    e->name = name;
+    return e;
+}
+
+/* Read the index written by an earlier run; a missing or foreign file is an empty index */
+static Status load_index(PlanIndex *ix, const char *fname)
+{
+    char line[MAX_MANIFEST_LINE];
+    FILE *fp = fopen(fname, "r");
+
+    if (fp == NULL)
+        return e_success;
+    if (fgets(line, sizeof(line), fp) == NULL || strncmp(line, PLAN_INDEX_MAGIC, strlen(PLAN_INDEX_MAGIC)) != 0)
+    {
+        fclose(fp);
+        return e_success;                                       // Rebuilt from scratch
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        PlanEntry e;
+        int name_at = -1;
+
+        memset(&e, 0, sizeof(e));
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%lld %ld %lld %u %u %u %d %lld %lld %n", &e.mtime_sec, &e.mtime_nsec, &e.size, &e.width,
+                   &e.height, &e.bpp, &e.payload, &e.room, &e.room_alpha, &name_at) != 9 || name_at < 0 ||
+            line[name_at] == '\0')
+            continue;                                           // Damaged line: that image is probed again
+
+        char *name = strdup(line + name_at);
+        PlanEntry *slot = name ? add_entry(ix, name) : NULL;
+        if (slot == NULL)
+        {
+            free(name);
+            fclose(fp);
+            return e_failure;
+        }
+        e.name = name;
+        *slot = e;
+    }
+    fclose(fp);
+    qsort(ix->entries, ix->count, sizeof(PlanEntry), compare_entries);
+    return e_success;
+}
+
+/* Write the index next to its final name, then move it over in one step */
+static Status save_index(const PlanIndex *ix, const char *fname)
+{
+    char tmp[MAX_MANIFEST_LINE];
+    FILE *fp;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", fname) >= (int)sizeof(tmp))
+        return e_failure;
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+        return e_failure;
+
+    fprintf(fp, "%s\n", PLAN_INDEX_MAGIC);
+    for (size_t i = 0; i < ix->count; i++)
+    {
+        const PlanEntry *e = &ix->entries[i];
+        if (e->seen)
+            fprintf(fp, "%lld %ld %lld %u %u %u %d %lld %lld %s\n", e->mtime_sec, e->mtime_nsec, e->size, e->width,
+                    e->height, e->bpp, e->payload, e->room, e->room_alpha, e->name);
+    }
+    if (fclose(fp) != 0 || rename(tmp, fname) != 0)
+    {
+        remove(tmp);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Describe one image from its header region; what is not a BMP stays indexed as unusable */
+static void probe_entry(const PlanIndex *ix, PlanEntry *e)
+{
+    char fname[MAX_MANIFEST_LINE];
+    ProbeInfo probeInfo;
+
+    snprintf(fname, sizeof(fname), "%s/%s", ix->dname, e->name);
+    e->width = e->height = e->bpp = 0;
+    e->payload = 0;
+    e->room = e->room_alpha = 0;
+    if (probe_image(fname, &probeInfo) == e_failure)
+        return;
+
+    e->width = probeInfo.width;
+    e->height = probeInfo.height;
+    e->bpp = probeInfo.bmp.bits_per_pixel;
+    e->payload = probeInfo.has_payload;
+    e->room = probe_data_room(&probeInfo.bmp, 0);
+    e->room_alpha = probe_data_room(&probeInfo.bmp, 1);
+}
+
+/* Worker: probe stale entries until none are left */
+static void *refresh_worker(void *arg)
+{
+    PlanIndex *ix = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&ix->lock);
+        size_t i = ix->next++;
+        pthread_mutex_unlock(&ix->lock);
+
+        if (i >= ix->count)
+            break;
+        if (ix->entries[i].stale)
+            probe_entry(ix, &ix->entries[i]);
+    }
+    return NULL;
+}
+
+/* Match the index against the directory: new or changed images are probed again
+ * Return Value: images probed, -1 if the directory cannot be read
+ */
+static long refresh_index(PlanIndex *ix, int jobs)
+{
+    DIR *dir = opendir(ix->dname);
+    struct dirent *entry;
+    size_t known = ix->count;
+    long probed = 0;
+
+    if (dir == NULL)
+        return -1;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char fname[MAX_MANIFEST_LINE];
+        struct stat st;
+        size_t len = strlen(entry->d_name);
+
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".bmp") != 0 || strchr(entry->d_name, '\n'))
+            continue;
+        snprintf(fname, sizeof(fname), "%s/%s", ix->dname, entry->d_name);
+        if (stat(fname, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        // Known images keep their description while mtime and size stay the same
+        PlanEntry key = { .name = entry->d_name };
+        PlanEntry *e = known ? bsearch(&key, ix->entries, known, sizeof(PlanEntry), compare_entries) : NULL;
+        if (e == NULL)
+        {
+            char *name = strdup(entry->d_name);
+            if (name == NULL || (e = add_entry(ix, name)) == NULL)
+            {
+                free(name);
+                break;
+            }
+        }
+        e->seen = 1;
+        if (e->stale || e >= ix->entries + known || e->mtime_sec != st.st_mtim.tv_sec ||
+            e->mtime_nsec != st.st_mtim.tv_nsec || e->size != st.st_size)
+        {
+            e->stale = 1;
+            e->mtime_sec = st.st_mtim.tv_sec;
+            e->mtime_nsec = st.st_mtim.tv_nsec;
+            e->size = st.st_size;
+            probed++;
+        }
+    }
+    closedir(dir);
+
+    // Probe what changed on 'jobs' threads, the calling thread included
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+    if (jobs > MAX_THREADS)
+        jobs = MAX_THREADS;
+    if (jobs > probed)
+        jobs = probed ? probed : 1;
+    ix->next = 0;
+    for (int i = 1; i < jobs; i++)
+    {
+        if (pthread_create(&tids[started], NULL, refresh_worker, ix) == 0)
+            started++;
+    }
+    refresh_worker(ix);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    qsort(ix->entries, ix->count, sizeof(PlanEntry), compare_entries);
+    return probed;
+}
+
+/* Refresh the index of 'dname' and print the best carrier for 'req' */
+Status run_plan(const char *dname, const char *index_fname, const PlanRequest *req, int jobs)
+{
+    PlanIndex ix = { dname, NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+    char default_fname[MAX_MANIFEST_LINE];
+    size_t kept = 0;
+
+    if (index_fname == NULL)
+    {
+        snprintf(default_fname, sizeof(default_fname), "%s/%s", dname, PLAN_INDEX_NAME);
+        index_fname = default_fname;
+    }
+    if (load_index(&ix, index_fname) == e_failure)
+        return e_failure;
+    long probed = refresh_index(&ix, jobs);
+    if (probed < 0)
+    {
+        fprintf(stderr, "ERROR: Unable to scan directory %s\n", dname);
+        return e_failure;
+    }
+    for (size_t i = 0; i < ix.count; i++)
+        kept += ix.entries[i].seen;
+
+    // Unchanged directory: the index on disk is already right
+    if ((probed > 0 || kept != ix.count) && save_index(&ix, index_fname) == e_failure)
+        fprintf(stderr, "WARNING: Unable to write index %s\n", index_fname);
+
+    // Least room that still takes the payload, smaller files first on a tie
+    size_t payload = req->encrypt ? aead_stream_size(req->secret_size) : (size_t)req->secret_size;
+    size_t need = LSB_SPAN(payload, req->depth);
+    const PlanEntry *best = NULL;
+    long long best_room = 0;
+    for (size_t i = 0; i < ix.count; i++)
+    {
+        const PlanEntry *e = &ix.entries[i];
+        long long room = req->alpha ? e->room_alpha : e->room;
+        if (!e->seen || e->bpp == 0 || e->payload || room <= (long long)need)
+            continue;
+        if (best == NULL || room < best_room || (room == best_room && e->size < best->size))
+        {
+            best = e;
+            best_room = room;
+        }
+    }
+
+    printf("{\"dir\":");
+    print_json_string(dname);
+    printf(",\"secret\":%ld,\"depth\":%d,\"indexed\":%zu,\"probed\":%ld,\"file\":", req->secret_size, req->depth, kept, probed);
+    if (best)
+    {
+        print_json_string(best->name);
+        printf(",\"width\":%u,\"height\":%u,\"bpp\":%u,\"capacity\":%ld}\n", best->width, best->height, best->bpp,
+               probe_room_bytes(best_room, req->depth));
+    }
+    else
+    {
+        printf("null}\n");
+    }
+
+    for (size_t i = 0; i < ix.count; i++)
+        free(ix.entries[i].name);
+    free(ix.entries);
+    return best ? e_success : e_failure;
+}
@@ -0,0 +1,35 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "types.h" // Contains user defined types
+
+/*
+ * Plan mode: pick the carrier of a directory that fits a secret best
+ * Every *.bmp of the directory is described by its parsed header alone
+ * (size, bit depth, existing payload, room for a new one) in an index
+ * file, by default <dir>/.stego-index. A run only probes images whose
+ * mtime or size changed since the index was written, drops the ones that
+ * are gone, then answers from the index: the carrier with the least room
+ * that still takes the secret. Images already holding a payload are
+ * left out. One JSON line is printed on stdout.
+ */
+
+#define PLAN_INDEX_NAME ".stego-index"
+#define PLAN_INDEX_MAGIC "# stego-index 1"
+
+/* Request: secret bytes and the options it will be encoded with */
+typedef struct
+{
+    long secret_size; // secret bytes as stored (--compress is not guessed at)
+    int depth; // LSBs per carrier byte for the data
+    int alpha; // 32 bpp carriers may also use their alpha bytes
+    int encrypt; // the secret grows by the salt and one tag per chunk
+} PlanRequest;
+
+/* Refresh the index of 'dname' ('index_fname', or NULL for the default) on 'jobs'
+ * threads and print the best carrier for 'req'
+ * Return Value: e_failure if the directory cannot be read or nothing fits
+ */
+Status run_plan(const char *dname, const char *index_fname, const PlanRequest *req, int jobs);
+
+#endif
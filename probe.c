@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "probe.h"
+#include "batch.h"
+#include "common.h"
+#include "lsb.h"
+#include "aead.h"
+
+/* State shared by the probe workers */
+typedef struct
+{
+    char **files; // images to probe
+    size_t count;
+    size_t next; // next file to hand out
+    pthread_mutex_t lock; // guards next, failed and stdout
+    int failed;
+} ProbeJob;
+
+/* Carrier bytes left for data after a fresh header and the CRC, laid out as check_capacity does */
+long long probe_data_room(const BmpInfo *bmp, int alpha)
+{
+    size_t header_size = STEGO_HEADER_SIZE * 8;
+    BmpInfo data_bmp = *bmp;
+
+    if (alpha && bmp_use_alpha(&data_bmp) == e_success)
+        header_size = bmp_carrier_pos(&data_bmp, bmp_file_end(bmp, header_size));
+    if (data_bmp.usable <= header_size + STEGO_CHECKSUM_SIZE * 8)
+        return 0;
+    return data_bmp.usable - header_size - STEGO_CHECKSUM_SIZE * 8;
+}
+
+/* Secret bytes that fit in 'room' data carrier bytes at 'depth'
+ * check_capacity wants more room than the data takes, hence the byte held back
+ */
+long probe_room_bytes(long long room, int depth)
+{
+    return room > 0 ? (room - 1) * depth / 8 : 0;
+}
+
+/* Read the header region of one image */
+Status probe_image(const char *fname, ProbeInfo *probeInfo)
+{
+    char header[PROBE_READ_SIZE];
+    DecodeInfo decInfo;
+
+    memset(probeInfo, 0, sizeof(*probeInfo));
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return e_failure;
+    ssize_t len = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    if (len < BMP_HEADER_SIZE)
+        return e_failure;
+
+    // Decode the header fields from the buffer as if it were the mapped image
+    memset(&decInfo, 0, sizeof(decInfo));
+    decInfo.op_map = header;
+    decInfo.op_map_size = len;
+    if (skip_bmp_header(&decInfo) == e_failure)
+        return e_failure;
+
+    probeInfo->width = decInfo.bmp.width;
+    probeInfo->height = decInfo.bmp.height;
+    probeInfo->bmp = decInfo.bmp;
+
+    long size = -1;
+    if (decode_stego_header(&decInfo) == e_success)
+        size = decInfo.size_secret_file;
+
+    // Carrier bytes in use: header fields at 1 bit per byte, data at 'depth' bits
+    long used, capacity = decInfo.bmp.usable;
+    if (size >= 0)
+    {
+        if (decInfo.alpha && bmp_use_alpha(&decInfo.bmp) == e_success)
+            decInfo.carrier_pos = bmp_carrier_pos(&decInfo.bmp, decInfo.op_pos);
+        capacity = decInfo.bmp.usable;
+        used = decInfo.carrier_pos + LSB_SPAN(size, decInfo.depth) + (decInfo.checksum ? STEGO_CHECKSUM_SIZE * 8 : 0);
+    }
+    if (size >= 0 && used <= capacity && (!decInfo.encrypt || aead_plain_size(size) >= 0))
+    {
+        probeInfo->has_payload = 1;
+        probeInfo->depth = decInfo.depth;
+        probeInfo->sealed = decInfo.encrypt;
+        probeInfo->codec = decInfo.codec;
+        probeInfo->size_secret_file = decInfo.encrypt ? aead_plain_size(size) : size; // Secret bytes, without salt and tags
+        strcpy(probeInfo->extn_secret_file, decInfo.extn_secret_file);
+        probeInfo->shard = decInfo.shard;
+    }
+    else
+    {
+        probeInfo->depth = MIN_DEPTH;
+        probeInfo->free_bytes = probe_room_bytes(probe_data_room(&probeInfo->bmp, 0), MIN_DEPTH); // Room for a fresh secret
+        return e_success;
+    }
+    probeInfo->free_bytes = probe_room_bytes(capacity - used, probeInfo->depth);
+    return e_success;
+}
+
+/* Probe one image and print its report line */
+static void report_image(const char *fname, ProbeJob *job)
+{
+    ProbeInfo probeInfo;
+    Status status = probe_image(fname, &probeInfo);
+
+    pthread_mutex_lock(&job->lock);
+    printf("{\"file\":");
+    print_json_string(fname);
+    if (status == e_failure)
+    {
+        printf(",\"status\":\"error\"}\n");
+        job->failed = 1;
+    }
+    else if (probeInfo.has_payload)
+    {
+        printf(",\"status\":\"ok\",\"width\":%u,\"height\":%u,\"payload\":true,\"extn\":",
+               probeInfo.width, probeInfo.height);
+        print_json_string(probeInfo.extn_secret_file);
+        printf(",\"depth\":%d,\"sealed\":%s,\"compressed\":%s,\"size\":%ld,", probeInfo.depth,
+               probeInfo.sealed ? "true" : "false", probeInfo.codec != e_codec_none ? "true" : "false",
+               probeInfo.size_secret_file);
+        if (probeInfo.shard.count)
+            printf("\"shard\":%d,\"shards\":%d,", probeInfo.shard.index, probeInfo.shard.count);
+        printf("\"free\":%ld}\n", probeInfo.free_bytes);
+    }
+    else
+    {
+        printf(",\"status\":\"ok\",\"width\":%u,\"height\":%u,\"payload\":false,\"free\":%ld}\n",
+               probeInfo.width, probeInfo.height, probeInfo.free_bytes);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Worker: probe files until none are left */
+static void *probe_worker(void *arg)
+{
+    ProbeJob *job = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        size_t i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= job->count)
+            break;
+        report_image(job->files[i], job);
+    }
+    return NULL;
+}
+
+/* Append "dname/name" (or just name when dname is NULL) to the probe list */
+static Status add_file(ProbeJob *job, size_t *alloc, const char *dname, const char *name)
+{
+    if (job->count == *alloc)
+    {
+        size_t size = *alloc ? *alloc * 2 : 256;
+        char **files = realloc(job->files, size * sizeof(char *));
+        if (files == NULL)
+            return e_failure;
+        job->files = files;
+        *alloc = size;
+    }
+
+    char *fname = malloc((dname ? strlen(dname) + 1 : 0) + strlen(name) + 1);
+    if (fname == NULL)
+        return e_failure;
+    if (dname)
+        sprintf(fname, "%s/%s", dname, name);
+    else
+        strcpy(fname, name);
+    job->files[job->count++] = fname;
+    return e_success;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Add every *.bmp file of a directory, in name order */
+static Status scan_directory(ProbeJob *job, size_t *alloc, const char *dname)
+{
+    DIR *dir = opendir(dname);
+    struct dirent *entry;
+    size_t first = job->count;
+
+    if (dir == NULL)
+        return e_failure;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".bmp") != 0)
+            continue;
+
+        if (add_file(job, alloc, dname, entry->d_name) == e_failure)
+            break;
+    }
+    closedir(dir);
+    qsort(job->files + first, job->count - first, sizeof(char *), compare_names);
+    return e_success;
+}
+
+/* Probe every image named in 'paths' on 'jobs' worker threads */
+Status run_probe(char *paths[], int jobs)
+{
+    ProbeJob job = { NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, 0 };
+    pthread_t tids[MAX_THREADS];
+    size_t alloc = 0;
+    int started = 0;
+    struct stat st;
+
+    // Build the file list first, directories expand to their images
+    for (int i = 0; paths[i] != NULL; i++)
+    {
+        if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            if (scan_directory(&job, &alloc, paths[i]) == e_failure)
+            {
+                fprintf(stderr, "ERROR: Unable to scan directory %s\n", paths[i]);
+                job.failed = 1;
+            }
+        }
+        else if (add_file(&job, &alloc, NULL, paths[i]) == e_failure)
+        {
+            job.failed = 1;
+        }
+    }
+
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > MAX_THREADS)
+        jobs = MAX_THREADS;
+    if ((size_t)jobs > job.count)
+        jobs = job.count ? job.count : 1;
+
+    for (int i = 1; i < jobs; i++)
+    {
+        if (pthread_create(&tids[started], NULL, probe_worker, &job) == 0)
+            started++;
+    }
+    probe_worker(&job);                                         // Calling thread works too
+
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    for (size_t i = 0; i < job.count; i++)
+        free(job.files[i]);
+    free(job.files);
+    return job.failed ? e_failure : e_success;
+}
@@ -0,0 +1,52 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "types.h" // Contains user defined types
+#include "decode.h"
+
+/*
+ * Probe mode: inspect stego images without decoding them
+ * Only the header region is read (one page per image): magic string,
+ * extension, depth and size fields, plus the BMP width and height
+ * Directories are scanned for *.bmp files (not recursive)
+ * One JSON line per image is printed on stdout
+ */
+
+/* One page: BMP header, palette or masks, and the payload header fields */
+#define PROBE_READ_SIZE 4096
+
+typedef struct _ProbeInfo
+{
+    uint width; // BMP width in pixels
+    uint height; // BMP height in pixels
+    BmpInfo bmp; // header layout, as parsed
+    int has_payload; // magic string and header fields are valid
+    char extn_secret_file[MAX_FILE_SUFFIX]; // recorded extension
+    int depth; // LSBs per carrier byte for the secret data
+    int sealed; // the secret is encrypted (size is its plaintext size)
+    CodecType codec; // compression of the secret (size is its compressed size)
+    long size_secret_file; // recorded secret size
+    long free_bytes; // secret bytes still available after the payload at its depth
+    ShardInfo shard; // place of the payload in a secret split over several images
+} ProbeInfo;
+
+/* Read the header region of one image
+ * Return Value: e_failure if the file cannot be read or is not a BMP,
+ * e_success otherwise (has_payload tells whether it carries a secret)
+ */
+Status probe_image(const char *fname, ProbeInfo *probeInfo);
+
+/* Carrier bytes left for data after a fresh header and the CRC, laid out as check_capacity does
+ * ('alpha': through the alpha bytes of a 32 bpp image)
+ */
+long long probe_data_room(const BmpInfo *bmp, int alpha);
+
+/* Secret bytes that fit in 'room' data carrier bytes at 'depth', as check_capacity counts them */
+long probe_room_bytes(long long room, int depth);
+
+/* Probe every image named in 'paths' (NULL terminated) on 'jobs' worker threads
+ * Return Value: e_failure if any image could not be probed
+ */
+Status run_probe(char *paths[], int jobs);
+
+#endif
@@ -0,0 +1,142 @@
+#include <string.h>
+#include "scatter.h"
+#include "lsb.h"
+
+/* 64-bit finalizer: every input bit reaches every output bit */
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* Derive the permutation of [0, domain) for a passphrase */
+void scatter_init(Scatter *sc, const char *key, size_t domain)
+{
+    uint64_t state = 0xCBF29CE484222325ULL;                 // FNV-1a offset basis
+
+    // Hash the passphrase, then the domain so each carrier size gets its own order
+    for (; *key; key++)
+        state = (state ^ (unsigned char)*key) * 0x100000001B3ULL;
+    state ^= mix64(domain);
+
+    for (int r = 0; r < SCATTER_ROUNDS; r++)
+    {
+        state += 0x9E3779B97F4A7C15ULL;                     // splitmix64 sequence
+        sc->round_key[r] = mix64(state);
+    }
+
+    // Smallest even-width power of two that holds the domain
+    sc->half_bits = 1;
+    while (sc->half_bits < 32 && ((uint64_t)1 << (2 * sc->half_bits)) < domain)
+        sc->half_bits++;
+    sc->half_mask = ((uint64_t)1 << sc->half_bits) - 1;
+    sc->domain = domain;
+}
+
+/* Position of slot 'i' in [0, domain)
+ * Balanced Feistel network over 2 * half_bits bits, walked until it lands
+ * inside the domain (fewer than 4 steps on average)
+ */
+size_t scatter_index(const Scatter *sc, size_t i)
+{
+    uint64_t x = i;
+
+    do
+    {
+        uint64_t left = x >> sc->half_bits, right = x & sc->half_mask;
+        for (int r = 0; r < SCATTER_ROUNDS; r++)
+        {
+            uint64_t next = left ^ (mix64(right ^ sc->round_key[r]) & sc->half_mask);
+            left = right;
+            right = next;
+        }
+        x = left << sc->half_bits | right;
+    } while (x >= sc->domain);
+
+    return x;
+}
+
+/* Embed 'count' bytes at 'depth' into the scattered carrier slots from 'slot' on
+ * Slots are gathered a block at a time, run through the bulk kernel and put back;
+ * with 'verify' each block is read back through the offsets it was put at
+ */
+static Status scatter_place(const Scatter *sc, const BmpInfo *bmp, char *image, size_t data_pos, size_t slot,
+                            const char *data, size_t count, int depth, int verify)
+{
+    const size_t group = LSB_GROUP(depth), span = group * 8 / depth;
+    size_t offset[SCATTER_BLOCK];
+    char unit[SCATTER_BLOCK], check[SCATTER_BLOCK];
+
+    while (count > 0)
+    {
+        size_t run = SCATTER_BLOCK / span * group;
+        if (run > count)
+            run = count;
+        size_t len = LSB_SPAN(run, depth);
+
+        for (size_t i = 0; i < len; i++)
+        {
+            offset[i] = bmp_file_offset(bmp, data_pos + scatter_index(sc, slot + i));
+            unit[i] = image[offset[i]];
+        }
+        lsb_embed_depth(unit, data, run, depth);
+        for (size_t i = 0; i < len; i++)
+            image[offset[i]] = unit[i];
+
+        if (verify)
+        {
+            for (size_t i = 0; i < len; i++)
+                unit[i] = image[offset[i]];
+            lsb_extract_depth(check, unit, run, depth);
+            if (memcmp(check, data, run) != 0)
+                return e_failure;
+        }
+
+        slot += len;
+        data += run;
+        count -= run;
+    }
+    return e_success;
+}
+
+/* Embed 'count' bytes at 'depth' into the scattered carrier slots from 'slot' on */
+void scatter_embed(const Scatter *sc, const BmpInfo *bmp, char *image, size_t data_pos, size_t slot,
+                   const char *data, size_t count, int depth)
+{
+    scatter_place(sc, bmp, image, data_pos, slot, data, count, depth, 0);
+}
+
+/* scatter_embed, then read every block back from the slots it was just put in */
+Status scatter_embed_verified(const Scatter *sc, const BmpInfo *bmp, char *image, size_t data_pos, size_t slot,
+                              const char *data, size_t count, int depth)
+{
+    return scatter_place(sc, bmp, image, data_pos, slot, data, count, depth, 1);
+}
+
+/* Extract 'count' bytes at 'depth' from the scattered carrier slots from 'slot' on */
+void scatter_extract(const Scatter *sc, const BmpInfo *bmp, char *data, const char *image, size_t data_pos,
+                     size_t slot, size_t count, int depth)
+{
+    const size_t group = LSB_GROUP(depth), span = group * 8 / depth;
+    char unit[SCATTER_BLOCK];
+
+    while (count > 0)
+    {
+        size_t run = SCATTER_BLOCK / span * group;
+        if (run > count)
+            run = count;
+        size_t len = LSB_SPAN(run, depth);
+
+        for (size_t i = 0; i < len; i++)
+            unit[i] = image[bmp_file_offset(bmp, data_pos + scatter_index(sc, slot + i))];
+        lsb_extract_depth(data, unit, run, depth);
+
+        slot += len;
+        data += run;
+        count -= run;
+    }
+}
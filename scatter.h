@@ -0,0 +1,50 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+#include "bmp.h"
+
+/*
+ * Keyed scatter of the secret data over the carrier
+ * Data carrier slot i (the i-th carrier byte of the sequential layout)
+ * goes to carrier byte data_pos + scatter_index(i) instead of data_pos + i.
+ * scatter_index is a keyed Feistel permutation of [0, domain), evaluated
+ * per index, so any range of slots can be placed without a table.
+ */
+
+#define SCATTER_ROUNDS 6
+#define SCATTER_BLOCK 4096 // carrier slots staged per kernel call, whole units at every depth
+
+typedef struct _Scatter
+{
+    uint64_t round_key[SCATTER_ROUNDS]; // derived from the key and the domain
+    uint half_bits; // bits in each Feistel half
+    uint64_t half_mask; // (1 << half_bits) - 1
+    size_t domain; // carrier bytes the data may use
+} Scatter;
+
+/* Derive the permutation of [0, domain) for a passphrase */
+void scatter_init(Scatter *sc, const char *key, size_t domain);
+
+/* Position of slot 'i' in [0, domain) */
+size_t scatter_index(const Scatter *sc, size_t i);
+
+/* Embed 'count' bytes at 'depth' into the scattered carrier slots from 'slot' on
+ * 'image' is the whole image in memory, data_pos the carrier offset of slot 0
+ */
+void scatter_embed(const Scatter *sc, const BmpInfo *bmp, char *image, size_t data_pos, size_t slot,
+                   const char *data, size_t count, int depth);
+
+/* scatter_embed, then read every block back from the slots it was just put in
+ * Return Value: e_failure at the first block that does not read back
+ */
+Status scatter_embed_verified(const Scatter *sc, const BmpInfo *bmp, char *image, size_t data_pos, size_t slot,
+                              const char *data, size_t count, int depth);
+
+/* Extract 'count' bytes at 'depth' from the scattered carrier slots from 'slot' on */
+void scatter_extract(const Scatter *sc, const BmpInfo *bmp, char *data, const char *image, size_t data_pos,
+                     size_t slot, size_t count, int depth);
+
+#endif
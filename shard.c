@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include "shard.h"
+#include "common.h"
+#include "bmp.h"
+#include "lsb.h"
+#include "pack.h"
+#include "aead.h"
+#include "probe.h"
+
+/* State shared by the shard workers */
+typedef struct
+{
+    char **files; // carriers (encode) or stego images (decode), in shard order
+    int count;
+    int next; // next shard to hand out
+    pthread_mutex_t lock; // guards next, failed and stdout
+    int failed;
+    ShardInfo *shards; // place of every shard in the secret
+    long *sizes; // secret bytes of every shard (encode)
+    char **stego_names; // output image of every shard (encode)
+    const char *secret; // secret file (encode)
+    const char *out_name; // output file with its extension, NULL when verifying (decode)
+    const EncodeInfo *enc_template;
+    const DecodeInfo *dec_template;
+} ShardJob;
+
+/* Most payload bytes 'size' secret bytes can grow to: every frame stored, then sealed */
+static size_t worst_payload(size_t size, const EncodeInfo *enc)
+{
+    if (enc->codec != e_codec_none)
+        size += (size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE * PACK_HEADER_SIZE;
+    return enc->encrypt ? aead_stream_size(size) : size;
+}
+
+/* Secret bytes a carrier takes as one shard with the template's options
+ * Return Value: -1 if the carrier is not a readable BMP, or is shorter than its header says
+ */
+static long shard_capacity(const char *fname, const EncodeInfo *enc)
+{
+    unsigned char header[BMP_HEADER_SIZE];
+    BmpInfo bmp, data_bmp;
+    struct stat st;
+    FILE *fp = fopen(fname, "rb");
+
+    if (fp == NULL)
+        return -1;
+    size_t len = fread(header, 1, sizeof(header), fp);
+    int sized = fstat(fileno(fp), &st) == 0;
+    fclose(fp);
+    if (len != sizeof(header) || !sized || bmp_parse(header, &bmp) == e_failure)
+        return -1;
+
+    // Same accounting as check_capacity: header, data at 'depth' bits, CRC, one spare byte
+    int depth = enc->depth < MIN_DEPTH ? MIN_DEPTH : enc->depth;
+    size_t reserved = STEGO_SHARD_HEADER_SIZE * 8;
+    data_bmp = bmp;
+    if (enc->alpha && bmp_use_alpha(&data_bmp) == e_success)
+        reserved = bmp_carrier_pos(&data_bmp, bmp_file_end(&bmp, reserved));
+    if (bmp_file_end(&data_bmp, data_bmp.usable) > (size_t)st.st_size)
+        return -1;
+    reserved += STEGO_CHECKSUM_SIZE * 8 + 1;
+    if (data_bmp.usable <= reserved)
+        return 0;
+    size_t payload = (data_bmp.usable - reserved) * depth / 8;
+
+    // Largest secret whose worst case still fits
+    size_t lo = 0, hi = payload;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (worst_payload(mid, enc) <= payload)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Split 'size' secret bytes over the carriers in proportion to their capacity,
+ * so every carrier ends up about as full as the others
+ */
+static Status plan_shards(ShardJob *job, long size)
+{
+    long *capacity = job->sizes, cap_left = 0, left = size, offset = 0;   // Each capacity gives way to its share
+    uint set;
+
+    for (int i = 0; i < job->count; i++)
+    {
+        capacity[i] = shard_capacity(job->files[i], job->enc_template);
+        if (capacity[i] < 0)
+        {
+            fprintf(stderr, "ERROR: %s is not an uncompressed BMP image, or is cut short\n", job->files[i]);
+            return e_failure;
+        }
+        cap_left += capacity[i];
+    }
+    if (size > cap_left)
+    {
+        fprintf(stderr, "ERROR: The carriers hold %ld secret bytes, the secret has %ld\n", cap_left, size);
+        return e_failure;
+    }
+    if (getrandom(&set, sizeof(set), 0) != sizeof(set))
+    {
+        fprintf(stderr, "ERROR: Unable to get random bytes for the set id\n");
+        return e_failure;
+    }
+
+    for (int i = 0; i < job->count; i++)
+    {
+        // Round up so the last carriers are never asked for more than their share
+        long cap = capacity[i];
+        long share = cap_left ? (long)(((long double)left * cap + cap_left - 1) / cap_left) : 0;
+        if (share > cap)
+            share = cap;
+        if (share > left)
+            share = left;
+
+        job->shards[i] = (ShardInfo){ i, job->count, set, offset, size };
+        job->sizes[i] = share;
+        offset += share;
+        left -= share;
+        cap_left -= cap;
+    }
+    return left == 0 ? e_success : e_failure;
+}
+
+/* Encode shard 'i' into its carrier */
+static Status encode_shard(ShardJob *job, int i)
+{
+    EncodeInfo encInfo = *job->enc_template;
+    char *argv[6] = { "shard", "-e", job->files[i], (char *)job->secret, job->stego_names[i], NULL };
+    Status status = e_failure;
+
+    encInfo.io_buf = NULL;
+    encInfo.keep_io_buf = 0;
+    encInfo.quiet = 1;
+    if (read_and_validate_encode_args(argv, &encInfo) == e_success)
+    {
+        encInfo.size_secret_file = job->sizes[i];
+        encInfo.secret_size_given = 1;
+        encInfo.shard = job->shards[i];
+        status = do_encoding(&encInfo);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    if (status == e_success)
+        printf("INFO: Shard %d/%d: %s -> %s, %ld bytes at offset %ld\n", i + 1, job->count, job->files[i],
+               job->stego_names[i], job->sizes[i], job->shards[i].offset);
+    else
+        printf("ERROR: Shard %d/%d: %s -> %s failed\n", i + 1, job->count, job->files[i], job->stego_names[i]);
+    fflush(stdout);
+    pthread_mutex_unlock(&job->lock);
+    return status;
+}
+
+/* Decode shard 'i' straight into its range of the output file */
+static Status decode_shard(ShardJob *job, int i)
+{
+    DecodeInfo decInfo = *job->dec_template;
+    const ShardInfo *want = &job->shards[i];
+    Status status = e_failure;
+
+    decInfo.op_image_fname = job->files[i];
+    decInfo.fptr_op_image = decInfo.out_secret = NULL;
+    decInfo.op_map = decInfo.out_map = NULL;
+    decInfo.streaming = 0;
+    if (open_decode_files(&decInfo) == e_success &&
+        (decInfo.io_mode == e_io_stdio || decInfo.io_mode == e_io_pipeline || map_decode_files(&decInfo) == e_success || decInfo.io_mode != e_io_mmap) &&
+        skip_bmp_header(&decInfo) == e_success && decode_stego_header(&decInfo) == e_success &&
+        decInfo.shard.set == want->set && decInfo.shard.index == want->index)
+    {
+        // Every shard has its own stream on the output, positioned at its offset
+        if (job->out_name)
+        {
+            decInfo.out_secret = fopen(job->out_name, "r+b");
+            if (decInfo.out_secret && fseek(decInfo.out_secret, decInfo.shard.offset, SEEK_SET) != 0)
+            {
+                fclose(decInfo.out_secret);
+                decInfo.out_secret = NULL;
+            }
+        }
+        if (job->out_name == NULL || decInfo.out_secret != NULL)
+            status = decode_secret_file_data(&decInfo);
+    }
+    close_decode_files(&decInfo);
+
+    pthread_mutex_lock(&job->lock);
+    if (status == e_success)
+        printf("INFO: Shard %d/%d: %s %s, offset %ld\n", i + 1, job->count, job->files[i],
+               job->out_name ? "decoded" : "verified", want->offset);
+    else
+        printf("ERROR: Shard %d/%d: %s failed\n", i + 1, job->count, job->files[i]);
+    fflush(stdout);
+    pthread_mutex_unlock(&job->lock);
+    return status;
+}
+
+/* Worker: run shards until none are left */
+static void *shard_worker(void *arg)
+{
+    ShardJob *job = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (i >= job->count)
+            break;
+        Status status = job->enc_template ? encode_shard(job, i) : decode_shard(job, i);
+        if (status == e_failure)
+        {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+/* Run every shard of the job on 'jobs' worker threads */
+static Status run_shards(ShardJob *job, int jobs)
+{
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+
+    if (jobs > job->count)
+        jobs = job->count;
+    for (int i = 1; i < jobs; i++)
+    {
+        if (pthread_create(&tids[started], NULL, shard_worker, job) == 0)
+            started++;
+    }
+    shard_worker(job);                                      // Calling thread works too
+
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    return job->failed ? e_failure : e_success;
+}
+
+/* Split 'secret' over 'count' carriers */
+Status run_shard_encode(const char *secret, const char *stego_name, char *carriers[], int count, int jobs,
+                        const EncodeInfo *enc_template)
+{
+    ShardJob job = { .files = carriers, .count = count, .lock = PTHREAD_MUTEX_INITIALIZER };
+    struct stat st;
+    Status status = e_failure;
+
+    if (count < 1 || count > STEGO_SHARD_MAX)
+    {
+        fprintf(stderr, "ERROR: Shards need 1 to %d carriers\n", STEGO_SHARD_MAX);
+        return e_failure;
+    }
+    if (stat(secret, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "ERROR: Sharding needs a regular secret file, %s is not one\n", secret);
+        return e_failure;
+    }
+
+    // Shard i goes to <stego>.<i>.bmp
+    size_t base = strlen(stego_name);
+    if (base > 4 && strcmp(stego_name + base - 4, ".bmp") == 0)
+        base -= 4;
+    job.shards = calloc(count, sizeof(*job.shards));
+    job.sizes = calloc(count, sizeof(*job.sizes));
+    job.stego_names = calloc(count, sizeof(*job.stego_names));
+    int named = job.stego_names != NULL;
+    for (int i = 0; named && i < count; i++)
+    {
+        job.stego_names[i] = malloc(base + 16);
+        named = job.stego_names[i] != NULL;
+        if (named)
+            sprintf(job.stego_names[i], "%.*s.%d.bmp", (int)base, stego_name, i);
+    }
+    job.secret = secret;
+    job.enc_template = enc_template;
+
+    if (job.shards && job.sizes && named &&
+        plan_shards(&job, st.st_size) == e_success)
+        status = run_shards(&job, jobs);
+
+    for (int i = 0; job.stego_names && i < count; i++)
+        free(job.stego_names[i]);
+    free(job.stego_names);
+    free(job.sizes);
+    free(job.shards);
+    return status;
+}
+
+/* Read every image's header: one whole set, each shard once, put in shard order */
+static Status collect_shards(ShardJob *job, char *images[], ProbeInfo *first)
+{
+    ProbeInfo probeInfo;
+
+    for (int i = 0; i < job->count; i++)
+    {
+        if (probe_image(images[i], &probeInfo) == e_failure || !probeInfo.has_payload || !probeInfo.shard.count)
+        {
+            fprintf(stderr, "ERROR: %s does not hold a shard\n", images[i]);
+            return e_failure;
+        }
+        if (i == 0)
+            *first = probeInfo;
+
+        const ShardInfo *shard = &probeInfo.shard;
+        if (shard->count != job->count)
+        {
+            fprintf(stderr, "ERROR: %s belongs to a set of %d shards, %d images were given\n", images[i], shard->count,
+                    job->count);
+            return e_failure;
+        }
+        if (shard->set != first->shard.set || shard->total != first->shard.total)
+        {
+            fprintf(stderr, "ERROR: %s is not part of the same set as %s\n", images[i], images[0]);
+            return e_failure;
+        }
+        if (job->files[shard->index] != NULL)
+        {
+            fprintf(stderr, "ERROR: %s and %s both hold shard %d\n", job->files[shard->index], images[i], shard->index + 1);
+            return e_failure;
+        }
+        job->files[shard->index] = images[i];
+        job->shards[shard->index] = *shard;
+    }
+    return e_success;
+}
+
+/* Create the output file at its full size, every shard then writes its own range */
+static Status create_shard_output(const char *name, long size)
+{
+    FILE *out = fopen(name, "wb");
+    Status status = out && ftruncate(fileno(out), size) == 0 ? e_success : e_failure;
+
+    if (status == e_failure)
+        fprintf(stderr, "ERROR: Unable to create %s\n", name);
+    if (out)
+        fclose(out);
+    return status;
+}
+
+/* Reassemble the secret held by 'count' stego images */
+Status run_shard_decode(const char *out_name, char *images[], int count, int jobs, const DecodeInfo *dec_template)
+{
+    ShardJob job = { .files = NULL, .count = count, .lock = PTHREAD_MUTEX_INITIALIZER };
+    DecodeInfo names = *dec_template;
+    ProbeInfo first;
+    Status status = e_failure;
+
+    job.files = calloc(count, sizeof(*job.files));
+    job.shards = calloc(count, sizeof(*job.shards));
+    job.dec_template = dec_template;
+    names.out_fname = (char *)out_name;
+
+    if (job.files && job.shards && collect_shards(&job, images, &first) == e_success)
+    {
+        if (dec_template->verify)
+        {
+            status = run_shards(&job, jobs);                // Checked only, nothing is written
+        }
+        else if (strcmp(out_name, "-") == 0)
+        {
+            fprintf(stderr, "ERROR: Shards are written at their offsets and cannot go to stdout\n");
+        }
+        else
+        {
+            // Output name gets the recorded extension, as for a single image
+            strcpy(names.extn_secret_file, first.extn_secret_file);
+            if (create_output_file_name(&names) == e_success)
+            {
+                job.out_name = names.out_fname;
+                if (create_shard_output(job.out_name, first.shard.total) == e_success)
+                {
+                    status = run_shards(&job, jobs);
+                    if (status == e_failure)
+                        remove(job.out_name);               // No half-assembled secret is left behind
+                }
+                free(names.out_fname);
+            }
+        }
+    }
+
+    free(job.shards);
+    free(job.files);
+    return status;
+}
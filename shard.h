@@ -0,0 +1,31 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "types.h" // Contains user defined types
+#include "encode.h"
+#include "decode.h"
+
+/*
+ * Shard mode: one secret split over several carrier images
+ *   ./a.out -e --shards <secret> <stego.bmp> <carrier.bmp>...
+ *     shard i goes to <stego>.<i>.bmp, sized by each carrier's capacity
+ *   ./a.out -d --shards <output> <stego.bmp>...
+ *     the images may come in any order, shards are written at their
+ *     offsets in one output file
+ * Shards are encoded and decoded on --jobs workers, one line per shard
+ * is printed on stdout
+ */
+
+/* Split 'secret' over 'count' carriers, options from enc_template
+ * Return Value: e_failure if the secret does not fit or any shard failed
+ */
+Status run_shard_encode(const char *secret, const char *stego_name, char *carriers[], int count, int jobs,
+                        const EncodeInfo *enc_template);
+
+/* Reassemble the secret held by 'count' stego images into 'out_name' plus its extension
+ * (with --verify the shards are only checked), options from dec_template
+ * Return Value: e_failure if the images are not one whole set or any shard failed
+ */
+Status run_shard_decode(const char *out_name, char *images[], int count, int jobs, const DecodeInfo *dec_template);
+
+#endif
@@ -0,0 +1,151 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "stats.h"
+
+static const char *stage_names[STATS_STAGES] = {
+    "open", "capacity", "bmp_header", "stego_header", "data", "tail", "sync", "close"
+};
+
+static int io_fd = -1;
+static pthread_once_t io_once = PTHREAD_ONCE_INIT;
+
+/* Opened once and kept: every later look is a single pread */
+static void open_io_counters(void)
+{
+    io_fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+}
+
+/* Read and write system calls made by the process so far (0 without task I/O accounting)
+ * The pread of a look shows up in the next one, so a lap takes one read off
+ */
+static void io_counters(uint64_t *reads, uint64_t *writes)
+{
+    char buf[512];
+    ssize_t len;
+
+    *reads = *writes = 0;
+    pthread_once(&io_once, open_io_counters);
+    if (io_fd < 0 || (len = pread(io_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+        return;
+    buf[len] = '\0';
+
+    const char *p = strstr(buf, "syscr: ");
+    if (p)
+        *reads = strtoull(p + 7, NULL, 10);
+    p = strstr(buf, "syscw: ");
+    if (p)
+        *writes = strtoull(p + 7, NULL, 10);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Start timing a job from now */
+void stats_mark(StatsMark *mark)
+{
+    io_counters(&mark->reads, &mark->writes);
+    mark->ns = now_ns();
+}
+
+/* Charge everything since 'mark' to 'stage' and move the mark */
+void stats_lap(Stats *st, StatsMark *mark, StatsStage stage, uint64_t bytes)
+{
+    StageStats *s = &st->stage[stage];
+    uint64_t ns = now_ns(), total_reads, total_writes;
+
+    io_counters(&total_reads, &total_writes);
+    uint64_t reads = total_reads > mark->reads ? total_reads - mark->reads - 1 : 0; // Without the previous look
+    uint64_t writes = total_writes > mark->writes ? total_writes - mark->writes : 0;
+
+    // Jobs on several threads may share one Stats
+    __atomic_fetch_add(&s->runs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->ns, ns - mark->ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->reads, reads, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->writes, writes, __ATOMIC_RELAXED);
+
+    mark->reads = total_reads;
+    mark->writes = total_writes;
+    mark->ns = ns;
+}
+
+/* Name of a stage in the output */
+const char *stats_stage_name(StatsStage stage)
+{
+    return stage < STATS_STAGES ? stage_names[stage] : "unknown";
+}
+
+/* Whether any stage of 'st' ran */
+static int has_runs(const Stats *st)
+{
+    for (int s = 0; s < STATS_STAGES; s++)
+        if (st->stage[s].runs)
+            return 1;
+    return 0;
+}
+
+/* One Prometheus counter family over every op and stage that ran */
+static void print_family(FILE *fp, const Stats *const *st, int count, const char *name, const char *help, size_t field,
+                         double scale)
+{
+    fprintf(fp, "# HELP stego_stage_%s %s\n# TYPE stego_stage_%s counter\n", name, help, name);
+    for (int i = 0; i < count; i++)
+        for (int s = 0; s < STATS_STAGES; s++)
+        {
+            const StageStats *stage = &st[i]->stage[s];
+            if (stage->runs == 0)
+                continue;
+            uint64_t value = *(const uint64_t *)((const char *)stage + field);
+            if (scale != 1)
+                fprintf(fp, "stego_stage_%s{op=\"%s\",stage=\"%s\"} %.9f\n", name, st[i]->op, stage_names[s], value * scale);
+            else
+                fprintf(fp, "stego_stage_%s{op=\"%s\",stage=\"%s\"} %llu\n", name, st[i]->op, stage_names[s],
+                        (unsigned long long)value);
+        }
+}
+
+/* Write the counters as JSON lines or Prometheus text */
+void stats_print(FILE *fp, StatsFormat format, const Stats *const *st, int count)
+{
+    if (format == e_stats_prometheus)
+    {
+        print_family(fp, st, count, "runs_total", "Times each stage completed.", offsetof(StageStats, runs), 1);
+        print_family(fp, st, count, "seconds_total", "Time spent in each stage.", offsetof(StageStats, ns), 1e-9);
+        print_family(fp, st, count, "bytes_total", "Header, payload or image bytes each stage handled.",
+                     offsetof(StageStats, bytes), 1);
+        print_family(fp, st, count, "read_syscalls_total", "Read system calls during each stage, process wide.",
+                     offsetof(StageStats, reads), 1);
+        print_family(fp, st, count, "write_syscalls_total", "Write system calls during each stage, process wide.",
+                     offsetof(StageStats, writes), 1);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char *sep = "";
+        if (!has_runs(st[i]))
+            continue;
+        fprintf(fp, "{\"op\":\"%s\",\"stages\":{", st[i]->op);
+        for (int s = 0; s < STATS_STAGES; s++)
+        {
+            const StageStats *stage = &st[i]->stage[s];
+            if (stage->runs == 0)
+                continue;
+            fprintf(fp, "%s\"%s\":{\"runs\":%llu,\"ns\":%llu,\"bytes\":%llu,\"reads\":%llu,\"writes\":%llu}", sep,
+                    stage_names[s], (unsigned long long)stage->runs, (unsigned long long)stage->ns,
+                    (unsigned long long)stage->bytes, (unsigned long long)stage->reads,
+                    (unsigned long long)stage->writes);
+            sep = ",";
+        }
+        fprintf(fp, "}}\n");
+    }
+}
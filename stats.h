@@ -0,0 +1,79 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Per-stage timings and counters (--stats, or StegoContext.stats)
+ * A stage boundary costs a clock read and one read of /proc/self/io, so
+ * the hooks can stay on in production; building with -DSTEGO_NO_STATS
+ * turns every hook into nothing. Counters only grow: one Stats can sum
+ * many jobs, from any thread. System call counts are process wide (every
+ * thread's, worker threads included), so they are exact per stage only
+ * while one job runs at a time; memory-mapped access makes none.
+ */
+
+typedef enum
+{
+    e_stage_open,         // open (and map) the files
+    e_stage_capacity,     // parse the BMP, check the secret fits
+    e_stage_bmp_header,   // copy or skip the BMP header
+    e_stage_stego_header, // embed or extract the container header
+    e_stage_data,         // embed or extract the payload and its CRC
+    e_stage_tail,         // copy the image after the payload
+    e_stage_sync,         // push the stego image to disk (--verify-on-write)
+    e_stage_close,        // close (and unmap) the files
+    STATS_STAGES
+} StatsStage;
+
+typedef enum
+{
+    e_stats_json,      // one JSON object per line
+    e_stats_prometheus // Prometheus text exposition format
+} StatsFormat;
+
+/* Totals of one stage */
+typedef struct
+{
+    uint64_t runs; // times the stage completed
+    uint64_t ns; // monotonic time spent in it
+    uint64_t bytes; // bytes handled: header bytes, payload bytes or image bytes copied
+    uint64_t reads; // read system calls (read, pread, readv...)
+    uint64_t writes; // write system calls
+} StageStats;
+
+typedef struct
+{
+    const char *op; // label in the output, e.g. "encode"
+    StageStats stage[STATS_STAGES];
+} Stats;
+
+/* Clock and counters at the last stage boundary of one job */
+typedef struct
+{
+    uint64_t ns, reads, writes;
+} StatsMark;
+
+#ifndef STEGO_NO_STATS
+#define STATS_MARK(st, mark) ((st) ? stats_mark(mark) : (void)0)
+#define STATS_LAP(st, mark, stage, bytes) ((st) ? stats_lap((st), (mark), (stage), (bytes)) : (void)0)
+#else
+#define STATS_MARK(st, mark) ((void)(st), (void)(mark))
+#define STATS_LAP(st, mark, stage, bytes) ((void)(st), (void)(mark))
+#endif
+
+/* Start timing a job from now */
+void stats_mark(StatsMark *mark);
+
+/* Charge the time and system calls since 'mark' to 'stage', with 'bytes', and move the mark */
+void stats_lap(Stats *st, StatsMark *mark, StatsStage stage, uint64_t bytes);
+
+/* Name of a stage in the output */
+const char *stats_stage_name(StatsStage stage);
+
+/* Write 'count' Stats to 'fp', stages (and Stats) that never ran left out */
+void stats_print(FILE *fp, StatsFormat format, const Stats *const *st, int count);
+
+#endif
@@ -0,0 +1,737 @@
+#include <string.h>
+#include <limits.h>
+#include "stego.h"
+#include "bmp.h"
+#include "lsb.h"
+#include "scatter.h"
+#include "crc.h"
+
+/* Payload bytes on their way into or out of the image, in order
+ * Runs go to the kernels in whole units; a unit split between two calls
+ * waits in 'held' (embed) or is extracted once and handed out from there
+ */
+typedef struct
+{
+    StegoContext *ctx;
+    BmpInfo bmp; // data layout, alpha bytes included when used
+    unsigned char *image;
+    size_t data_pos; // carrier offset of the first data carrier byte
+    Scatter sc; // keyed order over the carrier bytes after the header
+    int scatter; // slots go through 'sc'
+    int depth;
+    size_t size; // payload bytes
+    size_t done; // payload bytes through the kernels
+    char held[3]; // partial unit
+    size_t held_len; // bytes in 'held'
+    size_t held_pos; // bytes of 'held' handed out (extract)
+    uint crc; // CRC32C of the payload bytes so far
+
+    /* Sealing and opening */
+    AeadKey key;
+    size_t plain_size; // bytes under the seal: the secret, or its frames
+    size_t plain_done; // bytes sealed or opened so far
+    size_t fill; // bytes waiting in ctx->plain (embed)
+    size_t opened; // chunk in ctx->plain plus one, 0 for none (random access)
+
+    /* Output of an extraction */
+    char *out; // NULL when only measuring
+    size_t out_size;
+    size_t out_len;
+    size_t frame_len; // bytes of the current frame in ctx->frame
+    size_t frame_size; // bytes of the current frame, 0 until its header is in
+} Payload;
+
+/* Store 'len' bytes of 'value' big-endian */
+static void put_be(unsigned char *p, uint64_t value, int len)
+{
+    for (int i = len - 1; i >= 0; i--, value >>= 8)
+        p[i] = value;
+}
+
+/* Read a big-endian field of 'len' bytes */
+static uint64_t get_be(const unsigned char *p, int len)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < len; i++)
+        value = value << 8 | p[i];
+    return value;
+}
+
+/* Record why a call failed */
+static Status fail(StegoContext *ctx, const char *error)
+{
+    ctx->error = error;
+    return e_failure;
+}
+
+/* Build the container header for 'h' */
+size_t stego_header_pack(const StegoHeader *h, unsigned char *header)
+{
+    const size_t size = h->shard.count ? STEGO_SHARD_HEADER_SIZE : STEGO_HEADER_SIZE;
+
+    memset(header, 0, size);
+    memcpy(header, MAGIC_STRING, strlen(MAGIC_STRING));
+    header[2] = STEGO_VERSION_MARK | STEGO_VERSION;
+    header[3] = size;
+    put_be(header + STEGO_FLAGS_OFFSET, h->flags | (h->shard.count ? EXTN_SHARD_FLAG : 0), 4);
+    put_be(header + STEGO_SIZE_OFFSET, h->payload_size, 8);
+    memcpy(header + STEGO_EXTN_OFFSET, h->extn, strlen(h->extn));
+    if (h->shard.count)
+    {
+        put_be(header + STEGO_SHARD_INDEX_OFFSET, h->shard.index, 2);
+        put_be(header + STEGO_SHARD_COUNT_OFFSET, h->shard.count, 2);
+        put_be(header + STEGO_SHARD_POS_OFFSET, h->shard.offset, 8);
+        put_be(header + STEGO_SHARD_TOTAL_OFFSET, h->shard.total, 8);
+        put_be(header + STEGO_SHARD_SET_OFFSET, h->shard.set, 4);
+    }
+    put_be(header + size - 4, crc32c(0, header, size - 4), 4);
+    return size;
+}
+
+/* Parse and check a container header of 'size' bytes */
+Status stego_header_unpack(const unsigned char *header, size_t size, StegoHeader *h)
+{
+    if (size < STEGO_HEADER_SIZE || size > STEGO_HEADER_MAX || memcmp(header, MAGIC_STRING, strlen(MAGIC_STRING)) != 0 ||
+        header[2] != (STEGO_VERSION_MARK | STEGO_VERSION) || header[3] != size)
+        return e_failure;
+    if (crc32c(0, header, size - 4) != get_be(header + size - 4, 4))
+        return e_failure;
+
+    // Extension and 64-bit payload size, the flags keep the legacy field layout
+    size_t extn_size = header[STEGO_FLAGS_OFFSET + 3];
+    h->flags = get_be(header + STEGO_FLAGS_OFFSET, 4);
+    h->payload_size = get_be(header + STEGO_SIZE_OFFSET, 8);
+    if (h->flags > STEGO_FLAGS_MAX || h->payload_size > LONG_MAX || extn_size >= STEGO_EXTN_SIZE)
+        return e_failure;
+    memcpy(h->extn, header + STEGO_EXTN_OFFSET, extn_size);
+    h->extn[extn_size] = '\0';
+
+    // One shard of a split secret: where its bytes go in the whole
+    memset(&h->shard, 0, sizeof(h->shard));
+    if (h->flags & EXTN_SHARD_FLAG)
+    {
+        uint64_t offset = get_be(header + STEGO_SHARD_POS_OFFSET, 8), total = get_be(header + STEGO_SHARD_TOTAL_OFFSET, 8);
+
+        h->shard.index = get_be(header + STEGO_SHARD_INDEX_OFFSET, 2);
+        h->shard.count = get_be(header + STEGO_SHARD_COUNT_OFFSET, 2);
+        h->shard.set = get_be(header + STEGO_SHARD_SET_OFFSET, 4);
+        if (size < STEGO_SHARD_HEADER_SIZE || h->shard.index >= h->shard.count || total > LONG_MAX || offset > total)
+            return e_failure;
+        h->shard.offset = offset;
+        h->shard.total = total;
+    }
+    return e_success;
+}
+
+/* Reset the options to the defaults */
+void stego_init(StegoContext *ctx)
+{
+    ctx->depth = MIN_DEPTH;
+    ctx->alpha = ctx->scatter = ctx->encrypt = 0;
+    ctx->codec = e_codec_none;
+    ctx->key = NULL;
+    ctx->stats = NULL;
+    strcpy(ctx->extn, ".txt");
+    memset(&ctx->header, 0, sizeof(ctx->header));
+    ctx->error = NULL;
+}
+
+/* Parse the BMP in 'image' and lay out the payload behind a 'header_size' byte header
+ * Output: bmp (header fields), p->bmp and p->data_pos (secret data)
+ */
+static Status open_image(StegoContext *ctx, const unsigned char *image, size_t image_len, size_t header_size, int alpha,
+                         BmpInfo *bmp, Payload *p)
+{
+    if (image_len < BMP_HEADER_SIZE || bmp_parse(image, bmp) == e_failure)
+        return fail(ctx, "not an uncompressed 8, 24 or 32 bpp BMP image");
+    if (bmp_file_end(bmp, bmp->usable) > image_len)
+        return fail(ctx, "image buffer is shorter than its pixel data");
+
+    // Data through the alpha bytes too: it starts where the header fields end, in that layout
+    p->ctx = ctx;
+    p->image = (unsigned char *)image;
+    p->bmp = *bmp;
+    p->data_pos = header_size * 8;
+    if (alpha && bmp_use_alpha(&p->bmp) == e_success)
+        p->data_pos = bmp_carrier_pos(&p->bmp, bmp_file_end(bmp, p->data_pos));
+    return e_success;
+}
+
+/* Start moving 'size' payload bytes at 'depth' */
+static void begin_payload(Payload *p, size_t size, int depth, int scatter, const char *key)
+{
+    p->scatter = scatter;
+    p->depth = depth;
+    p->size = size;
+    p->done = p->held_len = p->held_pos = 0;
+    p->crc = 0;
+    p->plain_done = p->fill = p->opened = 0;
+    p->out_len = p->frame_len = p->frame_size = 0;
+    if (scatter)
+        scatter_init(&p->sc, key, p->bmp.usable - p->data_pos);
+}
+
+/* Embed 'count' payload bytes at the next slots; 'done' is a whole number of units */
+static void put_units(Payload *p, const char *data, size_t count)
+{
+    size_t slot = LSB_SPAN(p->done, p->depth);
+
+    if (p->scatter)
+        scatter_embed(&p->sc, &p->bmp, (char *)p->image, p->data_pos, slot, data, count, p->depth);
+    else
+        bmp_embed(&p->bmp, (char *)p->image, 0, p->data_pos + slot, data, count, p->depth);
+    p->done += count;
+}
+
+/* Extract the next 'count' payload bytes; 'done' is a whole number of units */
+static void get_units(Payload *p, char *data, size_t count)
+{
+    size_t slot = LSB_SPAN(p->done, p->depth);
+
+    if (p->scatter)
+        scatter_extract(&p->sc, &p->bmp, data, (const char *)p->image, p->data_pos, slot, count, p->depth);
+    else
+        bmp_extract(&p->bmp, data, (const char *)p->image, 0, p->data_pos + slot, count, p->depth);
+    p->done += count;
+}
+
+/* Append 'len' bytes to the payload */
+static void payload_write(Payload *p, const char *data, size_t len)
+{
+    const size_t group = LSB_GROUP(p->depth);
+
+    p->crc = crc32c(p->crc, data, len);
+    if (p->held_len > 0)
+    {
+        size_t take = group - p->held_len < len ? group - p->held_len : len;
+        memcpy(p->held + p->held_len, data, take);
+        p->held_len += take;
+        data += take;
+        len -= take;
+        if (p->held_len < group)
+            return;
+        put_units(p, p->held, group);
+        p->held_len = 0;
+    }
+
+    size_t whole = len / group * group;
+    if (whole > 0)
+        put_units(p, data, whole);
+    memcpy(p->held, data + whole, len - whole);
+    p->held_len = len - whole;
+}
+
+/* Read the next 'len' payload bytes */
+static void payload_read(Payload *p, char *data, size_t len)
+{
+    const size_t group = LSB_GROUP(p->depth);
+    char *start = data;
+    size_t total = len;
+
+    // What is left of a unit extracted by the previous read
+    size_t take = p->held_len - p->held_pos < len ? p->held_len - p->held_pos : len;
+    memcpy(data, p->held + p->held_pos, take);
+    p->held_pos += take;
+    data += take;
+    len -= take;
+
+    size_t whole = len / group * group;
+    if (whole > 0)
+        get_units(p, data, whole);
+    if (len > whole)
+    {
+        // Extract the whole unit (or what the payload has left) and keep the rest for the next read
+        p->held_len = p->size - p->done < group ? p->size - p->done : group;
+        get_units(p, p->held, p->held_len);
+        p->held_pos = len - whole;
+        memcpy(data + whole, p->held, p->held_pos);
+    }
+    p->crc = crc32c(p->crc, start, total);
+}
+
+/* Slot of the payload CRC: right after the payload, in keyed order when scattered */
+static size_t trailer_slot(const Payload *p)
+{
+    return LSB_SPAN(p->size, p->depth);
+}
+
+/* Seal the chunk waiting in ctx->plain and append its record to the payload */
+static void seal_chunk(Payload *p)
+{
+    StegoContext *ctx = p->ctx;
+
+    aead_seal_range(&p->key, p->plain_size, p->plain_done, p->plain_done + p->fill, ctx->plain, ctx->record);
+    payload_write(p, ctx->record, p->fill + AEAD_TAG_SIZE);
+    p->plain_done += p->fill;
+    p->fill = 0;
+}
+
+/* Append plaintext (the secret or its frames), sealed a chunk at a time when encrypting */
+static void plain_write(Payload *p, const char *data, size_t len)
+{
+    if (!p->ctx->encrypt)
+    {
+        payload_write(p, data, len);
+        return;
+    }
+    while (len > 0)
+    {
+        size_t take = AEAD_CHUNK_SIZE - p->fill < len ? AEAD_CHUNK_SIZE - p->fill : len;
+        memcpy(p->ctx->plain + p->fill, data, take);
+        p->fill += take;
+        data += take;
+        len -= take;
+        if (p->fill == AEAD_CHUNK_SIZE)
+            seal_chunk(p);
+    }
+}
+
+/* Bytes the secret takes once compressed: a first pass that keeps no frames */
+static size_t packed_size(StegoContext *ctx, const char *secret, size_t secret_len)
+{
+    size_t size = 0;
+
+    for (size_t i = 0; i < secret_len; i += PACK_CHUNK_SIZE)
+        size += pack_frame(secret + i, secret_len - i < PACK_CHUNK_SIZE ? secret_len - i : PACK_CHUNK_SIZE, ctx->frame);
+    return size;
+}
+
+/* Most payload bytes 'size' secret bytes can grow to: every frame stored, then sealed */
+static size_t worst_payload(const StegoContext *ctx, size_t size)
+{
+    if (ctx->codec != e_codec_none)
+        size += (size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE * PACK_HEADER_SIZE;
+    return ctx->encrypt ? aead_stream_size(size) : size;
+}
+
+/* Check the options of an embed */
+static Status check_options(StegoContext *ctx)
+{
+    if (ctx->depth == 0)
+        ctx->depth = MIN_DEPTH;
+    if (ctx->depth < MIN_DEPTH || ctx->depth > MAX_DEPTH)
+        return fail(ctx, "depth must be between 1 and 4");
+    if ((ctx->scatter || ctx->encrypt) && ctx->key == NULL)
+        return fail(ctx, "scatter and encryption need a key");
+    if (ctx->codec != e_codec_none && ctx->codec != e_codec_lz)
+        return fail(ctx, "unknown codec");
+    if (strlen(ctx->extn) >= STEGO_EXTN_SIZE)
+        return fail(ctx, "extension is too long");
+    return e_success;
+}
+
+/* Secret bytes 'image' can hold with the context's options */
+long stego_capacity(StegoContext *ctx, const unsigned char *image, size_t image_len)
+{
+    BmpInfo bmp;
+    Payload p;
+
+    ctx->error = NULL;
+    if (check_options(ctx) == e_failure || open_image(ctx, image, image_len, STEGO_HEADER_SIZE, ctx->alpha, &bmp, &p) == e_failure)
+        return -1;
+
+    // Same accounting as the encoder: header, data at 'depth' bits, CRC, one spare byte
+    size_t reserved = p.data_pos + STEGO_CHECKSUM_SIZE * 8 + 1;
+    if (p.bmp.usable <= reserved)
+        return 0;
+    size_t payload = (p.bmp.usable - reserved) * ctx->depth / 8;
+
+    // Largest secret whose worst case still fits
+    size_t lo = 0, hi = payload;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (worst_payload(ctx, mid) <= payload)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Embed 'secret_len' bytes of 'secret' into 'image' in place
+ * Header at one bit per carrier byte, then the payload (secret, frames or
+ * sealed stream) at the context's depth, then the payload CRC
+ */
+Status stego_embed(StegoContext *ctx, unsigned char *image, size_t image_len, const void *secret, size_t secret_len)
+{
+    const char *data = secret;
+    unsigned char header[STEGO_HEADER_MAX], crc[STEGO_CHECKSUM_SIZE];
+    BmpInfo bmp;
+    Payload p;
+
+    StatsMark mark;
+
+    ctx->error = NULL;
+    STATS_MARK(ctx->stats, &mark);
+    if (check_options(ctx) == e_failure || open_image(ctx, image, image_len, STEGO_HEADER_SIZE, ctx->alpha, &bmp, &p) == e_failure)
+        return e_failure;
+    if (secret_len > LONG_MAX)
+        return fail(ctx, "secret is too large");
+
+    // Payload size up front: compressed by a first pass, sealed adds the salt and one tag per chunk
+    size_t plain = ctx->codec != e_codec_none ? packed_size(ctx, data, secret_len) : secret_len;
+    size_t payload = ctx->encrypt ? aead_stream_size(plain) : plain;
+    if (p.bmp.usable <= p.data_pos + LSB_SPAN(payload, ctx->depth) + STEGO_CHECKSUM_SIZE * 8)
+        return fail(ctx, "image does not have enough capacity");
+    STATS_LAP(ctx->stats, &mark, e_stage_capacity, 0);
+
+    // Header fields, laid out as the command line encoder does
+    StegoHeader *h = &ctx->header;
+    memset(h, 0, sizeof(*h));
+    h->flags = strlen(ctx->extn) | (ctx->depth - 1) << EXTN_DEPTH_SHIFT | EXTN_CHECKSUM_FLAG |
+               (long)ctx->codec << EXTN_CODEC_SHIFT;
+    if (bmp_has_padding(&bmp))
+        h->flags |= EXTN_ROWS_FLAG;
+    if (ctx->alpha && bmp.pixel_bytes == 4)
+        h->flags |= EXTN_ALPHA_FLAG;
+    if (ctx->scatter)
+        h->flags |= EXTN_SCATTER_FLAG;
+    if (ctx->encrypt)
+        h->flags |= EXTN_SEALED_FLAG;
+    h->payload_size = payload;
+    strcpy(h->extn, ctx->extn);
+    size_t header_size = stego_header_pack(h, header);
+    bmp_embed(&bmp, (char *)image, 0, 0, (const char *)header, header_size, MIN_DEPTH);
+    STATS_LAP(ctx->stats, &mark, e_stage_stego_header, header_size);
+
+    begin_payload(&p, payload, ctx->depth, ctx->scatter, ctx->key);
+    p.plain_size = plain;
+    if (ctx->encrypt)
+    {
+        unsigned char salt[AEAD_SALT_SIZE];
+        if (aead_random_salt(salt) == e_failure)
+            return fail(ctx, "unable to get random bytes for the salt");
+        aead_derive_key(&p.key, ctx->key, salt);
+        payload_write(&p, (const char *)salt, AEAD_SALT_SIZE);
+    }
+
+    // Secret as is, or one frame per chunk
+    if (ctx->codec == e_codec_none)
+        plain_write(&p, data, secret_len);
+    for (size_t i = 0; ctx->codec != e_codec_none && i < secret_len; i += PACK_CHUNK_SIZE)
+    {
+        size_t len = secret_len - i < PACK_CHUNK_SIZE ? secret_len - i : PACK_CHUNK_SIZE;
+        plain_write(&p, ctx->frame, pack_frame(data + i, len, ctx->frame));
+    }
+
+    // Last (or only, possibly empty) record, then the partial unit
+    if (ctx->encrypt && (p.fill > 0 || plain == 0))
+        seal_chunk(&p);
+    if (p.held_len > 0)
+        put_units(&p, p.held, p.held_len);
+
+    put_be(crc, p.crc, STEGO_CHECKSUM_SIZE);
+    if (ctx->scatter)
+        scatter_embed(&p.sc, &p.bmp, (char *)image, p.data_pos, trailer_slot(&p), (const char *)crc, STEGO_CHECKSUM_SIZE, MIN_DEPTH);
+    else
+        bmp_embed(&p.bmp, (char *)image, 0, p.data_pos + trailer_slot(&p), (const char *)crc, STEGO_CHECKSUM_SIZE, MIN_DEPTH);
+    STATS_LAP(ctx->stats, &mark, e_stage_data, payload + STEGO_CHECKSUM_SIZE);
+    return e_success;
+}
+
+/* Hand 'len' secret bytes to the output, or only count them when measuring */
+static Status out_write(Payload *p, const char *data, size_t len)
+{
+    if (p->out != NULL)
+    {
+        if (p->out_size - p->out_len < len)
+            return fail(p->ctx, "output buffer is too small for the secret");
+        memcpy(p->out + p->out_len, data, len);
+    }
+    p->out_len += len;
+    return e_success;
+}
+
+/* Take plaintext bytes: the secret itself, or frames to decompress */
+static Status plain_read(Payload *p, const char *data, size_t len)
+{
+    StegoContext *ctx = p->ctx;
+
+    if (ctx->header.flags >> EXTN_CODEC_SHIFT & 3)
+    {
+        while (len > 0)
+        {
+            // Frame header first, then the rest of the frame it announces
+            size_t want = p->frame_size ? p->frame_size : PACK_HEADER_SIZE;
+            size_t take = want - p->frame_len < len ? want - p->frame_len : len;
+            memcpy(ctx->frame + p->frame_len, data, take);
+            p->frame_len += take;
+            data += take;
+            len -= take;
+
+            if (p->frame_size == 0 && p->frame_len == PACK_HEADER_SIZE &&
+                (p->frame_size = pack_frame_size(ctx->frame)) == 0)
+                return fail(ctx, "corrupt compressed frame");
+            if (p->frame_size != 0 && p->frame_len == p->frame_size)
+            {
+                long count = unpack_frame(ctx->frame, p->frame_size, ctx->chunk);
+                if (count < 0)
+                    return fail(ctx, "corrupt compressed frame");
+                if (out_write(p, ctx->chunk, count) == e_failure)
+                    return e_failure;
+                p->frame_len = p->frame_size = 0;
+            }
+        }
+        return e_success;
+    }
+    return out_write(p, data, len);
+}
+
+/* Find the container header of 'image' and lay out its payload
+ * Output: p (payload layout, sizes), *codec and *sealed from the header flags
+ */
+static Status open_payload(StegoContext *ctx, const unsigned char *image, size_t image_len, Payload *p, int *codec,
+                           int *sealed, StatsMark *mark)
+{
+    unsigned char header[STEGO_HEADER_MAX];
+    StegoHeader *h = &ctx->header;
+    BmpInfo bmp;
+
+    if (open_image(ctx, image, image_len, 0, 0, &bmp, p) == e_failure)
+        return e_failure;
+
+    // Magic, version and header size first, then the rest of the header in one call
+    size_t size = bmp.usable >= STEGO_HEADER_MAX * 8 ? STEGO_HEADER_MAX : 0;
+    if (size > 0)
+    {
+        bmp_extract(&bmp, (char *)header, (const char *)image, 0, 0, 4, MIN_DEPTH);
+        size = header[3];
+    }
+    if (size < STEGO_HEADER_SIZE || size > STEGO_HEADER_MAX || memcmp(header, MAGIC_STRING, strlen(MAGIC_STRING)) != 0 ||
+        header[2] != (STEGO_VERSION_MARK | STEGO_VERSION))
+        return fail(ctx, "no versioned stego header (older images need the command line decoder)");
+    bmp_extract(&bmp, (char *)header + 4, (const char *)image, 0, 4 * 8, size - 4, MIN_DEPTH);
+    if (stego_header_unpack(header, size, h) == e_failure)
+        return fail(ctx, "damaged stego header");
+    if (h->shard.count)
+        return fail(ctx, "image holds one shard of a split secret");
+    STATS_LAP(ctx->stats, mark, e_stage_stego_header, size);
+
+    // Options come from the header
+    *codec = h->flags >> EXTN_CODEC_SHIFT & 3;
+    *sealed = (h->flags & EXTN_SEALED_FLAG) != 0;
+    int scatter = (h->flags & EXTN_SCATTER_FLAG) != 0;
+    if (*codec > e_codec_lz)
+        return fail(ctx, "unknown codec");
+    if ((scatter || *sealed) && ctx->key == NULL)
+        return fail(ctx, "image is scattered or sealed, a key is needed");
+    strcpy(ctx->extn, h->extn);
+    if (open_image(ctx, image, image_len, size, (h->flags & EXTN_ALPHA_FLAG) != 0, &bmp, p) == e_failure)
+        return e_failure;
+    int depth = (h->flags >> EXTN_DEPTH_SHIFT & 3) + 1;
+    if (p->bmp.usable <= p->data_pos + LSB_SPAN(h->payload_size, depth) + STEGO_CHECKSUM_SIZE * 8)
+        return fail(ctx, "payload size exceeds the image");
+
+    begin_payload(p, h->payload_size, depth, scatter, ctx->key);
+    long plain = *sealed ? aead_plain_size(h->payload_size) : (long)h->payload_size;
+    if (plain < 0)
+        return fail(ctx, "damaged stego header");
+    p->plain_size = plain;
+    return e_success;
+}
+
+/* Extract the secret of 'image' into 'out' */
+Status stego_extract(StegoContext *ctx, const unsigned char *image, size_t image_len, void *out, size_t out_size,
+                     size_t *out_len)
+{
+    unsigned char crc[STEGO_CHECKSUM_SIZE];
+    StegoHeader *h = &ctx->header;
+    Payload p;
+    StatsMark mark;
+    int codec, sealed;
+
+    ctx->error = NULL;
+    *out_len = 0;
+    STATS_MARK(ctx->stats, &mark);
+    if (open_payload(ctx, image, image_len, &p, &codec, &sealed, &mark) == e_failure)
+        return e_failure;
+    p.out = out;
+    p.out_size = out_size;
+    long plain = p.plain_size;
+
+    // Known size and nothing to check it against: done without reading the payload
+    if (out == NULL && codec == e_codec_none && !(h->flags & EXTN_CHECKSUM_FLAG))
+    {
+        *out_len = plain;
+        return e_success;
+    }
+    if (out != NULL && codec == e_codec_none && (size_t)plain > out_size)
+        return fail(ctx, "output buffer is too small for the secret");
+
+    if (sealed)
+    {
+        // Salt, then one record per chunk, each checked before its bytes are used
+        unsigned char salt[AEAD_SALT_SIZE];
+        payload_read(&p, (char *)salt, AEAD_SALT_SIZE);
+        aead_derive_key(&p.key, ctx->key, salt);
+        do
+        {
+            size_t len = p.plain_size - p.plain_done < AEAD_CHUNK_SIZE ? p.plain_size - p.plain_done : AEAD_CHUNK_SIZE;
+            payload_read(&p, ctx->record, len + AEAD_TAG_SIZE);
+            if (aead_open_range(&p.key, p.plain_size, p.plain_done, p.plain_done + len, ctx->record, ctx->plain) == e_failure)
+                return fail(ctx, "wrong key or damaged payload");
+            if (plain_read(&p, ctx->plain, len) == e_failure)
+                return e_failure;
+            p.plain_done += len;
+        } while (p.plain_done < p.plain_size);
+    }
+    else if (codec == e_codec_none && out != NULL)
+    {
+        payload_read(&p, out, p.size);                 // Straight into the caller's buffer
+        p.out_len = p.size;
+    }
+    else
+    {
+        while (p.plain_done < p.plain_size)
+        {
+            size_t len = p.plain_size - p.plain_done < AEAD_RECORD_SIZE ? p.plain_size - p.plain_done : AEAD_RECORD_SIZE;
+            payload_read(&p, ctx->record, len);
+            if (plain_read(&p, ctx->record, len) == e_failure)
+                return e_failure;
+            p.plain_done += len;
+        }
+    }
+    if (p.frame_len != 0)
+        return fail(ctx, "compressed data ends inside a frame");
+
+    // Payload CRC right after the payload
+    if (h->flags & EXTN_CHECKSUM_FLAG)
+    {
+        if (p.scatter)
+            scatter_extract(&p.sc, &p.bmp, (char *)crc, (const char *)image, p.data_pos, trailer_slot(&p), STEGO_CHECKSUM_SIZE, MIN_DEPTH);
+        else
+            bmp_extract(&p.bmp, (char *)crc, (const char *)image, 0, p.data_pos + trailer_slot(&p), STEGO_CHECKSUM_SIZE, MIN_DEPTH);
+        if (get_be(crc, STEGO_CHECKSUM_SIZE) != p.crc)
+            return fail(ctx, "payload checksum mismatch");
+    }
+
+    *out_len = p.out_len;
+    STATS_LAP(ctx->stats, &mark, e_stage_data,
+              h->payload_size + (h->flags & EXTN_CHECKSUM_FLAG ? STEGO_CHECKSUM_SIZE : 0));
+    return e_success;
+}
+
+/* Read payload bytes [begin, begin + len) wherever they are: from the unit holding 'begin' on */
+static void payload_read_at(Payload *p, char *data, size_t begin, size_t len)
+{
+    const size_t group = LSB_GROUP(p->depth);
+    size_t skip = begin % group;
+
+    p->done = begin - skip;
+    p->held_len = p->held_pos = 0;
+    if (skip > 0)
+    {
+        p->held_len = p->size - p->done < group ? p->size - p->done : group;
+        get_units(p, p->held, p->held_len);
+        p->held_pos = skip;
+    }
+    payload_read(p, data, len);
+}
+
+/* Read bytes [begin, begin + len) under the seal: only the records they touch are opened */
+static Status plain_read_at(Payload *p, char *data, size_t begin, size_t len)
+{
+    StegoContext *ctx = p->ctx;
+
+    if (!(ctx->header.flags & EXTN_SEALED_FLAG))
+    {
+        payload_read_at(p, data, begin, len);
+        return e_success;
+    }
+    while (len > 0)
+    {
+        size_t index = begin / AEAD_CHUNK_SIZE, base = index * AEAD_CHUNK_SIZE;
+        size_t count = p->plain_size - base < AEAD_CHUNK_SIZE ? p->plain_size - base : AEAD_CHUNK_SIZE;
+
+        if (p->opened != index + 1)
+        {
+            payload_read_at(p, ctx->record, AEAD_SALT_SIZE + index * AEAD_RECORD_SIZE, count + AEAD_TAG_SIZE);
+            if (aead_open_range(&p->key, p->plain_size, base, base + count, ctx->record, ctx->plain) == e_failure)
+                return fail(ctx, "wrong key or damaged payload");
+            p->opened = index + 1;
+        }
+
+        size_t take = base + count - begin < len ? base + count - begin : len;
+        memcpy(data, ctx->plain + (begin - base), take);
+        data += take;
+        begin += take;
+        len -= take;
+    }
+    return e_success;
+}
+
+/* Extract secret bytes [offset, offset + length) of 'image' into 'out' */
+Status stego_extract_range(StegoContext *ctx, const unsigned char *image, size_t image_len, size_t offset,
+                           size_t length, void *out, size_t out_size, size_t *out_len)
+{
+    Payload p;
+    StatsMark mark;
+    int codec, sealed;
+
+    ctx->error = NULL;
+    *out_len = 0;
+    STATS_MARK(ctx->stats, &mark);
+    if (open_payload(ctx, image, image_len, &p, &codec, &sealed, &mark) == e_failure)
+        return e_failure;
+    p.out = out;
+    p.out_size = out_size;
+    size_t end = length > SIZE_MAX - offset ? SIZE_MAX : offset + length;
+
+    if (sealed)
+    {
+        unsigned char salt[AEAD_SALT_SIZE];
+        payload_read_at(&p, (char *)salt, 0, AEAD_SALT_SIZE);
+        aead_derive_key(&p.key, ctx->key, salt);
+    }
+
+    if (codec == e_codec_none)
+    {
+        if (offset > p.plain_size)
+            return fail(ctx, "offset is past the end of the secret");
+        if (end > p.plain_size)
+            end = p.plain_size;
+        if (out != NULL && end - offset > out_size)
+            return fail(ctx, "output buffer is too small for the range");
+        if (out != NULL && plain_read_at(&p, out, offset, end - offset) == e_failure)
+            return e_failure;
+        p.out_len = end - offset;
+    }
+    else
+    {
+        // Every frame but the last holds a whole chunk: the ones before the range are skipped by their headers
+        size_t pos = 0, base = 0;
+        while (pos < p.plain_size && base < end && offset < end)
+        {
+            if (plain_read_at(&p, ctx->frame, pos, PACK_HEADER_SIZE) == e_failure)
+                return e_failure;
+            size_t size = pack_frame_size(ctx->frame);
+            if (size == 0 || size > p.plain_size - pos)
+                return fail(ctx, "corrupt compressed frame");
+            if (base + PACK_CHUNK_SIZE <= offset && pos + size < p.plain_size)
+            {
+                pos += size;
+                base += PACK_CHUNK_SIZE;
+                continue;
+            }
+
+            long count;
+            if (plain_read_at(&p, ctx->frame + PACK_HEADER_SIZE, pos + PACK_HEADER_SIZE, size - PACK_HEADER_SIZE) ==
+                    e_failure ||
+                (count = unpack_frame(ctx->frame, size, ctx->chunk)) < 0)
+                return ctx->error ? e_failure : fail(ctx, "corrupt compressed frame");
+
+            size_t from = base > offset ? base : offset, to = base + count < end ? base + count : end;
+            if (from < to && out_write(&p, ctx->chunk + (from - base), to - from) == e_failure)
+                return e_failure;
+            pos += size;
+            base += count;
+        }
+        if (offset > base && offset < end)
+            return fail(ctx, "offset is past the end of the secret");
+    }
+
+    *out_len = p.out_len;
+    STATS_LAP(ctx->stats, &mark, e_stage_data, p.out_len);
+    return e_success;
+}
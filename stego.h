@@ -0,0 +1,98 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+#include "common.h"
+#include "pack.h"
+#include "aead.h"
+#include "stats.h"
+
+/*
+ * Library API: embed and extract between caller-owned buffers
+ * 'image' is a whole BMP file in memory (header, palette or masks and
+ * pixels), so images made here decode with the command line tool and the
+ * other way round. Nothing is allocated and nothing is printed: all
+ * scratch space is in the StegoContext, which the caller owns and reuses
+ * from one call to the next, one context per thread.
+ * Build: gcc -O2 -c stego.c bmp.c lsb.c scatter.c aead.c pack.c crc.c stats.c
+ *        ar rcs libstego.a stego.o bmp.o lsb.o scatter.o aead.o pack.o crc.o stats.o
+ */
+
+/* Container header fields, laid out as described in common.h */
+typedef struct _StegoHeader
+{
+    long flags; // extension size field: length, depth, layout and codec bits
+    uint64_t payload_size; // bytes embedded for the secret
+    char extn[STEGO_EXTN_SIZE]; // recorded extension, NUL terminated
+    ShardInfo shard; // place in a split secret, count 0 when not split
+} StegoHeader;
+
+typedef struct _StegoContext
+{
+    /* Options, set by the caller before stego_embed (decoding reads them from the image) */
+    int depth; // LSBs per carrier byte for the secret data, 0 or MIN_DEPTH-MAX_DEPTH
+    int alpha; // 32 bpp images: the secret data also uses the alpha bytes
+    int scatter; // spread the secret data over the image in keyed order
+    int encrypt; // seal the secret with ChaCha20-Poly1305
+    CodecType codec; // compression applied before sealing
+    const char *key; // passphrase for scatter and encryption, needed again to extract
+    char extn[STEGO_EXTN_SIZE]; // extension recorded for the secret (stego_extract fills it in)
+    Stats *stats; // per-stage timings added up over calls, NULL for none (see stats.h)
+
+    /* Result of the last call */
+    StegoHeader header; // header embedded or found
+    const char *error; // why the last call failed, NULL after a success
+
+    /* Scratch: one chunk of every stage of the pipeline */
+    char plain[AEAD_CHUNK_SIZE]; // chunk before sealing or after opening
+    char frame[PACK_FRAME_MAX]; // compressed frame
+    char record[AEAD_RECORD_SIZE]; // sealed record, or payload bytes in transit
+    char chunk[PACK_CHUNK_SIZE]; // decompressed chunk on its way to the output
+} StegoContext;
+
+/* Reset the options to the defaults: depth 1, no alpha, scatter, encryption, compression or stats, ".txt" */
+void stego_init(StegoContext *ctx);
+
+/* Secret bytes 'image' can hold with the context's options (before compression)
+ * Return Value: -1 if 'image' is not an uncompressed 8/24/32 bpp BMP
+ */
+long stego_capacity(StegoContext *ctx, const unsigned char *image, size_t image_len);
+
+/* Embed 'secret_len' bytes of 'secret' into 'image' in place
+ * Return Value: e_failure (with ctx->error) if the options are invalid,
+ * the image is not a BMP or the secret does not fit
+ */
+Status stego_embed(StegoContext *ctx, unsigned char *image, size_t image_len, const void *secret, size_t secret_len);
+
+/* Extract the secret of 'image' into 'out', which holds 'out_size' bytes
+ * 'out' may be NULL to only learn the secret's size; *out_len receives it
+ * Return Value: e_failure (with ctx->error) if there is no valid payload,
+ * the key is wrong, the checksum does not match or 'out' is too small
+ */
+Status stego_extract(StegoContext *ctx, const unsigned char *image, size_t image_len, void *out, size_t out_size,
+                     size_t *out_len);
+
+/* Extract only secret bytes [offset, offset + length) of 'image' into 'out'
+ * Only the carrier bytes behind the range are read (sealed records it
+ * touches are opened, compressed frames before it are stepped over by
+ * their headers), so the payload CRC is not checked. A range running past
+ * the end is cut short; *out_len receives its length ('out' may be NULL)
+ * Return Value: e_failure (with ctx->error) as stego_extract, or if
+ * 'offset' is past the end of the secret
+ */
+Status stego_extract_range(StegoContext *ctx, const unsigned char *image, size_t image_len, size_t offset,
+                           size_t length, void *out, size_t out_size, size_t *out_len);
+
+/* Build the container header for 'h'
+ * Return Value: header bytes written to 'header' (STEGO_HEADER_MAX at most)
+ */
+size_t stego_header_pack(const StegoHeader *h, unsigned char *header);
+
+/* Parse and check a container header of 'size' bytes
+ * Return Value: e_failure if the version, CRC or any field is invalid
+ */
+Status stego_header_unpack(const unsigned char *header, size_t size, StegoHeader *h);
+
+#endif
@@ -1,8 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "encode.h"
 #include "decode.h"
 #include "types.h"
+#include "lsb.h"
+#include "batch.h"
+#include "probe.h"
+#include "shard.h"
+#include "plan.h"
+#include "stats.h"
 
  /* Check operation type */
 OperationType check_operation_type(char *argv[])
@@ -11,15 +19,291 @@ OperationType check_operation_type(char *argv[])
         return e_encode;
     else if (strcmp(argv[1], "-d") == 0)
         return e_decode;
+    else if (strcmp(argv[1], "-b") == 0)
+        return e_batch;
+    else if (strcmp(argv[1], "-i") == 0)
+        return e_probe;
+    else if (strcmp(argv[1], "-p") == 0)
+        return e_plan;
     else
         return e_unsupported;
 }
 
+/* Parse a size argument with an optional K/M/G suffix */
+static int parse_size(const char *arg, size_t *value)
+{
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+
+    if (end == arg || strchr(arg, '-'))
+        return 0;                                               // strtoull would wrap a negative count
+    if (*end == 'K' || *end == 'k')
+        n <<= 10, end++;
+    else if (*end == 'M' || *end == 'm')
+        n <<= 20, end++;
+    else if (*end == 'G' || *end == 'g')
+        n <<= 30, end++;
+    if (*end != '\0')
+        return 0;
+
+    *value = n;
+    return 1;
+}
+
+/* Strip --options from argv, leaving the positional arguments in order
+ * Return Value: new argc, or -1 on a bad option
+ */
+static int parse_options(int argc, char *argv[], EncodeInfo *encInfo, DecodeInfo *decInfo, int *jobs, int *shards,
+                         int *stats, const char **index_fname)
+{
+    int out = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[out++] = argv[i];                  // Positional argument
+        }
+        else if (strcmp(argv[i], "--probe") == 0)
+        {
+            argv[out++] = "-i";                     // Long form of the operation flag
+        }
+        else if (strcmp(argv[i], "--plan") == 0)
+        {
+            argv[out++] = "-p";
+        }
+        else if ((strcmp(argv[i], "--offset") == 0 || strcmp(argv[i], "--length") == 0) && i + 1 < argc)
+        {
+            size_t value;
+            int offset = strcmp(argv[i], "--offset") == 0;
+
+            if (!parse_size(argv[++i], &value))
+            {
+                printf("ERROR: Invalid %s %s\n", offset ? "offset" : "length", argv[i]);
+                return -1;
+            }
+            if (!decInfo->range)
+            {
+                decInfo->range = 1;                 // The other bound defaults to the whole secret
+                decInfo->range_length = SIZE_MAX;
+            }
+            if (offset)
+                decInfo->range_offset = value;
+            else
+                decInfo->range_length = value;
+        }
+        else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc)
+        {
+            *index_fname = argv[++i];
+        }
+        else if (strcmp(argv[i], "--chunk-size") == 0 && i + 1 < argc)
+        {
+            if (!parse_size(argv[++i], &encInfo->chunk_size))
+            {
+                printf("ERROR: Invalid chunk size %s\n", argv[i]);
+                return -1;
+            }
+            decInfo->chunk_size = encInfo->chunk_size;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            encInfo->threads = decInfo->threads = atoi(argv[++i]);
+            if (encInfo->threads < 1 || encInfo->threads > MAX_THREADS)
+            {
+                printf("ERROR: Threads must be between 1 and %d\n", MAX_THREADS);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+        {
+            encInfo->depth = atoi(argv[++i]);
+            if (encInfo->depth < MIN_DEPTH || encInfo->depth > MAX_DEPTH)
+            {
+                printf("ERROR: Depth must be between %d and %d\n", MIN_DEPTH, MAX_DEPTH);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--secret-size") == 0 && i + 1 < argc)
+        {
+            size_t size;
+            if (!parse_size(argv[++i], &size))
+            {
+                printf("ERROR: Invalid secret size %s\n", argv[i]);
+                return -1;
+            }
+            encInfo->size_secret_file = size;
+            encInfo->secret_size_given = 1;
+        }
+        else if (strcmp(argv[i], "--extn") == 0 && i + 1 < argc)
+        {
+            if (argv[++i][0] != '.' || strlen(argv[i]) >= MAX_FILE_SUFFIX)
+            {
+                printf("ERROR: Invalid extension %s\n", argv[i]);
+                return -1;
+            }
+            strcpy(encInfo->extn_secret_file, argv[i]);
+        }
+        else if (strcmp(argv[i], "--alpha") == 0)
+        {
+            encInfo->alpha = 1;
+        }
+        else if (strcmp(argv[i], "--scatter") == 0)
+        {
+            encInfo->scatter = 1;
+        }
+        else if (strcmp(argv[i], "--compress") == 0)
+        {
+            encInfo->codec = e_codec_lz;
+        }
+        else if (strcmp(argv[i], "--encrypt") == 0)
+        {
+            encInfo->encrypt = 1;
+        }
+        else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc)
+        {
+            encInfo->key = decInfo->key = argv[++i];
+        }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            decInfo->verify = 1;
+        }
+        else if (strcmp(argv[i], "--verify-on-write") == 0)
+        {
+            encInfo->verify_write = 1;
+        }
+        else if (strcmp(argv[i], "--shards") == 0)
+        {
+            *shards = 1;
+        }
+        else if (strcmp(argv[i], "--in-place") == 0)
+        {
+            encInfo->write_mode = e_write_in_place;
+        }
+        else if (strcmp(argv[i], "--reflink") == 0)
+        {
+            encInfo->write_mode = e_write_reflink;
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+        {
+            *jobs = atoi(argv[++i]);
+            if (*jobs < 1 || *jobs > MAX_THREADS)
+            {
+                printf("ERROR: Jobs must be between 1 and %d\n", MAX_THREADS);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "auto") == 0)
+                encInfo->io_mode = decInfo->io_mode = e_io_auto;
+            else if (strcmp(argv[i], "stdio") == 0)
+                encInfo->io_mode = decInfo->io_mode = e_io_stdio;
+            else if (strcmp(argv[i], "mmap") == 0)
+                encInfo->io_mode = decInfo->io_mode = e_io_mmap;
+            else if (strcmp(argv[i], "uring") == 0)
+            {
+                encInfo->io_mode = e_io_uring;
+                decInfo->io_mode = e_io_stdio;              // Decoding has no io_uring path
+            }
+            else if (strcmp(argv[i], "pipeline") == 0)
+                encInfo->io_mode = decInfo->io_mode = e_io_pipeline;
+            else
+            {
+                printf("ERROR: Invalid I/O mode %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+        {
+            i++;
+#ifdef STEGO_NO_STATS
+            printf("ERROR: Built without stats (STEGO_NO_STATS)\n");
+            return -1;
+#endif
+            if (strcmp(argv[i], "json") == 0)
+                *stats = e_stats_json;
+            else if (strcmp(argv[i], "prometheus") == 0)
+                *stats = e_stats_prometheus;
+            else
+            {
+                printf("ERROR: Invalid stats format %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc)
+        {
+            KernelType kernel;
+
+            i++;
+            if (strcmp(argv[i], "auto") == 0)
+                kernel = e_kernel_auto;
+            else if (strcmp(argv[i], "scalar") == 0)
+                kernel = e_kernel_scalar;
+            else if (strcmp(argv[i], "sse2") == 0)
+                kernel = e_kernel_sse2;
+            else if (strcmp(argv[i], "avx2") == 0)
+                kernel = e_kernel_avx2;
+            else
+            {
+                printf("ERROR: Invalid kernel %s\n", argv[i]);
+                return -1;
+            }
+            if (lsb_select_kernel(kernel) == e_failure)
+            {
+                printf("ERROR: Kernel %s is not supported on this CPU\n", argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    // Scattered slots are reached through the memory map only
+    if (encInfo->scatter && encInfo->io_mode != e_io_auto && encInfo->io_mode != e_io_mmap)
+    {
+        printf("ERROR: --scatter needs memory-mapped files, use --io auto or --io mmap\n");
+        return -1;
+    }
+
+    argv[out] = NULL;
+    return out;
+}
+
 int main(int argc, char *argv[])
 {
     EncodeInfo encInfo;
     DecodeInfo decInfo;
     OperationType op_type;
+    int jobs = 1, shards = 0, stats = -1;
+    const char *index_fname = NULL;
+    Stats enc_stats = { .op = "encode" }, dec_stats = { .op = "decode" };
+
+    memset(&encInfo, 0, sizeof(encInfo));
+    memset(&decInfo, 0, sizeof(decInfo));
+    argc = parse_options(argc, argv, &encInfo, &decInfo, &jobs, &shards, &stats, &index_fname);
+    if (argc < 0)
+        return 1;
+    if (stats >= 0)
+    {
+        encInfo.stats = &enc_stats;                 // Batch jobs and shards add up into the same counters
+        decInfo.stats = &dec_stats;
+    }
+
+    if ((encInfo.scatter || encInfo.encrypt) && encInfo.key == NULL)
+    {
+        printf("ERROR: %s needs a --key passphrase\n", encInfo.scatter ? "--scatter" : "--encrypt");
+        return 1;
+    }
+
+    if (decInfo.range && (decInfo.verify || shards))
+    {
+        printf("ERROR: --offset and --length extract from one image, not with %s\n", shards ? "--shards" : "--verify");
+        return 1;
+    }
 
     if (argc < 3)
     {
@@ -27,19 +311,78 @@ int main(int argc, char *argv[])
         printf("Usage:\n");
         printf("Encoding: ./a.out -e <source.bmp> <secret.txt> <stego.bmp>\n");
         printf("Decoding: ./a.out -d <stego.bmp> <output.txt>\n");
+        printf("Verify:   ./a.out -d <stego.bmp> --verify\n");
+        printf("Shards:   ./a.out -e --shards <secret.txt> <stego.bmp> <carrier.bmp>... [--jobs N]\n");
+        printf("          ./a.out -d --shards <output.txt> <stego.N.bmp>... [--jobs N]\n");
+        printf("Batch:    ./a.out -b <manifest|-> [--jobs N]\n");
+        printf("Probe:    ./a.out -i|--probe <image.bmp|dir>... [--jobs N]\n");
+        printf("Plan:     ./a.out -p|--plan <dir> <secret|N[K|M|G]> [--index F] [--jobs N]\n");
+        printf("Options:\n");
+        printf("  --chunk-size <N[K|M]>  carrier bytes per I/O block (default 1M)\n");
+        printf("  --io <auto|stdio|mmap|uring|pipeline> file access strategy (default auto)\n");
+        printf("  --kernel <auto|scalar|sse2|avx2> LSB kernel (default auto)\n");
+        printf("  --stats <json|prometheus> per-stage time, bytes and system calls, on stderr\n");
+        printf("  --threads <N>          worker threads for the secret data (default 1)\n");
+        printf("  --depth <1-4>          LSBs per carrier byte for the secret data (default 1)\n");
+        printf("  --alpha                32 bpp carriers: secret data also uses the alpha bytes\n");
+        printf("  --scatter              spread the secret data over the carrier in an order derived from --key\n");
+        printf("  --compress             compress the secret (LZ77, 64K frames) before embedding\n");
+        printf("  --encrypt              seal the secret with ChaCha20-Poly1305 in 64K chunks, keyed by --key\n");
+        printf("  --key <passphrase>     key for --scatter and --encrypt (also needed to decode)\n");
+        printf("  --verify               decode: check the payload against its CRC32C, write no output\n");
+        printf("  --offset <N>           decode: start at secret byte N, reading only the carrier bytes behind the range\n");
+        printf("  --length <N>           decode: secret bytes to extract (default: to the end)\n");
+        printf("  --verify-on-write      encode: read every embedded block back before it is written, fsync at the end\n");
+        printf("  --in-place             rewrite only the payload range of an existing copy of the carrier\n");
+        printf("                         (<stego.bmp>, or <source.bmp> itself when omitted)\n");
+        printf("  --reflink              clone <source.bmp> into <stego.bmp>, then encode in place\n");
+        printf("  --shards               split the secret over several carriers, or join it back from them\n");
+        printf("  --jobs <N>             batch jobs, probed images or shards run concurrently (default 1)\n");
+        printf("  --index <file>         plan: carrier index to reuse and refresh (default <dir>/.stego-index)\n");
+        printf("  --secret-size <N>      length of a streamed secret (else 8-byte length prefix)\n");
+        printf("  --extn <.ext>          extension recorded for a streamed secret (default .txt)\n");
+        printf("  Use - for <source.bmp>, <secret> or <stego.bmp> to stream via stdin/stdout\n");
         return 1;
     }
 
     op_type = check_operation_type(argv);
 
-    if (op_type == e_encode)
+    if (shards && op_type == e_encode)
+    {
+        if (argc < 5)
+        {
+            printf("ERROR: --shards needs a secret, a stego name and at least one carrier\n");
+            return 1;
+        }
+        if (run_shard_encode(argv[2], argv[3], argv + 4, argc - 4, jobs, &encInfo) == e_success)
+            printf("INFO: Encoding completed successfully.\n");
+        else
+            printf("ERROR: Encoding failed.\n");
+    }
+    else if (shards && op_type == e_decode)
+    {
+        // Verifying writes nothing, so every argument is a stego image
+        int first = decInfo.verify ? 2 : 3;
+        if (argc <= first)
+        {
+            printf("ERROR: --shards needs %sat least one stego image\n", decInfo.verify ? "" : "an output name and ");
+            return 1;
+        }
+        if (run_shard_decode(argv[2], argv + first, argc - first, jobs, &decInfo) == e_success)
+            printf(decInfo.verify ? "INFO: Payload verified successfully.\n" : "INFO: Decoding completed successfully.\n");
+        else
+            printf(decInfo.verify ? "ERROR: Verification failed.\n" : "ERROR: Decoding failed.\n");
+    }
+    else if (op_type == e_encode)
     {
         if (read_and_validate_encode_args(argv, &encInfo) == e_success)
         {
+            // Status goes to stderr when stdout carries the stego image
+            FILE *msg = strcmp(encInfo.stego_image_fname, "-") == 0 ? stderr : stdout;
             if (do_encoding(&encInfo) == e_success)
-                printf("INFO: Encoding completed successfully.\n");
+                fprintf(msg, "INFO: Encoding completed successfully.\n");
             else
-                printf("ERROR: Encoding failed.\n");
+                fprintf(msg, "ERROR: Encoding failed.\n");
         }
         else
         {
@@ -50,20 +393,73 @@ int main(int argc, char *argv[])
     {
         if (read_and_validate_decode_args(argv, &decInfo) == e_success)
         {
+            // Status goes to stderr when stdout carries the secret
+            FILE *msg = strcmp(decInfo.out_fname, "-") == 0 ? stderr : stdout;
             if (do_decoding(&decInfo) == e_success)
-                printf("INFO: Decoding completed successfully.\n");
+                fprintf(msg, decInfo.verify ? "INFO: Payload verified successfully.\n" : "INFO: Decoding completed successfully.\n");
             else
-                printf("ERROR: Decoding failed.\n");
+                fprintf(msg, decInfo.verify ? "ERROR: Verification failed.\n" : "ERROR: Decoding failed.\n");
         }
         else
         {
             printf("ERROR: Validation failed.\n");
         }
     }
+    else if (op_type == e_batch)
+    {
+        FILE *manifest = strcmp(argv[2], "-") == 0 ? stdin : fopen(argv[2], "r");
+        if (manifest == NULL)
+        {
+            perror("fopen");
+            printf("ERROR: Unable to open manifest %s\n", argv[2]);
+            return 1;
+        }
+        if (run_batch(manifest, jobs, &encInfo, &decInfo) == e_failure)
+            fprintf(stderr, "ERROR: Some batch jobs failed.\n");
+        if (manifest != stdin)
+            fclose(manifest);
+    }
+    else if (op_type == e_probe)
+    {
+        if (run_probe(argv + 2, jobs) == e_failure)
+            fprintf(stderr, "ERROR: Some images could not be probed.\n");
+    }
+    else if (op_type == e_plan)
+    {
+        // The secret is sized from its file, or given as a byte count
+        PlanRequest req = { .secret_size = 0, .depth = encInfo.depth ? encInfo.depth : 1, .alpha = encInfo.alpha,
+                             .encrypt = encInfo.encrypt };
+        struct stat st;
+        size_t size;
+
+        if (argc < 4)
+        {
+            printf("ERROR: Plan needs a directory and a secret or its size\n");
+            return 1;
+        }
+        if (parse_size(argv[3], &size))
+            req.secret_size = size;
+        else if (stat(argv[3], &st) == 0)
+            req.secret_size = st.st_size;
+        else
+        {
+            printf("ERROR: Unable to size secret %s\n", argv[3]);
+            return 1;
+        }
+        if (run_plan(argv[2], index_fname, &req, jobs) == e_failure)
+            fprintf(stderr, "ERROR: No carrier fits.\n");
+    }
     else
     {
         printf("ERROR: Unsupported operation.\n");
     }
 
+    // Counters go to stderr: stdout may carry an image or a secret
+    if (stats >= 0)
+    {
+        const Stats *all[] = { &enc_stats, &dec_stats };
+        stats_print(stderr, stats, all, 2);
+    }
+
     return 0;
 }
@@ -4,6 +4,9 @@
 /* User defined types */
 typedef unsigned int uint;
 
+/* Upper bound for --threads */
+#define MAX_THREADS 64
+
 /* Status will be used in fn. return type */
 typedef enum
 {
@@ -15,7 +18,54 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_batch,
+    e_probe,
+    e_plan,
     e_unsupported
 } OperationType;
 
+/* How carrier and output files are accessed */
+typedef enum
+{
+    e_io_auto,  // memory-map when possible, stdio otherwise
+    e_io_stdio, // always use FILE* streams
+    e_io_mmap,  // memory-map or fail
+    e_io_uring, // stdio files, blocks read and written through io_uring (stdio when unavailable)
+    e_io_pipeline // stdio files, reader, embedder and writer threads joined by rings
+} IOMode;
+
+/* How the stego image is produced from the carrier */
+typedef enum
+{
+    e_write_copy,     // write a full new stego image
+    e_write_in_place, // stego image already holds the carrier, rewrite the payload range only
+    e_write_reflink   // clone the carrier into the stego image, then rewrite in place
+} WriteMode;
+
+/* Compression applied to the secret before embedding */
+typedef enum
+{
+    e_codec_none, // secret embedded as is
+    e_codec_lz    // LZ77 frames, see pack.h
+} CodecType;
+
+/* Place of one image's payload in a secret split over several images */
+typedef struct
+{
+    int index; // shard number, 0 first
+    int count; // shards in the set, 0 when the secret is not split
+    uint set; // random id shared by the shards of one secret
+    long offset; // secret offset of the shard's first byte
+    long total; // secret bytes over all shards
+} ShardInfo;
+
+/* LSB embed/extract kernel implementation */
+typedef enum
+{
+    e_kernel_auto,   // best kernel the CPU supports
+    e_kernel_scalar, // portable byte loop
+    e_kernel_sse2,   // 16 carrier bytes per step
+    e_kernel_avx2    // 32 carrier bytes per step
+} KernelType;
+
 #endif
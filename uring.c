@@ -0,0 +1,143 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+static int uring_ok;
+static pthread_once_t uring_once = PTHREAD_ONCE_INIT;
+
+/* Try a small ring: kernels before 5.6, seccomp filters and sysctls may refuse */
+static void uring_probe(void)
+{
+    Uring ring;
+
+    if (uring_init(&ring, 2) == e_success)
+    {
+        uring_ok = 1;
+        uring_exit(&ring);
+    }
+}
+
+/* Check once whether io_uring reads and writes work on this kernel */
+int uring_available(void)
+{
+    pthread_once(&uring_once, uring_probe);
+    return uring_ok;
+}
+
+/* Set up a ring with 'entries' submission slots */
+Status uring_init(Uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return e_failure;
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))                 // Came with IORING_OP_READ/WRITE (5.6)
+    {
+        close(ring->fd);
+        return e_failure;
+    }
+
+    // Both rings in one mapping when the kernel allows it
+    ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP && ring->cq_map_size > ring->sq_map_size)
+        ring->sq_map_size = ring->cq_map_size;
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = p.features & IORING_FEAT_SINGLE_MMAP ? ring->sq_map :
+                   mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        if (ring->sq_map != MAP_FAILED)
+            munmap(ring->sq_map, ring->sq_map_size);
+        if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+            munmap(ring->cq_map, ring->cq_map_size);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqes_size);
+        close(ring->fd);
+        return e_failure;
+    }
+
+    ring->entries = p.sq_entries;
+    ring->sq_head = (unsigned *)((char *)ring->sq_map + p.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_map + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_map + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_map + p.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_map + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_map + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_map + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_map + p.cq_off.cqes);
+    return e_success;
+}
+
+/* Tear the ring down */
+void uring_exit(Uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+}
+
+/* Queue a positional read or write tagged 'tag' */
+Status uring_queue(Uring *ring, int write, int fd, void *buf, size_t len, uint64_t off, uint64_t tag)
+{
+    unsigned tail = *ring->sq_tail;
+
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries)
+        return e_failure;
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = tag;
+    ring->sq_array[index] = index;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);   // Entry visible before the tail moves
+    ring->queued++;
+    return e_success;
+}
+
+/* Submit what is queued and reap one completion */
+Status uring_wait(Uring *ring, uint64_t *tag, int *res)
+{
+    for (;;)
+    {
+        unsigned head = *ring->cq_head;
+        int ready = head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        // Push new requests out even when a completion is waiting
+        if (ring->queued > 0 || !ready)
+        {
+            int n = syscall(__NR_io_uring_enter, ring->fd, ring->queued, ready ? 0 : 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (n < 0 && errno != EINTR)
+                return e_failure;
+            if (n > 0)
+                ring->queued -= n;
+        }
+        if (ready)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            *tag = cqe->user_data;
+            *res = cqe->res;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return e_success;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Minimal io_uring over the raw system calls (no liburing)
+ * Reads and writes are queued with a 64-bit tag, submitted together and
+ * reaped one completion at a time. Needs Linux 5.6 for IORING_OP_READ and
+ * IORING_OP_WRITE; uring_available tells whether the kernel allows it.
+ */
+
+#define URING_DEPTH 4 // blocks in flight in a pipeline: read, embed and write overlap
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+typedef struct _Uring
+{
+    int fd;
+    unsigned entries; // submission slots
+    unsigned queued; // requests prepared but not yet submitted
+
+    /* Submission ring */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+
+    /* Completion ring */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Mappings */
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+} Uring;
+
+/* Check once whether io_uring reads and writes work on this kernel */
+int uring_available(void);
+
+/* Set up a ring with 'entries' submission slots (a power of two) */
+Status uring_init(Uring *ring, unsigned entries);
+
+/* Tear the ring down; nothing may be in flight */
+void uring_exit(Uring *ring);
+
+/* Queue a positional read (write 0) or write (write 1) of 'len' bytes tagged 'tag'
+ * Return Value: e_failure if every submission slot is taken
+ */
+Status uring_queue(Uring *ring, int write, int fd, void *buf, size_t len, uint64_t off, uint64_t tag);
+
+/* Submit what is queued and reap one completion, waiting for it if needed
+ * Output: tag of the request and its result (bytes moved or -errno)
+ */
+Status uring_wait(Uring *ring, uint64_t *tag, int *res);
+
+#endif